@@ -20,6 +20,7 @@ struct avpu_dma_buffer *avpu_alloc_dma(struct device *dev, size_t size)
 		return NULL;
 
 	buf->size = size;
+	atomic_set(&buf->map_count, 0);
 	buf->cpu_handle = dma_alloc_coherent(dev, buf->size,
 					     &buf->dma_handle,
 					     GFP_KERNEL | GFP_DMA);
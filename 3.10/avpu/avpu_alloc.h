@@ -2,11 +2,13 @@
 #define _AL_ALLOC_H_
 
 #include <linux/device.h>
+#include <linux/atomic.h>
 
 struct avpu_dma_buffer {
 	u32 size;
 	dma_addr_t dma_handle;
 	void *cpu_handle;
+	atomic_t map_count;	/* live user mappings of the codec mmap path */
 };
 
 struct avpu_dma_buffer *avpu_alloc_dma(struct device *dev, size_t size);
@@ -28,16 +28,15 @@ int avpu_ioctl_get_dma_fd(struct device *dev, unsigned long arg)
 
 int add_buffer_to_list(struct avpu_codec_chan *chan, struct avpu_dma_buffer *buf)
 {
-	struct avpu_dma_buf_mmap *buf_mmap = kmalloc(sizeof(*buf_mmap), GFP_KERNEL);
+	int buf_id;
 
-	if (!buf_mmap)
-		return -1;
-	buf_mmap->buf = buf;
+	idr_preload(GFP_KERNEL);
 	spin_lock(&chan->lock);
-	list_add_tail(&buf_mmap->list, &chan->mem);
-	buf_mmap->buf_id = chan->num_bufs++;
+	buf_id = idr_alloc(&chan->mem, buf, 0, 0, GFP_NOWAIT);
 	spin_unlock(&chan->lock);
-	return buf_mmap->buf_id;
+	idr_preload_end();
+
+	return buf_id < 0 ? -1 : buf_id;
 }
 
 int avpu_ioctl_get_dma_mmap(struct device *dev, struct avpu_codec_chan *chan,
@@ -57,8 +56,10 @@ int avpu_ioctl_get_dma_mmap(struct device *dev, struct avpu_codec_chan *chan,
 	}
 
 	info.fd = add_buffer_to_list(chan, buf);
-	if (info.fd == -1)
+	if (info.fd == -1) {
+		avpu_free_dma(dev, buf);
 		return -ENOMEM;
+	}
 	/* offset for mmap needs to be a multiple of page size */
 	info.fd = info.fd << PAGE_SHIFT;
 
@@ -73,6 +74,38 @@ int avpu_ioctl_get_dma_mmap(struct device *dev, struct avpu_codec_chan *chan,
 	return 0;
 }
 
+int avpu_ioctl_put_dma_mmap(struct device *dev, struct avpu_codec_chan *chan,
+			   unsigned long arg)
+{
+	struct avpu_dma_info info;
+	struct avpu_dma_buffer *buf;
+	int buf_id;
+
+	if (copy_from_user(&info, (struct avpu_dma_info *)arg, sizeof(info)))
+		return -EFAULT;
+
+	/* userspace hands back the mmap offset returned by GET_DMA_MMAP */
+	buf_id = info.fd >> PAGE_SHIFT;
+
+	spin_lock(&chan->lock);
+	buf = idr_find(&chan->mem, buf_id);
+	/* the buffer must stay alive while userspace still maps it */
+	if (buf && atomic_read(&buf->map_count)) {
+		spin_unlock(&chan->lock);
+		return -EBUSY;
+	}
+	if (buf)
+		idr_remove(&chan->mem, buf_id);
+	spin_unlock(&chan->lock);
+
+	if (!buf)
+		return -EINVAL;
+
+	avpu_free_dma(dev, buf);
+
+	return 0;
+}
+
 int avpu_ioctl_get_dmabuf_dma_addr(struct device *dev, unsigned long arg)
 {
 	struct avpu_dma_info info;
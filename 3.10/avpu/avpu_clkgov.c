@@ -0,0 +1,237 @@
+#include <linux/clk.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/seq_file.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+
+#include "avpu_ip.h"
+#include "avpu_clkgov.h"
+
+/*
+ * Load based AVPU clock scaling.
+ *
+ * Every window the busy time accumulated by the irq handler (start
+ * register write to completion irq) is sampled. Above up_threshold the
+ * clock jumps back to avpu_clk, while a load that would still stay under
+ * down_threshold at the next lower operating point for down_windows
+ * consecutive windows steps the clock down by one point.
+ */
+static int avpu_clk_governor;
+module_param(avpu_clk_governor, int, S_IRUGO);
+MODULE_PARM_DESC(avpu_clk_governor, "start with load based clock scaling enabled");
+static int avpu_clk_opps[AVPU_CLKGOV_MAX_OPPS - 1] = {
+	400000000, 300000000, 200000000,
+};
+static int avpu_clk_opps_nr = 3;
+module_param_array(avpu_clk_opps, int, &avpu_clk_opps_nr, S_IRUGO);
+MODULE_PARM_DESC(avpu_clk_opps, "lower avpu operating points in Hz, descending");
+static int avpu_gov_window_ms = 100;
+module_param(avpu_gov_window_ms, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(avpu_gov_window_ms, "load sampling window");
+static int avpu_gov_up_threshold = 80;
+module_param(avpu_gov_up_threshold, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(avpu_gov_up_threshold, "busy percent to go back to avpu_clk");
+static int avpu_gov_down_threshold = 60;
+module_param(avpu_gov_down_threshold, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(avpu_gov_down_threshold, "max busy percent expected after stepping down");
+static int avpu_gov_down_windows = 5;
+module_param(avpu_gov_down_windows, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(avpu_gov_down_windows, "quiet windows needed before stepping down");
+
+/* called with gov->lock held */
+static void avpu_clkgov_set(struct avpu_codec_desc *codec, int index)
+{
+	struct avpu_clkgov *gov = &codec->clkgov;
+	int ret;
+
+	ret = clk_set_rate(codec->clk, gov->opps[index]);
+	if (ret) {
+		avpu_err("clk_set_rate %lu failed: %d\n", gov->opps[index], ret);
+		return;
+	}
+	gov->cur = index;
+	avpu_dbg("clock set to %lu Hz\n", clk_get_rate(codec->clk));
+}
+
+static void avpu_clkgov_schedule(struct avpu_clkgov *gov)
+{
+	schedule_delayed_work(&gov->work,
+			      msecs_to_jiffies(max(avpu_gov_window_ms, 10)));
+}
+
+static void avpu_clkgov_work(struct work_struct *work)
+{
+	struct avpu_clkgov *gov = container_of(to_delayed_work(work),
+					       struct avpu_clkgov, work);
+	struct avpu_codec_desc *codec = container_of(gov,
+					       struct avpu_codec_desc, clkgov);
+	ktime_t now = ktime_get();
+	bool running;
+	u64 busy, delta, window;
+	int target;
+
+	busy = avpu_stats_busy_ns(codec, now, &running);
+
+	mutex_lock(&gov->lock);
+	if (!gov->automatic)
+		goto unlock;
+
+	window = ktime_to_ns(ktime_sub(now, gov->last_sample));
+	/* stats restart from zero when a new channel is bound */
+	delta = busy >= gov->last_busy_ns ? busy - gov->last_busy_ns : busy;
+	gov->last_busy_ns = busy;
+	gov->last_sample = now;
+	gov->load = window ? min_t(u64, div64_u64(delta * 100, window), 100) : 0;
+
+	target = gov->cur;
+	if (gov->load >= avpu_gov_up_threshold) {
+		target = 0;
+		gov->low_windows = 0;
+	} else if (gov->cur + 1 < gov->nr_opps &&
+		   (u64)gov->load * gov->opps[gov->cur] <
+		   (u64)avpu_gov_down_threshold * gov->opps[gov->cur + 1]) {
+		if (++gov->low_windows >= avpu_gov_down_windows)
+			target = gov->cur + 1;
+	} else {
+		gov->low_windows = 0;
+	}
+
+	/*
+	 * never retune in the middle of a frame, try again next window.
+	 * running is sampled under i_lock, but clk_set_rate() sleeps and
+	 * cannot run under it, so a run kicked right after the sample still
+	 * sees the new rate. That only stretches or shortens that one run,
+	 * the same as a rate pinned through the avpu_clk proc file.
+	 */
+	if (target != gov->cur && !running) {
+		avpu_clkgov_set(codec, target);
+		gov->low_windows = 0;
+	}
+
+	avpu_clkgov_schedule(gov);
+unlock:
+	mutex_unlock(&gov->lock);
+}
+
+int avpu_clkgov_init(struct avpu_codec_desc *codec, unsigned long max_rate)
+{
+	struct avpu_clkgov *gov = &codec->clkgov;
+	int i;
+
+	mutex_init(&gov->lock);
+	INIT_DELAYED_WORK(&gov->work, avpu_clkgov_work);
+
+	gov->opps[0] = max_rate;
+	gov->nr_opps = 1;
+	for (i = 0; i < avpu_clk_opps_nr; i++) {
+		if (avpu_clk_opps[i] <= 0 ||
+		    avpu_clk_opps[i] >= gov->opps[gov->nr_opps - 1]) {
+			avpu_err("ignoring operating point %d Hz\n", avpu_clk_opps[i]);
+			continue;
+		}
+		gov->opps[gov->nr_opps++] = avpu_clk_opps[i];
+	}
+	gov->cur = 0;
+
+	if (avpu_clk_governor) {
+		gov->automatic = true;
+		gov->last_sample = ktime_get();
+		avpu_clkgov_schedule(gov);
+	}
+
+	return 0;
+}
+
+void avpu_clkgov_exit(struct avpu_codec_desc *codec)
+{
+	struct avpu_clkgov *gov = &codec->clkgov;
+
+	mutex_lock(&gov->lock);
+	gov->automatic = false;
+	mutex_unlock(&gov->lock);
+	cancel_delayed_work_sync(&gov->work);
+}
+
+static int avpu_clkgov_show(struct seq_file *m, void *v)
+{
+	struct avpu_codec_desc *codec = (struct avpu_codec_desc *)(m->private);
+	struct avpu_clkgov *gov = &codec->clkgov;
+	int i;
+
+	mutex_lock(&gov->lock);
+	seq_printf(m, "mode %s\n", gov->automatic ? "auto" : "fixed");
+	seq_printf(m, "rate %lu Hz\n", clk_get_rate(codec->clk));
+	seq_printf(m, "load %u%%\n", gov->load);
+	seq_printf(m, "opps:");
+	for (i = 0; i < gov->nr_opps; i++)
+		seq_printf(m, " %s%lu", i == gov->cur ? "*" : "", gov->opps[i]);
+	seq_printf(m, "\n");
+	mutex_unlock(&gov->lock);
+
+	return 0;
+}
+
+static int avpu_clkgov_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, avpu_clkgov_show, PDE_DATA(inode));
+}
+
+/*
+ * echo auto > avpu_clk        : enable scaling
+ * echo 300000000 > avpu_clk   : pin the clock, the rate must be an opp
+ */
+static ssize_t avpu_clkgov_write(struct file *file, const char __user *buf,
+				 size_t len, loff_t *off)
+{
+	struct seq_file *m = file->private_data;
+	struct avpu_codec_desc *codec = (struct avpu_codec_desc *)(m->private);
+	struct avpu_clkgov *gov = &codec->clkgov;
+	char kbuf[16];
+	unsigned long rate;
+	int i;
+
+	if (len >= sizeof(kbuf))
+		return -EINVAL;
+	if (copy_from_user(kbuf, buf, len))
+		return -EFAULT;
+	kbuf[len] = '\0';
+
+	if (!strcmp(strim(kbuf), "auto")) {
+		mutex_lock(&gov->lock);
+		if (!gov->automatic) {
+			gov->automatic = true;
+			gov->low_windows = 0;
+			gov->last_busy_ns = avpu_stats_busy_ns(codec, ktime_get(), NULL);
+			gov->last_sample = ktime_get();
+			avpu_clkgov_schedule(gov);
+		}
+		mutex_unlock(&gov->lock);
+		return len;
+	}
+
+	if (kstrtoul(strim(kbuf), 0, &rate))
+		return -EINVAL;
+	for (i = 0; i < gov->nr_opps; i++)
+		if (gov->opps[i] == rate)
+			break;
+	if (i == gov->nr_opps)
+		return -EINVAL;
+
+	mutex_lock(&gov->lock);
+	gov->automatic = false;
+	avpu_clkgov_set(codec, i);
+	mutex_unlock(&gov->lock);
+
+	return len;
+}
+
+const struct file_operations avpu_clkgov_fops = {
+	.read = seq_read,
+	.write = avpu_clkgov_write,
+	.open = avpu_clkgov_open,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <linux/fs.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+
+#define AVPU_CLKGOV_MAX_OPPS 8
+
+struct avpu_codec_desc;
+
+struct avpu_clkgov {
+	struct delayed_work work;
+	struct mutex lock;
+	/* operating points in Hz, descending, opps[0] is avpu_clk */
+	unsigned long opps[AVPU_CLKGOV_MAX_OPPS];
+	int nr_opps;
+	int cur;
+	bool automatic;
+	int low_windows;
+	u32 load;
+	u64 last_busy_ns;
+	ktime_t last_sample;
+};
+
+int avpu_clkgov_init(struct avpu_codec_desc *codec, unsigned long max_rate);
+void avpu_clkgov_exit(struct avpu_codec_desc *codec);
+
+extern const struct file_operations avpu_clkgov_fops;
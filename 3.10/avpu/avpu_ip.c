@@ -16,6 +16,102 @@
 
 #include "avpu_ip.h"
 
+static inline int avpu_hist_bucket(u32 us)
+{
+	return min(fls(us), AVPU_HIST_BUCKETS - 1);
+}
+
+static inline u32 avpu_delta_us(ktime_t later, ktime_t earlier)
+{
+	s64 us = ktime_us_delta(later, earlier);
+
+	return us < 0 ? 0 : (u32)min_t(s64, us, U32_MAX);
+}
+
+/*
+ * called with i_lock held. A configuration write that starts no run gets
+ * no irq either, such a run is dropped once it is older than any frame
+ * could be, so it neither inflates the busy time nor keeps the clock
+ * governor from retuning.
+ */
+static void avpu_stats_expire(struct avpu_codec_desc *codec, ktime_t now)
+{
+	struct avpu_stats *st = &codec->stats;
+
+	if (!st->running ||
+	    ktime_to_ns(ktime_sub(now, st->kick)) < AVPU_STATS_RUN_TIMEOUT_MS * NSEC_PER_MSEC)
+		return;
+	st->stale_kicks++;
+	st->running = false;
+}
+
+/*
+ * called with i_lock held, for every register write but the irq mask and
+ * status ones. The start register layout is not documented here, so a run
+ * is taken to begin with the first write after the IP went idle (the irq
+ * that ended the previous run) and the busy time is an upper bound that
+ * includes the programming of the run.
+ */
+static void avpu_stats_kick(struct avpu_codec_desc *codec)
+{
+	struct avpu_stats *st = &codec->stats;
+	ktime_t now = ktime_get();
+
+	avpu_stats_expire(codec, now);
+	if (st->running)
+		return;
+	st->kicks++;
+	st->kick = now;
+	st->running = true;
+}
+
+/* called with i_lock held */
+static void avpu_stats_done(struct avpu_codec_desc *codec, ktime_t now)
+{
+	struct avpu_stats *st = &codec->stats;
+	u32 us;
+
+	if (!st->running)
+		return;
+
+	st->busy_ns += ktime_to_ns(ktime_sub(now, st->kick));
+	us = avpu_delta_us(now, st->kick);
+	st->kick_hist[avpu_hist_bucket(us)]++;
+	if (us > st->kick_max_us)
+		st->kick_max_us = us;
+	st->running = false;
+}
+
+/* busy time since the channel was bound, including a run in progress */
+u64 avpu_stats_busy_ns(struct avpu_codec_desc *codec, ktime_t now, bool *running)
+{
+	struct avpu_stats *st = &codec->stats;
+	unsigned long flags;
+	u64 busy;
+
+	spin_lock_irqsave(&codec->i_lock, flags);
+	avpu_stats_expire(codec, now);
+	busy = st->busy_ns;
+	if (st->running)
+		busy += ktime_to_ns(ktime_sub(now, st->kick));
+	if (running)
+		*running = st->running;
+	spin_unlock_irqrestore(&codec->i_lock, flags);
+
+	return busy;
+}
+
+/* called with i_lock held, once userspace has dequeued irq */
+void avpu_stats_wakeup(struct avpu_codec_desc *codec, struct r_irq *irq)
+{
+	struct avpu_stats *st = &codec->stats;
+	u32 us = avpu_delta_us(ktime_get(), irq->ts);
+
+	st->wake_hist[avpu_hist_bucket(us)]++;
+	if (us > st->wake_max_us)
+		st->wake_max_us = us;
+}
+
 int avpu_codec_bind_channel(struct avpu_codec_chan *chan,
 			    struct inode *inode)
 {
@@ -48,6 +144,8 @@ int avpu_codec_bind_channel(struct avpu_codec_chan *chan,
 	}
 
 	codec->chan = chan;
+	memset(&codec->stats, 0, sizeof(codec->stats));
+	codec->stats.start = ktime_get();
 
 unlock:
 	spin_unlock_irqrestore(&codec->i_lock, flags);
@@ -90,13 +188,18 @@ void avpu_codec_write_register(struct avpu_codec_chan *chan,
 			       struct avpu_reg *reg)
 {
 	struct avpu_codec_desc *codec = chan->codec;
+	unsigned long flags;
 
 	if (!chan->codec->regs) {
 		avpu_err("Registers not mapped\n");
 		return;
 	}
-	iowrite32(reg->value, chan->codec->regs + reg->id);
 
+	spin_lock_irqsave(&codec->i_lock, flags);
+	if (reg->id != AVPU_INTERRUPT_MASK && reg->id != AVPU_INTERRUPT)
+		avpu_stats_kick(codec);
+	iowrite32(reg->value, chan->codec->regs + reg->id);
+	spin_unlock_irqrestore(&codec->i_lock, flags);
 }
 
 irqreturn_t avpu_hardirq_handler(int irq, void *data)
@@ -108,7 +211,8 @@ irqreturn_t avpu_hardirq_handler(int irq, void *data)
 	struct r_irq *i_callback;
 	int callback_nb;
 	int i = 0;
-	int avpu_interrupt_nb = 20;
+	int avpu_interrupt_nb = AVPU_IRQ_NB;
+	ktime_t now = ktime_get();
 
 	mask = ioread32(codec->regs + AVPU_INTERRUPT_MASK);
 	unmasked_irq_bitfield = ioread32(codec->regs + AVPU_INTERRUPT);
@@ -126,16 +230,23 @@ irqreturn_t avpu_hardirq_handler(int irq, void *data)
 			i_callback = kmem_cache_alloc(codec->cache, GFP_ATOMIC);
 			if (!i_callback) {
 				avpu_dbg("ENOMEM: Missed interrupt\n");
+				spin_lock_irqsave(&codec->i_lock, flags);
+				codec->stats.lost_irqs++;
+				spin_unlock_irqrestore(&codec->i_lock, flags);
 				return IRQ_NONE;
 			}
 			i_callback->bitfield = i;
+			i_callback->ts = now;
 			spin_lock_irqsave(&codec->i_lock, flags);
 			list_add_tail(&i_callback->list, &codec->irq_masks);
+			codec->stats.irqs[i]++;
 			spin_unlock_irqrestore(&codec->i_lock, flags);
 		}
 	}
 
 	spin_lock_irqsave(&codec->i_lock, flags);
+	/* the IP raises no irq while idle, any of them ends the current run */
+	avpu_stats_done(codec, now);
 	if (codec->chan)
 		wake_up_interruptible(&codec->chan->irq_queue);
 	spin_unlock_irqrestore(&codec->i_lock, flags);
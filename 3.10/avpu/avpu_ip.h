@@ -7,9 +7,14 @@
 #include <linux/spinlock.h>
 #include <linux/slab.h>
 #include <linux/clk.h>
+#include <linux/idr.h>
+#include <linux/ktime.h>
+#include <linux/proc_fs.h>
+#include <jz_proc.h>
 
 #include "avpu_ioctl.h"
 #include "avpu_alloc.h"
+#include "avpu_clkgov.h"
 
 #define AVPU_NR_DEVS 4
 
@@ -23,6 +28,11 @@
 #define AVPU_INTERRUPT_MASK (AVPU_BASE_OFFSET + 0x14)
 #define AVPU_INTERRUPT (AVPU_BASE_OFFSET + 0x18)
 
+#define AVPU_IRQ_NB 20
+#define AVPU_HIST_BUCKETS 16
+/* no frame takes this long, a kick without irq by then started no run */
+#define AVPU_STATS_RUN_TIMEOUT_MS 200
+
 #define avpu_writel(val, reg) iowrite32(val, codec->regs + reg)
 #define avpu_readl(reg) ioread32(codec->regs + reg)
 
@@ -44,6 +54,26 @@ struct dma_buf_info {
 struct r_irq {
 	struct list_head list;
 	u32 bitfield;
+	ktime_t ts;
+};
+
+/*
+ * Utilisation counters of the bound channel, reset on open and
+ * protected by i_lock. Histogram bucket n counts samples below 2^n us.
+ */
+struct avpu_stats {
+	ktime_t start;
+	ktime_t kick;
+	bool running;
+	u64 busy_ns;
+	u32 kicks;
+	u32 stale_kicks;
+	u32 irqs[AVPU_IRQ_NB];
+	u32 lost_irqs;
+	u32 kick_max_us;
+	u32 wake_max_us;
+	u32 kick_hist[AVPU_HIST_BUCKETS];
+	u32 wake_hist[AVPU_HIST_BUCKETS];
 };
 
 struct avpu_codec_desc {
@@ -56,6 +86,9 @@ struct avpu_codec_desc {
 	struct list_head irq_masks;
 	spinlock_t i_lock;
 	struct kmem_cache *cache;
+	struct avpu_stats stats;
+	struct avpu_clkgov clkgov;
+	struct proc_dir_entry *proc;
 	int minor;
 	struct clk *clk;
 	struct clk *clk_mux;
@@ -66,18 +99,12 @@ struct avpu_codec_desc {
 	struct clk *ahb1_gate;
 };
 
-struct avpu_dma_buf_mmap {
-	struct list_head list;
-	struct avpu_dma_buffer *buf;
-	int buf_id;
-};
-
 struct avpu_codec_chan {
 	wait_queue_head_t irq_queue;
 	int unblock;
 	spinlock_t lock;
-	struct list_head mem;
-	int num_bufs;
+	/* buf_id (mmap offset >> PAGE_SHIFT) -> struct avpu_dma_buffer */
+	struct idr mem;
 	struct avpu_codec_desc *codec;
 };
 
@@ -85,5 +112,7 @@ int avpu_codec_bind_channel(struct avpu_codec_chan *chan, struct inode *inode);
 void avpu_codec_unbind_channel(struct avpu_codec_chan *chan);
 int avpu_codec_read_register(struct avpu_codec_chan *chan, struct avpu_reg *reg);
 void avpu_codec_write_register(struct avpu_codec_chan *chan, struct avpu_reg *reg);
+u64 avpu_stats_busy_ns(struct avpu_codec_desc *codec, ktime_t now, bool *running);
+void avpu_stats_wakeup(struct avpu_codec_desc *codec, struct r_irq *irq);
 irqreturn_t avpu_irq_handler(int irq, void *data);
 irqreturn_t avpu_hardirq_handler(int irq, void *data);
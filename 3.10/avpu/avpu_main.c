@@ -12,6 +12,7 @@
 #include <linux/io.h>
 #include <linux/kernel.h>
 #include <linux/kfifo.h>
+#include <linux/math64.h>
 #include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/moduleparam.h>
@@ -20,9 +21,12 @@
 #include <linux/of_irq.h>
 #include <linux/of_platform.h>
 #include <linux/platform_device.h>
+#include <linux/poll.h>
 #include <linux/sched.h>
+#include <linux/seq_file.h>
 #include <linux/signal.h>
 #include <linux/slab.h>
+#include <linux/sort.h>
 #include <linux/stddef.h>
 #include <linux/uaccess.h>
 #include <linux/vmalloc.h>
@@ -45,6 +49,7 @@ MODULE_PARM_DESC(clk_name, "chose parent clk");
 static int avpu_clk = 550000000;
 module_param(avpu_clk, int, S_IRUGO);
 MODULE_PARM_DESC(avpu_clk, "avpu clock freq");
+/* 0 uses the L1 dcache size, as the mips dma cache ops do for one range */
 static struct class *module_class;
 
 struct flush_cache_info {
@@ -56,6 +61,12 @@ struct flush_cache_info {
 	unsigned int	dir;
 };
 
+#define FLUSH_CACHE_BATCH_MAX	256
+struct flush_cache_batch {
+	unsigned int		count;
+	struct flush_cache_info	*info;
+};
+
 static void jz_avpu_release(struct device *dev) {
 	return;
 }
@@ -114,9 +125,8 @@ static int avpu_codec_open(struct inode *inode, struct file *filp) {
 		goto fail;
 	}
 
-	INIT_LIST_HEAD(&chan->mem);
+	idr_init(&chan->mem);
 	spin_lock_init(&chan->lock);
-	chan->num_bufs = 0;
 
 	filp->private_data = chan;
 
@@ -137,17 +147,20 @@ fail:
 	return ret;
 }
 
+static int free_buffer_by_id(int id, void *p, void *data) {
+	struct avpu_codec_chan *chan = data;
+
+	avpu_free_dma(chan->codec->device, p);
+	return 0;
+}
+
 static int avpu_codec_release(struct inode *inode, struct file *filp) {
 	struct avpu_codec_chan *chan = filp->private_data;
-	struct avpu_dma_buf_mmap *tmp;
-	struct list_head *pos, *n;
 //	printk("--------------%s(%d)-----------\n", __func__, __LINE__);
 	avpu_codec_unbind_channel(chan);
-	list_for_each_safe(pos, n, &chan->mem){
-		tmp = list_entry(pos, struct avpu_dma_buf_mmap, list);
-		list_del(pos);
-		kfree(tmp);
-	}
+	/* all mappings are gone by now, they hold a reference on filp */
+	idr_for_each(&chan->mem, free_buffer_by_id, chan);
+	idr_destroy(&chan->mem);
 
 	kfree(chan);
 //	printk("--------------%s(%d)-----------\n", __func__, __LINE__);
@@ -163,17 +176,24 @@ static long avpu_codec_compat_ioctl(struct file *file, unsigned int cmd, unsigne
 	return ret;
 }
 
-static struct avpu_dma_buffer *find_buf_by_id(struct avpu_codec_chan *chan, int desc_id) {
-	struct avpu_dma_buf_mmap *cur_buf_mmap;
+/* PUT_DMA_MMAP refuses to free a buffer while map_count is not zero */
+static void avpu_dma_vm_open(struct vm_area_struct *vma) {
+	struct avpu_dma_buffer *buf = vma->vm_private_data;
 
-	list_for_each_entry(cur_buf_mmap, &chan->mem, list){
-		if (cur_buf_mmap->buf_id == desc_id)
-			return cur_buf_mmap->buf;
-	}
+	atomic_inc(&buf->map_count);
+}
+
+static void avpu_dma_vm_close(struct vm_area_struct *vma) {
+	struct avpu_dma_buffer *buf = vma->vm_private_data;
 
-	return NULL;
+	atomic_dec(&buf->map_count);
 }
 
+static const struct vm_operations_struct avpu_dma_vm_ops = {
+	.open = avpu_dma_vm_open,
+	.close = avpu_dma_vm_close,
+};
+
 static int avpu_dma_mmap(struct file *filp, struct vm_area_struct *vma) {
 	struct avpu_codec_chan *chan = filp->private_data;
 	unsigned long start = vma->vm_start;
@@ -181,7 +201,14 @@ static int avpu_dma_mmap(struct file *filp, struct vm_area_struct *vma) {
 	/* offset if already in page */
 	int desc_id = vma->vm_pgoff;
 	int ret = 0;
-	struct avpu_dma_buffer *buf = find_buf_by_id(chan, desc_id);
+	struct avpu_dma_buffer *buf;
+
+	/* taken under the idr lock so a racing PUT_DMA_MMAP sees the mapping */
+	spin_lock(&chan->lock);
+	buf = idr_find(&chan->mem, desc_id);
+	if (buf)
+		atomic_inc(&buf->map_count);
+	spin_unlock(&chan->lock);
 
 	if (!buf)
 		return -EINVAL;
@@ -192,10 +219,13 @@ static int avpu_dma_mmap(struct file *filp, struct vm_area_struct *vma) {
 				buf->dma_handle, vsize);
 	if (ret < 0) {
 		pr_err("Remapping memory failed, error: %d\n", ret);
+		atomic_dec(&buf->map_count);
 		return ret;
 	}
 
 	vma->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP;
+	vma->vm_private_data = buf;
+	vma->vm_ops = &avpu_dma_vm_ops;
 
 	return 0;
 }
@@ -207,19 +237,22 @@ static int unblock_channel(struct avpu_codec_chan *chan) {
 	return 0;
 }
 
-static int wait_irq(struct avpu_codec_chan *chan, unsigned long arg) {
+static int wait_irq(struct avpu_codec_chan *chan, struct file *filp, unsigned long arg) {
 	struct avpu_codec_desc *codec = chan->codec;
 	int callback;
 	struct r_irq *i_callback;
 	unsigned long flags;
-	int ret;
+	int ret = 0;
 
 //	printk("--------------%s(%d)-----------\n", __func__, __LINE__);
-	ret = wait_event_interruptible(chan->irq_queue,
-				       channel_is_ready(chan));
+again:
+	if (!(filp->f_flags & O_NONBLOCK)) {
+		ret = wait_event_interruptible(chan->irq_queue,
+					       channel_is_ready(chan));
+		if (ret == -ERESTARTSYS)
+			return ret;
+	}
 //	printk("--------------%s(%d)-----------\n", __func__, __LINE__);
-	if (ret == -ERESTARTSYS)
-		return ret;
 	if (chan->unblock) {
 		avpu_dbg("Unblocking channel\n");
 		return -EINTR;
@@ -227,10 +260,18 @@ static int wait_irq(struct avpu_codec_chan *chan, unsigned long arg) {
 
 //	printk("--------------%s(%d)-----------\n", __func__, __LINE__);
 	spin_lock_irqsave(&codec->i_lock, flags);
+	/* a racing reader may have taken the event, blocking callers wait again */
+	if (list_empty(&codec->irq_masks)) {
+		spin_unlock_irqrestore(&codec->i_lock, flags);
+		if (!(filp->f_flags & O_NONBLOCK))
+			goto again;
+		return -EAGAIN;
+	}
 	i_callback = list_first_entry(&chan->codec->irq_masks,
 				      struct r_irq, list);
 	callback = i_callback->bitfield;
 	list_del(&i_callback->list);
+	avpu_stats_wakeup(codec, i_callback);
 	kmem_cache_free(codec->cache, i_callback);
 	spin_unlock_irqrestore(&codec->i_lock, flags);
 //	printk("--------------%s(%d)-----------\n", __func__, __LINE__);
@@ -241,6 +282,20 @@ static int wait_irq(struct avpu_codec_chan *chan, unsigned long arg) {
 	return ret;
 }
 
+static unsigned int avpu_codec_poll(struct file *filp, poll_table *wait) {
+	struct avpu_codec_chan *chan = filp->private_data;
+	unsigned int mask = 0;
+
+	poll_wait(filp, &chan->irq_queue, wait);
+
+	if (chan->unblock)
+		mask |= POLLHUP;
+	else if (channel_is_ready(chan))
+		mask |= POLLIN | POLLRDNORM;
+
+	return mask;
+}
+
 static int read_reg(struct avpu_codec_chan *chan, unsigned long arg) {
 	struct avpu_reg reg;
 	struct avpu_codec_desc *codec = chan->codec;
@@ -332,6 +387,59 @@ static long jz_cmd_flush_cache(long arg) {
 }
 #endif
 
+static int flush_cache_cmp(const void *a, const void *b) {
+	const struct flush_cache_info *x = a, *y = b;
+
+	if (x->addr == y->addr)
+		return 0;
+	return x->addr < y->addr ? -1 : 1;
+}
+
+static long jz_cmd_flush_cache_batch(long arg) {
+	struct flush_cache_batch batch;
+	struct flush_cache_info *info;
+	unsigned int i, n = 0;
+	long ret = 0;
+
+	if (copy_from_user(&batch, (void *)arg, sizeof(batch)))
+		return -EFAULT;
+	if (!batch.count || batch.count > FLUSH_CACHE_BATCH_MAX)
+		return -EINVAL;
+
+	info = kmalloc(batch.count * sizeof(*info), GFP_KERNEL);
+	if (!info)
+		return -ENOMEM;
+	if (copy_from_user(info, (void *)batch.info, batch.count * sizeof(*info))) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	/* merge overlapping and adjacent ranges, mixed directions become WBACK_INV */
+	sort(info, batch.count, sizeof(*info), flush_cache_cmp, NULL);
+	for (i = 0; i < batch.count; i++) {
+		if (info[i].addr + info[i].len < info[i].addr) {
+			ret = -EINVAL;
+			goto out;
+		}
+		if (n && info[i].addr <= info[n - 1].addr + info[n - 1].len) {
+			info[n - 1].len = max(info[n - 1].addr + info[n - 1].len,
+					      info[i].addr + info[i].len) - info[n - 1].addr;
+			if (info[n - 1].dir != info[i].dir)
+				info[n - 1].dir = WBACK_INV;
+			continue;
+		}
+		info[n++] = info[i];
+	}
+
+	/* no whole cache flush, it leaves the L2 alone and the codec reads memory */
+	for (i = 0; i < n; i++)
+		dma_cache_sync(NULL, (void *)info[i].addr, info[i].len, info[i].dir);
+
+out:
+	kfree(info);
+	return ret;
+}
+
 static long avpu_codec_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
 	struct avpu_codec_chan *chan = filp->private_data;
 	struct avpu_codec_desc *codec = chan->codec;
@@ -339,6 +447,8 @@ static long avpu_codec_ioctl(struct file *filp, unsigned int cmd, unsigned long
 	switch (cmd) {
 		case GET_DMA_MMAP:
 			return avpu_ioctl_get_dma_mmap(codec->device, chan, arg);
+		case PUT_DMA_MMAP:
+			return avpu_ioctl_put_dma_mmap(codec->device, chan, arg);
 		case GET_DMA_FD:
 			return avpu_ioctl_get_dma_fd(codec->device, arg);
 		case GET_DMA_PHY:
@@ -346,13 +456,15 @@ static long avpu_codec_ioctl(struct file *filp, unsigned int cmd, unsigned long
 		case AL_CMD_UNBLOCK_CHANNEL:
 			return unblock_channel(chan);
 		case AL_CMD_IP_WAIT_IRQ:
-			return wait_irq(chan, arg);
+			return wait_irq(chan, filp, arg);
 		case AL_CMD_IP_READ_REG:
 			return read_reg(chan, arg);
 		case AL_CMD_IP_WRITE_REG:
 			return write_reg(chan, arg);
 		case JZ_CMD_FLUSH_CACHE:
 			return jz_cmd_flush_cache(arg);
+		case JZ_CMD_FLUSH_CACHE_BATCH:
+			return jz_cmd_flush_cache_batch(arg);
 		default:
 			avpu_err("Unknown ioctl: 0x%.8X\n", cmd);
 			return -EINVAL;
@@ -366,6 +478,72 @@ const struct file_operations avpu_codec_fops = {
 	.unlocked_ioctl = avpu_codec_ioctl,
 	.compat_ioctl	= avpu_codec_compat_ioctl,
 	.mmap		= avpu_dma_mmap,
+	.poll		= avpu_codec_poll,
+};
+
+static void avpu_info_show_hist(struct seq_file *m, const char *name, u32 *hist)
+{
+	int i;
+
+	seq_printf(m, "%s:", name);
+	for (i = 0; i < AVPU_HIST_BUCKETS; i++)
+		seq_printf(m, " <%uus:%u", 1U << i, hist[i]);
+	seq_printf(m, "\n");
+}
+
+static int avpu_info_show(struct seq_file *m, void *v)
+{
+	struct avpu_codec_desc *codec = (struct avpu_codec_desc *)(m->private);
+	struct avpu_stats st;
+	unsigned long flags;
+	ktime_t now;
+	u64 elapsed, busy;
+	u32 ratio = 0;
+	int i;
+
+	spin_lock_irqsave(&codec->i_lock, flags);
+	st = codec->stats;
+	spin_unlock_irqrestore(&codec->i_lock, flags);
+
+	now = ktime_get();
+	elapsed = ktime_to_ns(ktime_sub(now, st.start));
+	busy = avpu_stats_busy_ns(codec, now, NULL);
+	if (elapsed)
+		ratio = div64_u64(busy * 1000, elapsed);
+
+	seq_printf(m, "The version of avpu driver is %s\n", AVPU_DRIVER_VERSION);
+	seq_printf(m, "Channel is %s\n", codec->chan ? "opened" : "closed");
+	seq_printf(m, "clock %lu Hz\n", clk_get_rate(codec->clk));
+	seq_printf(m, "kicks %u (%u without irq), lost irqs %u\n",
+		   st.kicks, st.stale_kicks, st.lost_irqs);
+	seq_printf(m, "busy %llu us of %llu us (%u.%u%%)\n",
+		   div_u64(busy, 1000), div_u64(elapsed, 1000),
+		   ratio / 10, ratio % 10);
+
+	seq_printf(m, "irqs:");
+	for (i = 0; i < AVPU_IRQ_NB; i++)
+		if (st.irqs[i])
+			seq_printf(m, " bit%d:%u", i, st.irqs[i]);
+	seq_printf(m, "\n");
+
+	seq_printf(m, "kick to irq max %u us\n", st.kick_max_us);
+	avpu_info_show_hist(m, "kick to irq", st.kick_hist);
+	seq_printf(m, "irq to wakeup max %u us\n", st.wake_max_us);
+	avpu_info_show_hist(m, "irq to wakeup", st.wake_hist);
+
+	return 0;
+}
+
+static int avpu_info_open(struct inode *inode, struct file *file)
+{
+	return single_open_size(file, avpu_info_show, PDE_DATA(inode), 2048);
+}
+
+static const struct file_operations avpu_info_fops = {
+	.read = seq_read,
+	.open = avpu_info_open,
+	.llseek = seq_lseek,
+	.release = single_release,
 };
 
 void clean_up_avpu_codec_cdev(struct avpu_codec_desc *dev) {
@@ -655,6 +833,19 @@ int avpu_codec_probe(struct platform_device *pdev) {
 	if (err)
 		return err;
 
+	/* only once probe can no longer fail, remove() stops it */
+	avpu_clkgov_init(codec, avpu_clk);
+
+	codec->proc = jz_proc_mkdir("avpu");
+	if (!codec->proc)
+		avpu_err("create avpu proc failed!\n");
+	else {
+		proc_create_data("avpu_info", S_IRUGO, codec->proc,
+				 &avpu_info_fops, (void *)codec);
+		proc_create_data("avpu_clk", S_IRUGO | S_IWUSR, codec->proc,
+				 &avpu_clkgov_fops, (void *)codec);
+	}
+
 	codec->minor = current_minor;
 	++current_minor;
 	printk("@@@@ avpu driver ok(version %s) @@@@@\n", AVPU_DRIVER_VERSION);
@@ -675,6 +866,14 @@ int avpu_codec_remove(struct platform_device *pdev) {
 	struct avpu_codec_desc *codec = platform_get_drvdata(pdev);
 	dev_t dev = MKDEV(avpu_codec_major, codec->minor);
 
+	/*
+	 * proc_remove() waits for the writers of avpu_clk, none can set a
+	 * rate or restart the governor on the clocks put below.
+	 */
+	if (codec->proc)
+		proc_remove(codec->proc);
+	avpu_clkgov_exit(codec);
+
 #ifdef CONFIG_SOC_T41
 #ifdef CONFIG_KERNEL_4_4_94
 	clk_disable_unprepare(codec->clk);
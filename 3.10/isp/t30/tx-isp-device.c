@@ -1412,15 +1412,18 @@ static int __init tx_isp_init(void)
 		printk("Failed to insmod isp driver!\n");
 		return ret;
 	}
+	private_funcs_stats_init();
 	ret = private_platform_device_register(&tx_isp_platform_device);
 	if(ret){
 		printk("Failed to insmod isp driver!!!\n");
+		private_funcs_stats_exit();
 		return ret;
 	}
 
 	ret = private_platform_driver_register(&tx_isp_driver);
 	if(ret){
 		private_platform_device_unregister(&tx_isp_platform_device);
+		private_funcs_stats_exit();
 	}
 	return ret;
 }
@@ -1429,6 +1432,7 @@ static void __exit tx_isp_exit(void)
 {
 	private_platform_driver_unregister(&tx_isp_driver);
 	private_platform_device_unregister(&tx_isp_platform_device);
+	private_funcs_stats_exit();
 }
 
 module_init(tx_isp_init);
@@ -60,6 +60,8 @@ int isp_printf(unsigned int level, unsigned char *fmt, ...);
 char *get_clk_name(void);
 int get_isp_clk(void);
 int get_isp_memopt(void);
+void private_funcs_stats_init(void);
+void private_funcs_stats_exit(void);
 void *private_vmalloc(unsigned long size);
 void private_vfree(const void *addr);
 
@@ -53,6 +53,7 @@
 /* #include <linux/mfd/jz_tcu.h> */
 
 #include <txx-funcs.h>
+#include <private-funcs-stats.h>
 
 /* -------------------debugfs interface------------------- */
 static int print_level = ISP_WARNING_LEVEL;
@@ -414,7 +415,10 @@ void private_spin_lock_init(spinlock_t *lock)
 
 void private_mutex_lock(struct mutex *lock)
 {
+	ktime_t start = funcs_stat_begin();
+
 	mutex_lock(lock);
+	funcs_stat_end(PFS_MUTEX_LOCK, start);
 }
 
 void private_mutex_unlock(struct mutex *lock)
@@ -448,12 +452,17 @@ EXPORT_SYMBOL(private_devm_clk_get);
 
 int private_clk_prepare_enable(struct clk *clk)
 {
+	ktime_t start = funcs_stat_begin();
+	int ret = 0;
+
 #ifdef CONFIG_KERNEL_3_10
-	return clk_enable(clk);
+	ret = clk_enable(clk);
 #endif
 #ifdef CONFIG_KERNEL_4_4_94
-	return clk_prepare_enable(clk);
+	ret = clk_prepare_enable(clk);
 #endif
+	funcs_stat_end(PFS_CLK_ENABLE, start);
+	return ret;
 }
 EXPORT_SYMBOL(private_clk_prepare_enable);
 
@@ -472,12 +481,15 @@ int private_clk_is_enabled(struct clk *clk)
 
 void private_clk_disable_unprepare(struct clk *clk)
 {
+	ktime_t start = funcs_stat_begin();
+
 #ifdef CONFIG_KERNEL_3_10
 	clk_disable(clk);
 #endif
 #ifdef CONFIG_KERNEL_4_4_94
 	clk_disable_unprepare(clk);
 #endif
+	funcs_stat_end(PFS_CLK_DISABLE, start);
 }
 EXPORT_SYMBOL(private_clk_disable_unprepare);
 
@@ -501,7 +513,12 @@ EXPORT_SYMBOL(private_devm_clk_put);
 
 int private_clk_set_rate(struct clk *clk, unsigned long rate)
 {
-	return clk_set_rate(clk, rate);
+	ktime_t start = funcs_stat_begin();
+	int ret;
+
+	ret = clk_set_rate(clk, rate);
+	funcs_stat_end(PFS_CLK_SET_RATE, start);
+	return ret;
 }
 EXPORT_SYMBOL(private_clk_set_rate);
 
@@ -518,7 +535,12 @@ void private_i2c_put_adapter(struct i2c_adapter *adap)
 
 int private_i2c_transfer(struct i2c_adapter *adap, struct i2c_msg *msgs, int num)
 {
-	return i2c_transfer(adap, msgs, num);
+	ktime_t start = funcs_stat_begin();
+	int ret;
+
+	ret = i2c_transfer(adap, msgs, num);
+	funcs_stat_end(PFS_I2C_TRANSFER, start);
+	return ret;
 }
 EXPORT_SYMBOL(private_i2c_transfer);
 
@@ -564,7 +586,12 @@ void private_i2c_unregister_device(struct i2c_client *client)
 /* gpio interfaces */
 int private_gpio_request(unsigned gpio, const char *label)
 {
-	return gpio_request(gpio, label);
+	ktime_t start = funcs_stat_begin();
+	int ret;
+
+	ret = gpio_request(gpio, label);
+	funcs_stat_end(PFS_GPIO_REQUEST, start);
+	return ret;
 }
 EXPORT_SYMBOL(private_gpio_request);
 
@@ -576,7 +603,12 @@ EXPORT_SYMBOL(private_gpio_free);
 
 int private_gpio_direction_output(unsigned gpio, int value)
 {
-	return gpio_direction_output(gpio, value);
+	ktime_t start = funcs_stat_begin();
+	int ret;
+
+	ret = gpio_direction_output(gpio, value);
+	funcs_stat_end(PFS_GPIO_OUTPUT, start);
+	return ret;
 }
 EXPORT_SYMBOL(private_gpio_direction_output);
 
@@ -592,7 +624,12 @@ int private_gpio_set_debounce(unsigned gpio, unsigned debounce)
 
 int private_jzgpio_set_func(enum gpio_port port, enum gpio_function func,unsigned long pins)
 {
-	return jzgpio_set_func(port, func, pins);
+	ktime_t start = funcs_stat_begin();
+	int ret;
+
+	ret = jzgpio_set_func(port, func, pins);
+	funcs_stat_end(PFS_JZGPIO_SET_FUNC, start);
+	return ret;
 }
 EXPORT_SYMBOL(private_jzgpio_set_func);
 
@@ -606,13 +643,19 @@ int private_jzgpio_ctrl_pull(enum gpio_port port, int enable_pull,unsigned long
 /* system interfaces */
 void private_msleep(unsigned int msecs)
 {
+	ktime_t start = funcs_stat_begin();
+
 	msleep(msecs);
+	funcs_stat_end(PFS_MSLEEP, start);
 }
 EXPORT_SYMBOL(private_msleep);
 
 void private_mdelay(unsigned int msecs)
 {
+	ktime_t start = funcs_stat_begin();
+
 	mdelay(msecs);
+	funcs_stat_end(PFS_MDELAY, start);
 }
 EXPORT_SYMBOL(private_mdelay);
 
@@ -664,12 +707,22 @@ void private_complete(struct completion *x)
 
 int private_wait_for_completion_interruptible(struct completion *x)
 {
-	return wait_for_completion_interruptible(x);
+	ktime_t start = funcs_stat_begin();
+	int ret;
+
+	ret = wait_for_completion_interruptible(x);
+	funcs_stat_end(PFS_WAIT_COMPLETION, start);
+	return ret;
 }
 
 unsigned long private_wait_for_completion_timeout(struct completion *x, unsigned long timeover)
 {
-	return wait_for_completion_timeout(x, timeover);
+	ktime_t start = funcs_stat_begin();
+	unsigned long ret;
+
+	ret = wait_for_completion_timeout(x, timeover);
+	funcs_stat_end(PFS_WAIT_COMPLETION, start);
+	return ret;
 }
 
 int private_wait_event_interruptible(wait_queue_head_t *q, int (*state)(void *), void *data)
@@ -738,12 +791,22 @@ void private_kfree(void *p){
 //copy user
 long private_copy_from_user(void *to, const void __user *from, long size)
 {
-	return copy_from_user(to, from,size);
+	ktime_t start = funcs_stat_begin();
+	long ret;
+
+	ret = copy_from_user(to, from,size);
+	funcs_stat_end(PFS_COPY_FROM_USER, start);
+	return ret;
 }
 
 long private_copy_to_user(void __user *to, const void *from, long size)
 {
-	return copy_to_user(to, from, size);
+	ktime_t start = funcs_stat_begin();
+	long ret;
+
+	ret = copy_to_user(to, from, size);
+	funcs_stat_end(PFS_COPY_TO_USER, start);
+	return ret;
 }
 
 /* file ops */
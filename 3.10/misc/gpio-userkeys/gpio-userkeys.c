@@ -3,6 +3,15 @@
 #include <linux/gpio_keys.h>
 #include <linux/slab.h>
 #include <linux/input.h>
+#include <linux/gpio.h>
+#include <linux/interrupt.h>
+#include <linux/hrtimer.h>
+#include <linux/kfifo.h>
+#include <linux/miscdevice.h>
+#include <linux/poll.h>
+#include <linux/uaccess.h>
+
+#include "userkey_debounce.h"
 
 extern struct platform_device jz_button_device;
 extern struct gpio_keys_button board_buttons[];
@@ -16,7 +25,49 @@ static struct platform_device *new_button_device;
 
 static char *gpio_config = "";
 module_param(gpio_config, charp, 0000);
-MODULE_PARM_DESC(gpio_config, "GPIO configuration: <KEYCODE,GPIO,ACTIVE_LOW>;...");
+MODULE_PARM_DESC(gpio_config, "GPIO configuration: <KEYCODE,GPIO,ACTIVE_LOW[,DEBOUNCE_MS]>;...");
+
+static bool native_mode;
+module_param(native_mode, bool, 0444);
+MODULE_PARM_DESC(native_mode, "Handle all keys here and report them on /dev/userkeys instead of gpio-keys");
+
+static unsigned int debounce_ms = 20;
+module_param(debounce_ms, uint, 0444);
+MODULE_PARM_DESC(debounce_ms, "Native mode debounce time of keys without their own DEBOUNCE_MS");
+
+/*
+ * Native mode
+ *
+ * The first edge of a burst masks the key interrupt and takes the event
+ * timestamp. The level is then sampled every debounce time until two
+ * samples agree; a changed stable level is reported and the interrupt is
+ * unmasked again, so a bouncing contact costs one interrupt per burst.
+ *
+ * read() on /dev/userkeys returns whole struct userkey_event records,
+ * poll() reports POLLIN while some are pending.
+ */
+struct userkey_event {
+	unsigned int code;
+	unsigned int value;		/* 1 pressed, 0 released */
+	unsigned long long timestamp_ns;	/* ktime_get() of the first edge */
+};
+
+struct userkey {
+	const struct gpio_keys_button *button;
+	int irq;
+	ktime_t debounce;
+	struct userkey_debounce db;
+	ktime_t edge;
+	struct hrtimer timer;
+};
+
+#define USERKEY_EVENT_CNT 64
+
+static struct userkey *userkeys;
+static int userkeys_cnt;
+static DEFINE_KFIFO(userkey_events, struct userkey_event, USERKEY_EVENT_CNT);
+static DEFINE_SPINLOCK(userkey_lock);
+static DECLARE_WAIT_QUEUE_HEAD(userkey_wait);
 
 static int parse_gpio_config(void)
 {
@@ -30,13 +81,14 @@ static int parse_gpio_config(void)
 		return -ENOMEM;
 
 	while ((token = strsep(&cur, ";")) != NULL && button_count < MAX_ADDITIONAL_BUTTONS) {
-		int keycode, gpio, active_low;
-		if (sscanf(token, "%d,%d,%d", &keycode, &gpio, &active_low) == 3) {
+		int keycode, gpio, active_low, debounce = 0;
+		if (sscanf(token, "%d,%d,%d,%d", &keycode, &gpio, &active_low, &debounce) >= 3) {
 			new_buttons[existing_buttons + button_count].code = keycode;
 			new_buttons[existing_buttons + button_count].gpio = gpio;
 			new_buttons[existing_buttons + button_count].active_low = active_low;
 			new_buttons[existing_buttons + button_count].desc = "GPIO Button";
 			new_buttons[existing_buttons + button_count].type = EV_KEY;
+			new_buttons[existing_buttons + button_count].debounce_interval = debounce;
 			button_count++;
 		}
 	}
@@ -47,6 +99,194 @@ static int parse_gpio_config(void)
 	return 0;
 }
 
+static int userkey_level(struct userkey *key)
+{
+	return !!gpio_get_value(key->button->gpio) ^ !!key->button->active_low;
+}
+
+static void userkey_report(struct userkey *key)
+{
+	struct userkey_event ev;
+	unsigned long flags;
+
+	ev.code = key->button->code;
+	ev.value = key->db.state;
+	ev.timestamp_ns = ktime_to_ns(key->edge);
+
+	spin_lock_irqsave(&userkey_lock, flags);
+	if (kfifo_is_full(&userkey_events))
+		kfifo_skip(&userkey_events);
+	kfifo_in(&userkey_events, &ev, 1);
+	spin_unlock_irqrestore(&userkey_lock, flags);
+	wake_up_interruptible(&userkey_wait);
+}
+
+static enum hrtimer_restart userkey_timer(struct hrtimer *timer)
+{
+	struct userkey *key = container_of(timer, struct userkey, timer);
+
+	switch (userkey_debounce_check(&key->db, userkey_level(key))) {
+	case USERKEY_DEBOUNCE_AGAIN:
+		hrtimer_forward_now(timer, key->debounce);
+		return HRTIMER_RESTART;
+	case USERKEY_DEBOUNCE_REPORT:
+		userkey_report(key);
+		break;
+	default:
+		break;
+	}
+	/* an edge seen while masked is resent by the irq core */
+	enable_irq(key->irq);
+	return HRTIMER_NORESTART;
+}
+
+static irqreturn_t userkey_irq(int irq, void *dev_id)
+{
+	struct userkey *key = dev_id;
+
+	key->edge = ktime_get();
+	userkey_debounce_start(&key->db, userkey_level(key));
+	disable_irq_nosync(irq);
+	hrtimer_start(&key->timer, key->debounce, HRTIMER_MODE_REL);
+	return IRQ_HANDLED;
+}
+
+static ssize_t userkeys_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+	struct userkey_event ev;
+	unsigned long flags;
+	size_t done = 0;
+	int ret = 0;
+
+	if (count < sizeof(ev))
+		return -EINVAL;
+
+	while (!done) {
+		if (kfifo_is_empty(&userkey_events)) {
+			if (file->f_flags & O_NONBLOCK)
+				return -EAGAIN;
+			ret = wait_event_interruptible(userkey_wait, !kfifo_is_empty(&userkey_events));
+			if (ret)
+				return ret;
+		}
+		while (done + sizeof(ev) <= count) {
+			spin_lock_irqsave(&userkey_lock, flags);
+			ret = kfifo_out(&userkey_events, &ev, 1);
+			spin_unlock_irqrestore(&userkey_lock, flags);
+			if (!ret)
+				break;
+			if (copy_to_user(buf + done, &ev, sizeof(ev)))
+				return done ? done : -EFAULT;
+			done += sizeof(ev);
+		}
+	}
+
+	return done;
+}
+
+static unsigned int userkeys_poll(struct file *file, poll_table *wait)
+{
+	poll_wait(file, &userkey_wait, wait);
+	if (!kfifo_is_empty(&userkey_events))
+		return POLLIN | POLLRDNORM;
+	return 0;
+}
+
+static const struct file_operations userkeys_fops = {
+	.owner	= THIS_MODULE,
+	.read	= userkeys_read,
+	.poll	= userkeys_poll,
+};
+
+static struct miscdevice userkeys_misc = {
+	.minor	= MISC_DYNAMIC_MINOR,
+	.name	= "userkeys",
+	.fops	= &userkeys_fops,
+};
+
+static void userkeys_native_free(int count)
+{
+	struct userkey *key;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		key = &userkeys[i];
+		disable_irq(key->irq);
+		hrtimer_cancel(&key->timer);
+		free_irq(key->irq, key);
+		gpio_free(key->button->gpio);
+	}
+	kfree(userkeys);
+	userkeys = NULL;
+}
+
+static int userkeys_native_init(int nbuttons)
+{
+	const struct gpio_keys_button *button;
+	struct userkey *key;
+	int i, ret;
+
+	userkeys = kcalloc(nbuttons, sizeof(*userkeys), GFP_KERNEL);
+	if (!userkeys)
+		return -ENOMEM;
+
+	for (i = 0; i < nbuttons; i++) {
+		key = &userkeys[i];
+		button = &new_buttons[i];
+		key->button = button;
+		key->debounce = ms_to_ktime(button->debounce_interval ? button->debounce_interval : debounce_ms);
+		hrtimer_init(&key->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+		key->timer.function = userkey_timer;
+
+		ret = gpio_request_one(button->gpio, GPIOF_IN, button->desc ? button->desc : "gpio-userkey");
+		if (ret) {
+			printk(KERN_ERR "gpio-userkeys: request gpio %d failed: %d\n", button->gpio, ret);
+			goto err_keys;
+		}
+		key->irq = gpio_to_irq(button->gpio);
+		if (key->irq < 0) {
+			ret = key->irq;
+			goto err_gpio;
+		}
+		key->db.state = userkey_level(key);
+		key->db.sample = key->db.state;
+		ret = request_irq(key->irq, userkey_irq, IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING,
+				  "gpio-userkeys", key);
+		if (ret) {
+			printk(KERN_ERR "gpio-userkeys: request irq for gpio %d failed: %d\n", button->gpio, ret);
+			goto err_gpio;
+		}
+	}
+	userkeys_cnt = i;
+
+	ret = misc_register(&userkeys_misc);
+	if (ret)
+		goto err_keys;
+
+	return 0;
+
+err_gpio:
+	gpio_free(button->gpio);
+err_keys:
+	userkeys_native_free(i);
+	return ret;
+}
+
+/* gpio-keys device with the board buttons only, in place of jz_button_device */
+static void userkeys_board_restore(void)
+{
+	struct platform_device *pdev;
+
+	pdev = platform_device_alloc("gpio-keys", -1);
+	if (!pdev)
+		return;
+	if (platform_device_add_data(pdev, &board_button_data, sizeof(board_button_data)) ||
+	    platform_device_add(pdev)) {
+		printk(KERN_ERR "gpio-userkeys: board keys are gone\n");
+		platform_device_put(pdev);
+	}
+}
+
 static int __init add_gpio_keys_init(void)
 {
 	int ret, i, existing_buttons, additional_buttons = 0;
@@ -81,6 +321,20 @@ static int __init add_gpio_keys_init(void)
 		return ret;
 	}
 
+	/* native mode only takes the entries that parsed */
+	if (native_mode) {
+		/* gpio-keys holds the board key gpios until its device goes away */
+		platform_device_unregister(&jz_button_device);
+		ret = userkeys_native_init(new_button_data.nbuttons);
+		if (ret) {
+			printk(KERN_ERR "gpio-userkeys: native mode failed (%d), restoring the board keys\n", ret);
+			userkeys_board_restore();
+			goto err_alloc;
+		}
+		printk(KERN_INFO "GPIO userkeys handling %d buttons on /dev/userkeys\n", userkeys_cnt);
+		return 0;
+	}
+
 	// Initialize new platform data
 	new_button_data.buttons = new_buttons;
 	new_button_data.nbuttons = existing_buttons + additional_buttons;
@@ -118,6 +372,11 @@ static void __exit add_gpio_keys_exit(void)
 	int existing_buttons = board_button_data.nbuttons;
 	int i;
 
+	if (native_mode) {
+		misc_deregister(&userkeys_misc);
+		userkeys_native_free(userkeys_cnt);
+	}
+
 	for (i = existing_buttons; i < new_button_data.nbuttons; i++) {
 		new_buttons[i].code = 0;
 		new_buttons[i].gpio = 0;
@@ -0,0 +1,39 @@
+/*
+ * Debounce decisions of the native userkeys mode. Nothing here touches
+ * the hardware, userkeys_test/ runs the same code on the host.
+ */
+#ifndef __USERKEY_DEBOUNCE_H__
+#define __USERKEY_DEBOUNCE_H__
+
+struct userkey_debounce {
+	int state;			/* last reported level */
+	int sample;			/* level at the previous sample */
+};
+
+enum userkey_debounce_action {
+	USERKEY_DEBOUNCE_AGAIN,		/* still bouncing, sample again one debounce time later */
+	USERKEY_DEBOUNCE_REPORT,	/* settled on a new level, report state */
+	USERKEY_DEBOUNCE_IDLE,		/* settled on the reported level */
+};
+
+/* first edge of a burst, level is the pin at the interrupt */
+static inline void userkey_debounce_start(struct userkey_debounce *db, int level)
+{
+	db->sample = level;
+}
+
+/* one debounce time after the previous sample */
+static inline enum userkey_debounce_action userkey_debounce_check(struct userkey_debounce *db, int level)
+{
+	if (level != db->sample) {
+		db->sample = level;
+		return USERKEY_DEBOUNCE_AGAIN;
+	}
+	if (level != db->state) {
+		db->state = level;
+		return USERKEY_DEBOUNCE_REPORT;
+	}
+	return USERKEY_DEBOUNCE_IDLE;
+}
+
+#endif /* __USERKEY_DEBOUNCE_H__ */
@@ -0,0 +1,301 @@
+/*
+ * Host side bounce simulation of the native userkeys mode.
+ *
+ * A key is a list of pin edges: presses and releases, each followed by a
+ * burst of contact bounce. The simulation plays them against
+ * userkey_irq and userkey_timer as gpio-userkeys.c runs them: the irq
+ * runs IRQ_LAT us after an edge, masks itself and arms the timer one
+ * debounce time out, the timer samples through userkey_debounce.h and
+ * unmasks, and an edge that came in while masked fires the irq again on
+ * unmask. The checks:
+ * - every real press and release is reported exactly once;
+ * - each report carries the time of the first edge of its burst;
+ * - glitches shorter than the debounce time are never reported, nor is
+ *   a level that only one sample saw;
+ * - a bouncing contact costs at most two interrupts per burst.
+ *
+ * make && ./userkeys_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../userkey_debounce.h"
+
+#define MAX_EDGES	4096
+#define MAX_EVENTS	1024
+#define IRQ_LAT		5		/* us from an edge to userkey_irq */
+
+struct sim {
+	/* the pin */
+	long long edge_at[MAX_EDGES];	/* us, the pin toggles at each */
+	int edges;
+	int level;
+	int start_level;
+
+	/* userkey */
+	struct userkey_debounce db;
+	long long debounce;
+	long long edge;			/* key->edge */
+	int masked;
+	int pending;			/* edge while masked, resent on unmask */
+	long long irq_at;		/* -1 when not raised */
+	long long timer_at;		/* -1 when not queued */
+
+	/* what came out */
+	unsigned int irqs;
+	int ev_value[MAX_EVENTS];
+	long long ev_time[MAX_EVENTS];
+	int events;
+};
+
+static int failures;
+
+#define CHECK(cond, ...) do {						\
+	if (!(cond)) {							\
+		printf("FAIL %s:%d: ", __func__, __LINE__);		\
+		printf(__VA_ARGS__);					\
+		printf("\n");						\
+		failures++;						\
+	}								\
+} while (0)
+
+static void sim_init(struct sim *s, int level, long long debounce)
+{
+	s->edges = 0;
+	s->level = level;
+	s->start_level = level;
+	s->db.state = level;
+	s->db.sample = level;
+	s->debounce = debounce;
+	s->masked = 0;
+	s->pending = 0;
+	s->irq_at = -1;
+	s->timer_at = -1;
+	s->irqs = 0;
+	s->events = 0;
+}
+
+static void sim_edge(struct sim *s, long long at)
+{
+	if (s->edges < MAX_EDGES)
+		s->edge_at[s->edges++] = at;
+}
+
+/*
+ * the pin goes to the other level at t, bounces times in the next span
+ * us and settles there
+ */
+static long long sim_burst(struct sim *s, long long t, int bounces, long long span)
+{
+	long long at = t;
+	int i = 0;
+
+	sim_edge(s, t);
+	for (i = 0; i < 2 * bounces; i++) {
+		at += 1 + rand() % (span / (2 * bounces) + 1);
+		sim_edge(s, at);
+	}
+	return at;
+}
+
+/* userkey_irq */
+static void sim_irq(struct sim *s, long long now)
+{
+	s->irq_at = -1;
+	s->irqs++;
+	s->edge = now;
+	userkey_debounce_start(&s->db, s->level);
+	s->masked = 1;
+	s->timer_at = now + s->debounce;
+}
+
+/* userkey_timer */
+static void sim_timer(struct sim *s, long long now)
+{
+	switch (userkey_debounce_check(&s->db, s->level)) {
+	case USERKEY_DEBOUNCE_AGAIN:
+		s->timer_at = now + s->debounce;
+		return;
+	case USERKEY_DEBOUNCE_REPORT:
+		if (s->events < MAX_EVENTS) {
+			s->ev_value[s->events] = s->db.state;
+			s->ev_time[s->events] = s->edge;
+			s->events++;
+		}
+		break;
+	default:
+		break;
+	}
+	s->timer_at = -1;
+	s->masked = 0;
+	if (s->pending) {
+		s->pending = 0;
+		s->irq_at = now + IRQ_LAT;
+	}
+}
+
+static void sim_run(struct sim *s)
+{
+	int next = 0;
+
+	long long edge = 0;
+
+	while (next < s->edges || s->irq_at >= 0 || s->timer_at >= 0) {
+		edge = next < s->edges ? s->edge_at[next] : -1;
+		/* the irq and the timer run before an edge on the same us */
+		if (s->irq_at >= 0 && (edge < 0 || s->irq_at <= edge)) {
+			sim_irq(s, s->irq_at);
+			continue;
+		}
+		if (s->timer_at >= 0 && (edge < 0 || s->timer_at <= edge)) {
+			sim_timer(s, s->timer_at);
+			continue;
+		}
+		s->level = !s->level;
+		if (s->masked)
+			s->pending = 1;
+		else if (s->irq_at < 0)
+			s->irq_at = edge + IRQ_LAT;
+		next++;
+	}
+	CHECK(s->level == s->db.state, "pin ended at %d, last report %d", s->level, s->db.state);
+}
+
+/* clean presses: one report per edge at the edge time, one irq each */
+static void test_clean(void)
+{
+	struct sim s;
+	long long t = 1000;
+	int i = 0;
+
+	sim_init(&s, 0, 20000);
+	for (i = 0; i < 20; i++) {
+		sim_edge(&s, t);
+		t += 100000 + i * 1000;
+	}
+	sim_run(&s);
+	CHECK(s.events == 20, "%d reports for 20 edges", s.events);
+	CHECK(s.irqs == 20, "%u irqs for 20 edges", s.irqs);
+	for (i = 0; i < s.events && i < 20; i++) {
+		CHECK(s.ev_value[i] == !(i & 1), "report %d is %d", i, s.ev_value[i]);
+		CHECK(s.ev_time[i] == s.edge_at[i] + IRQ_LAT, "report %d at %lld, edge at %lld",
+		      i, s.ev_time[i], s.edge_at[i]);
+	}
+}
+
+/* bursts shorter than the debounce time, hold times well past it */
+static void test_bounce(void)
+{
+	struct sim s;
+	long long debounce = 0, t = 0, first[64];
+	int run = 0, i = 0, presses = 0;
+
+	srand(4049);
+	for (run = 0; run < 2000; run++) {
+		debounce = 5000 + rand() % 45000;
+		sim_init(&s, rand() & 1, debounce);
+		presses = 1 + rand() % 32;
+		t = 1000 + rand() % 100000;
+		for (i = 0; i < 2 * presses; i++) {
+			first[i] = t;
+			t = sim_burst(&s, t, rand() % 8 + 1, debounce / 2);
+			t += 3 * debounce + rand() % 200000;
+		}
+		sim_run(&s);
+		CHECK(s.events == 2 * presses, "run %d: %d reports for %d bursts", run, s.events, 2 * presses);
+		CHECK(s.irqs <= 2 * 2 * presses, "run %d: %u irqs for %d bursts", run, s.irqs, 2 * presses);
+		for (i = 0; i < s.events && i < 2 * presses; i++) {
+			CHECK(s.ev_value[i] == (s.start_level ^ !(i & 1)), "run %d: report %d is %d",
+			      run, i, s.ev_value[i]);
+			CHECK(s.ev_time[i] == first[i] + IRQ_LAT, "run %d: report %d at %lld, burst at %lld",
+			      run, i, s.ev_time[i], first[i]);
+		}
+	}
+}
+
+/* pulses shorter than the debounce time never get through */
+static void test_glitch(void)
+{
+	struct sim s;
+	long long debounce = 0, t = 0;
+	int run = 0, i = 0;
+
+	for (run = 0; run < 2000; run++) {
+		debounce = 5000 + rand() % 45000;
+		sim_init(&s, rand() & 1, debounce);
+		t = 1000;
+		for (i = 0; i < 16; i++) {
+			sim_edge(&s, t);
+			sim_edge(&s, t + 1 + rand() % (debounce - 1));
+			t += 3 * debounce + rand() % 100000;
+		}
+		sim_run(&s);
+		CHECK(s.events == 0, "run %d: %d reports from glitches", run, s.events);
+	}
+}
+
+/*
+ * the irq reads the pin back at its old level and the first sample hits
+ * a second pulse, that one sample is not enough for a report
+ */
+static void test_one_sample(void)
+{
+	struct sim s;
+	long long debounce = 0, t = 0;
+	int run = 0, i = 0;
+
+	for (run = 0; run < 2000; run++) {
+		debounce = 5000 + rand() % 45000;
+		sim_init(&s, rand() & 1, debounce);
+		t = 1000;
+		for (i = 0; i < 16; i++) {
+			sim_edge(&s, t);
+			sim_edge(&s, t + 1 + rand() % (IRQ_LAT - 1));
+			sim_edge(&s, t + IRQ_LAT + debounce - 1 - rand() % (debounce / 4));
+			sim_edge(&s, t + IRQ_LAT + debounce + 1 + rand() % (debounce / 4));
+			t += 6 * debounce + rand() % 100000;
+		}
+		sim_run(&s);
+		CHECK(s.events == 0, "run %d: %d reports from single samples", run, s.events);
+	}
+}
+
+/* any edge pattern: reports alternate and the last one is where the pin settled */
+static void test_random(void)
+{
+	struct sim s;
+	long long t = 0;
+	int run = 0, i = 0, n = 0;
+
+	for (run = 0; run < 5000; run++) {
+		sim_init(&s, rand() & 1, 1000 + rand() % 50000);
+		n = rand() % 200;
+		t = 0;
+		for (i = 0; i < n; i++) {
+			t += 1 + rand() % (rand() & 1 ? 500 : 100000);
+			sim_edge(&s, t);
+		}
+		sim_run(&s);
+		for (i = 0; i < s.events; i++)
+			CHECK(s.ev_value[i] == (s.start_level ^ !(i & 1)), "run %d: report %d is %d twice",
+			      run, i, s.ev_value[i]);
+		CHECK(s.irqs <= n, "run %d: %u irqs for %d edges", run, s.irqs, n);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	test_clean();
+	test_bounce();
+	test_glitch();
+	test_one_sample();
+	test_random();
+
+	if (failures) {
+		printf("%d check(s) failed\n", failures);
+		return 1;
+	}
+	printf("userkeys debounce: all checks passed\n");
+	return 0;
+}
@@ -24,6 +24,10 @@
 #include <crypto/scatterwalk.h>
 #include <linux/proc_fs.h>
 #include <linux/miscdevice.h>
+#include <linux/kfifo.h>
+#include <linux/poll.h>
+#include <linux/sched.h>
+#include <linux/delay.h>
 #include <soc/base.h>
 #ifdef CONFIG_SOC_T40
 #include <dt-bindings/interrupt-controller/t40-irq.h>
@@ -32,6 +36,14 @@
 #endif
 #include "jz-dtrng.h"
 #define SBUFF_SIZE		128
+#define DTRNG_READ_CHUNK	64
+/* a word normally takes a few us at div_num 8 */
+#define DTRNG_POLL_TIMEOUT_US	1000
+
+/* rounded up to a power of two by kfifo */
+static int dtrng_pool_size = 4096;
+module_param(dtrng_pool_size, int, S_IRUGO);
+MODULE_PARM_DESC(dtrng_pool_size, "bytes of random data kept ready");
 /* #define DEBUG */
 #ifdef DEBUG
 #define dtrng_debug(format, ...) {printk(format, ## __VA_ARGS__);}
@@ -41,40 +53,121 @@
 
 static int dtrng_release(struct inode *inode, struct file *file)
 {
-	struct miscdevice *dev = file->private_data;
-	dtrng_operation_t *dtrng = miscdev_to_dtrngops(dev);
-	dtrng->state = 0;
 	return 0;
 }
 
-static ssize_t dtrng_read(struct file *file, char __user * buffer, size_t count, loff_t * ppos)
+/* called with dtrng->lock held, restarts irq generation until the pool is full */
+static void dtrng_refill_start(dtrng_operation_t *dtrng)
 {
-	return 0;
+	unsigned int reg = 0;
+
+	if (dtrng->filling || dtrng->polling || kfifo_avail(&dtrng->pool) < sizeof(unsigned int))
+		return;
+
+	dtrng->filling = true;
+	dtrng_bit_clr(dtrng, DTRNG_CFG, 11);   // no mask
+	reg = dtrng_reg_read(dtrng, DTRNG_CFG);
+	reg |= 8 << 1 | 1 << 0;//div_num = 8, enable dtrng
+	dtrng_reg_write(dtrng, DTRNG_CFG, reg);
 }
 
-static ssize_t dtrng_write(struct file *file, const char __user * buffer, size_t count, loff_t * ppos)
+/* called with dtrng->lock held */
+static void dtrng_refill_stop(dtrng_operation_t *dtrng)
 {
-	return 0;
+	dtrng_bit_clr(dtrng, DTRNG_CFG, 0);//disable dtrng
+	dtrng_bit_set(dtrng, DTRNG_CFG, 11);//mask the interrupt
+	dtrng->filling = false;
 }
 
-static int dtrng_open(struct inode *inode, struct file *file)
+static bool dtrng_pool_ready(dtrng_operation_t *dtrng)
+{
+	unsigned long flags;
+	bool ready;
+
+	spin_lock_irqsave(&dtrng->lock, flags);
+	ready = !kfifo_is_empty(&dtrng->pool);
+	spin_unlock_irqrestore(&dtrng->lock, flags);
+
+	return ready;
+}
+
+/*
+ * Take up to len bytes from the pool, sleeping while it is empty unless
+ * nonblock is set. Returns the number of bytes, -EAGAIN or -ERESTARTSYS.
+ */
+static int dtrng_pool_get(dtrng_operation_t *dtrng, void *buf, unsigned int len, bool nonblock)
+{
+	unsigned long flags;
+	unsigned int n = 0;
+	int ret = 0;
+
+	while (1) {
+		spin_lock_irqsave(&dtrng->lock, flags);
+		n = kfifo_out(&dtrng->pool, buf, len);
+		dtrng_refill_start(dtrng);
+		spin_unlock_irqrestore(&dtrng->lock, flags);
+		if (n)
+			return n;
+		if (nonblock)
+			return -EAGAIN;
+
+		ret = wait_event_interruptible(dtrng->pool_wait, dtrng_pool_ready(dtrng));
+		if (ret)
+			return ret;
+	}
+}
+
+static ssize_t dtrng_read(struct file *file, char __user * buffer, size_t count, loff_t * ppos)
 {
 	struct miscdevice *dev = file->private_data;
 	dtrng_operation_t *dtrng = miscdev_to_dtrngops(dev);
-	if(dtrng->state){
-		printk("dtrng driver is busy,can't open again!\n");
-		return -EBUSY;
+	unsigned char kbuf[DTRNG_READ_CHUNK];
+	size_t done = 0;
+	int n = 0;
+
+	/* blocking reads return once count bytes are copied or on a signal */
+	while (done < count) {
+		n = dtrng_pool_get(dtrng, kbuf, min_t(size_t, count - done, sizeof(kbuf)), file->f_flags & O_NONBLOCK);
+		if (n < 0)
+			break;
+		if (copy_to_user(buffer + done, kbuf, n)) {
+			n = -EFAULT;
+			break;
+		}
+		done += n;
 	}
-	dtrng->state = 1;
-	printk("%s:dtrng open successsful!\n",__func__);
+	memset(kbuf, 0, sizeof(kbuf));
+
+	return done ? done : n;
+}
+
+static unsigned int dtrng_poll(struct file *file, struct poll_table_struct *wait)
+{
+	struct miscdevice *dev = file->private_data;
+	dtrng_operation_t *dtrng = miscdev_to_dtrngops(dev);
+
+	poll_wait(file, &dtrng->pool_wait, wait);
+
+	return dtrng_pool_ready(dtrng) ? (POLLIN | POLLRDNORM) : 0;
+}
+
+static ssize_t dtrng_write(struct file *file, const char __user * buffer, size_t count, loff_t * ppos)
+{
 	return 0;
+}
 
+/* every opener shares the pool, the hardware is only touched under dtrng->lock */
+static int dtrng_open(struct inode *inode, struct file *file)
+{
+	dtrng_debug("%s:dtrng open successsful!\n",__func__);
+	return 0;
 }
 
 unsigned int cnt = 0;
 unsigned int cnt_t = 0;
 unsigned int random_r = 0;
-int dtrng_cpu_get_random(dtrng_operation_t *dtrng)
+/* called with dtrng->lock held, masks the irq and starts a polled word */
+static void dtrng_cpu_start(dtrng_operation_t *dtrng)
 {
 	static int i=0;
 	unsigned int reg = 0;
@@ -84,67 +177,112 @@ int dtrng_cpu_get_random(dtrng_operation_t *dtrng)
 		reg |= 8 << 1 | 1 << 11 | 1 << 0 | (dtrng->random[0]<<16);//div_num = 8, mask irq, enable dtrng
 		dtrng_reg_write(dtrng, DTRNG_CFG, reg);
 	}
+}
+
+/* called without dtrng->lock, dtrng->polling keeps the irq path off the block */
+int dtrng_cpu_get_random(dtrng_operation_t *dtrng)
+{
+	unsigned int us = 0;
 
-	while(!(dtrng_reg_read(dtrng, DTRNG_STAT) & 0x1));
+	while (!(dtrng_reg_read(dtrng, DTRNG_STAT) & 0x1)) {
+		if (++us > DTRNG_POLL_TIMEOUT_US)
+			return -ETIMEDOUT;
+		udelay(1);
+	}
 
 	dtrng->random[0] = dtrng_reg_read(dtrng, DTRNG_RANDOMNUM);
 	return 0;
 }
 
-int dtrng_irqmode_random(dtrng_operation_t *dtrng)
+/* the irq mode word comes from the pool filled by dtrng_ope_irq_handler */
+int dtrng_irqmode_random(dtrng_operation_t *dtrng, unsigned int *random)
 {
-	unsigned int reg = 0;
-	dtrng_bit_clr(dtrng, 0x0, 11);   // no mask
-	reg = dtrng_reg_read(dtrng, DTRNG_CFG);
-	reg |= 8 << 1 | 1 << 0 | (dtrng->random[0]<<16);//div_num = 0, not mask irq, enable dtrng
-	dtrng_reg_write(dtrng, DTRNG_CFG, reg);
+	unsigned char *p = (unsigned char *)random;
+	unsigned int done = 0;
+	int ret = 0;
+
+	while (done < sizeof(unsigned int)) {
+		ret = dtrng_pool_get(dtrng, p + done, sizeof(unsigned int) - done, false);
+		if (ret < 0)
+			return ret;
+		done += ret;
+	}
 	return 0;
 }
 
+/*
+ * polled mode owns the block for one word, irq refill resumes afterwards.
+ * The block is claimed under dtrng->lock but polled with it dropped, so
+ * irqs stay on while the word is generated.
+ */
+static int dtrng_cpu_random_locked(dtrng_operation_t *dtrng, unsigned int *random)
+{
+	unsigned long flags;
+	int ret = 0;
+
+	mutex_lock(&dtrng->poll_mutex);
+	spin_lock_irqsave(&dtrng->lock, flags);
+	dtrng->filling = false;
+	dtrng->polling = true;
+	dtrng->random[0] = *random;
+	dtrng_cpu_start(dtrng);
+	spin_unlock_irqrestore(&dtrng->lock, flags);
+
+	ret = dtrng_cpu_get_random(dtrng);
+	if (!ret)
+		*random = dtrng->random[0];
+
+	spin_lock_irqsave(&dtrng->lock, flags);
+	dtrng->polling = false;
+	dtrng_refill_start(dtrng);
+	spin_unlock_irqrestore(&dtrng->lock, flags);
+	mutex_unlock(&dtrng->poll_mutex);
+
+	return ret;
+}
+
 static long dtrng_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct miscdevice *dev = file->private_data;
     dtrng_operation_t *dtrng = miscdev_to_dtrngops(dev);
 	void __user *argp  = (void __user *)arg;
+	unsigned int random = 0;
 	int ret = 0;
 
 	switch(cmd) {
 		case IOCTL_DTRNG_CPU_GET_RANDOM:
 
-			if (copy_from_user(dtrng->random, argp , sizeof(unsigned int)))
+			if (copy_from_user(&random, argp , sizeof(unsigned int)))
 			{
 				printk("copy_from_user is error  : %s,%d\n",__func__,__LINE__);
 				return -EFAULT;
 			}
-			dtrng_debug("data from user is %u\n",dtrng->random[0]);
-			ret = dtrng_cpu_get_random(dtrng);
+			dtrng_debug("data from user is %u\n",random);
+			ret = dtrng_cpu_random_locked(dtrng, &random);
 			if (ret) {
 				printk("dtrng decrypt error!\n");
-				return -1;
+				return ret;
 			}
-			dtrng_debug("data to user is %u\n",dtrng->random[0]);
-			if (copy_to_user(argp, &dtrng->random, sizeof(unsigned int))) {
+			dtrng_debug("data to user is %u\n",random);
+			if (copy_to_user(argp, &random, sizeof(unsigned int))) {
 				printk("dtrng get copy_to_user error!!!\n");
 				return -EFAULT;
 			}
 			break;
 		case IOCTL_DTRNG_DMA_GET_RANDOM:
-			if (copy_from_user(dtrng->random, argp , sizeof(unsigned int)))
+			if (copy_from_user(&random, argp , sizeof(unsigned int)))
 			{
 				printk("copy_from_user is error  : %s,%d\n",__func__,__LINE__);
 				return -EFAULT;
 			}
-			dtrng_debug("data from user is %u\n",dtrng->random[0]);
+			dtrng_debug("data from user is %u\n",random);
 
-			ret = dtrng_irqmode_random(dtrng);
-			if (ret) {
-				printk("dtrng decrypt error!\n");
-				return -1;
-			}
-			wait_for_completion(&dtrng->dtrng_complete);
+			ret = dtrng_irqmode_random(dtrng, &random);
+			if (ret)
+				return ret;
 
-			dtrng_debug("data to  user is %u\n",dtrng->random[0]);
-			if (copy_to_user(argp, dtrng->random, sizeof(unsigned int))) {
+			dtrng_debug("data to  user is %u\n",random);
+			if (copy_to_user(argp, &random, sizeof(unsigned int))) {
 				printk("dtrng get copy_to_user error!!!\n");
 				return -EFAULT;
 			}
@@ -165,21 +303,45 @@ static long dtrng_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 static irqreturn_t dtrng_ope_irq_handler(int irq, void *data)
 {
 	dtrng_operation_t *dtrng = data;
-	dtrng->random[0] = dtrng_reg_read(dtrng, 0x4);
-	printk("%s   random:	0x%08x\n", __func__,dtrng->random[0]);
-
-	dtrng_bit_set(dtrng, 0x0, 12);//clear interrupt
-	dtrng_bit_clr(dtrng, 0x0, 0);//disable dtrng
-	dtrng_bit_set(dtrng, 0x0, 11);//mask the interrupt
-	dtrng_bit_clr(dtrng, 0x0, 12);//normal work
-	complete(&dtrng->dtrng_complete);
-	return 0;
+	unsigned int random = 0;
+
+	spin_lock(&dtrng->lock);
+	/* a late irq of the refill must not take the word being polled */
+	if (!dtrng->polling) {
+		random = dtrng_reg_read(dtrng, DTRNG_RANDOMNUM);
+		kfifo_in(&dtrng->pool, &random, sizeof(random));
+	}
+
+	dtrng_bit_set(dtrng, DTRNG_CFG, 12);//clear interrupt
+	/* keep generating until the pool is full */
+	if (!dtrng->polling && kfifo_avail(&dtrng->pool) < sizeof(random))
+		dtrng_refill_stop(dtrng);
+	dtrng_bit_clr(dtrng, DTRNG_CFG, 12);//normal work
+	spin_unlock(&dtrng->lock);
+
+	wake_up_interruptible(&dtrng->pool_wait);
+	return IRQ_HANDLED;
+}
+
+#if IS_ENABLED(CONFIG_HW_RANDOM)
+/* /dev/hwrng and rngd read the same pool as the misc device */
+static int dtrng_rng_read(struct hwrng *rng, void *data, size_t max, bool wait)
+{
+	dtrng_operation_t *dtrng = container_of(rng, dtrng_operation_t, rng);
+	int ret = 0;
+
+	ret = dtrng_pool_get(dtrng, data, max, !wait);
+	if (ret == -EAGAIN)
+		return 0;
+	return ret;
 }
+#endif
 
 const struct file_operations dtrng_fops = {
 	.owner = THIS_MODULE,
 	.read = dtrng_read,
 	.write = dtrng_write,
+	.poll = dtrng_poll,
 	.open = dtrng_open,
 	.unlocked_ioctl = dtrng_ioctl,
 	.release = dtrng_release,
@@ -210,6 +372,7 @@ static ssize_t dtrng_proc_write(struct file *filp, const char __user * buff, siz
 #if 1
 	int i = 0;
 	int control[4] = {0};
+	unsigned int random = 0;
 	unsigned char *p = NULL;
 	char *after = NULL;
 	memset(dtrng_g->sbuff, 0, SBUFF_SIZE);
@@ -236,9 +399,8 @@ static ssize_t dtrng_proc_write(struct file *filp, const char __user * buff, siz
 	if (control[0] == 0) {
 		dtrng_debug("Start IRQ Mode.\n");
 		for (i = 0; i < control[1]; i++) {
-			dtrng_g->random[0] = control[2];
-			dtrng_irqmode_random(dtrng_g);
-			wait_for_completion(&dtrng_g->dtrng_complete);
+			if (dtrng_irqmode_random(dtrng_g, &random))
+				break;
 			//printk("%s   random:	0x%08x\n", __func__,dtrng_g->random[0]);
 		}
 	}
@@ -246,13 +408,11 @@ static ssize_t dtrng_proc_write(struct file *filp, const char __user * buff, siz
 	if (control[0] == 1) {
 		dtrng_debug("Start CPU Mode.\n");
 		for (i = 0; i < control[1]; i++) {
-			dtrng_g->random[0] = control[2];
-			dtrng_cpu_get_random(dtrng_g);
-			printk("random:	0x%08x\n", dtrng_g->random[0]);
+			random = control[2];
+			if (dtrng_cpu_random_locked(dtrng_g, &random))
+				break;
+			printk("random:	0x%08x\n", random);
 		}
-		dtrng_bit_set(dtrng_g, 0x0, 12);//clear interrupt
-		dtrng_bit_clr(dtrng_g, 0x0, 12);//dtrng normal work
-		dtrng_bit_clr(dtrng_g, 0x0, 0);//diable dirng
 	}
 #endif
 #endif
@@ -303,6 +463,15 @@ static int jz_dtrng_probe(struct platform_device *pdev)
 	}
 	dtrng_debug("%s, dtrng iomem is :0x%08x\n", __func__, (unsigned int)dtrng_ope->iomem);
 
+	spin_lock_init(&dtrng_ope->lock);
+	mutex_init(&dtrng_ope->poll_mutex);
+	init_waitqueue_head(&dtrng_ope->pool_wait);
+	if (kfifo_alloc(&dtrng_ope->pool, max(dtrng_pool_size, DTRNG_READ_CHUNK), GFP_KERNEL)) {
+		dev_err(&pdev->dev, "alloc dtrng pool failed\n");
+		ret = -ENOMEM;
+		goto failed_alloc_pool;
+	}
+
 	dtrng_ope->irq = platform_get_irq(pdev, 0);
 	if (request_irq(dtrng_ope->irq, dtrng_ope_irq_handler, IRQF_SHARED, dtrng_ope->name, dtrng_ope)) {
 		dev_err(&pdev->dev, "request irq failed\n");
@@ -367,7 +536,19 @@ static int jz_dtrng_probe(struct platform_device *pdev)
 		goto failed_create_dtrng;
 	}
 #endif
-	init_completion(&dtrng_ope->dtrng_complete);
+	spin_lock_irq(&dtrng_ope->lock);
+	dtrng_refill_start(dtrng_ope);
+	spin_unlock_irq(&dtrng_ope->lock);
+
+#if IS_ENABLED(CONFIG_HW_RANDOM)
+	/* /dev/dtrng works without it */
+	dtrng_ope->rng.name = dtrng_ope->name;
+	dtrng_ope->rng.read = dtrng_rng_read;
+	if (hwrng_register(&dtrng_ope->rng))
+		dev_warn(&pdev->dev, "register hwrng failed\n");
+	else
+		dtrng_ope->rng_registered = true;
+#endif
 	dtrng_debug("%s: probe() done\n", __func__);
 	return 0;
 failed_create_dtrng:
@@ -385,6 +566,8 @@ failed_clk:
 failed_misc_register:
 	 free_irq(dtrng_ope->irq, dtrng_ope);
 failed_get_irq:
+	kfifo_free(&dtrng_ope->pool);
+failed_alloc_pool:
 	iounmap(dtrng_ope->iomem);
 failed_iomap:
 	release_mem_region(dtrng_ope->res->start, dtrng_ope->res->end - dtrng_ope->res->start + 1);
@@ -397,8 +580,15 @@ failed_get_mem:
 static int jz_dtrng_remove(struct platform_device *pdev)
 {
 	struct dtrng_operation *dtrng_ope = platform_get_drvdata(pdev);
+#if IS_ENABLED(CONFIG_HW_RANDOM)
+	if (dtrng_ope->rng_registered)
+		hwrng_unregister(&dtrng_ope->rng);
+#endif
 	proc_remove(proc_dtrng_dir);
 	proc_remove(entry);
+	spin_lock_irq(&dtrng_ope->lock);
+	dtrng_refill_stop(dtrng_ope);
+	spin_unlock_irq(&dtrng_ope->lock);
 #ifdef CONFIG_SOC_T40
 	clk_disable_unprepare(dtrng_ope->clk);
 	devm_clk_put(&pdev->dev, dtrng_ope->clk);
@@ -409,6 +599,7 @@ static int jz_dtrng_remove(struct platform_device *pdev)
 	misc_deregister(&dtrng_ope->dtrng_dev);
 	free_irq(dtrng_ope->irq, dtrng_ope);
 	iounmap(dtrng_ope->iomem);
+	kfifo_free(&dtrng_ope->pool);
 	kfree(dtrng_ope->sbuff);
 	kfree(dtrng_ope);
 	return 0;
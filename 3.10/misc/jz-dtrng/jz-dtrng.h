@@ -1,6 +1,11 @@
 #ifndef __JZ_DTRNG_H__
 #define __JZ_DTRNG_H__
 
+#if IS_ENABLED(CONFIG_HW_RANDOM)
+#include <linux/hw_random.h>
+#endif
+#include <linux/mutex.h>
+
 #define JZDTRNG_IOC_MAGIC  'D'
 #define IOCTL_DTRNG_DMA_GET_RANDOM					_IO(JZDTRNG_IOC_MAGIC, 110)
 #define IOCTL_DTRNG_CPU_GET_RANDOM					_IO(JZDTRNG_IOC_MAGIC, 111)
@@ -13,7 +18,6 @@
 typedef struct dtrng_operation {
 	struct miscdevice dtrng_dev;
 	struct resource *res;
-	int state;
 	void __iomem *iomem;
 	struct clk *clk;
 	struct device *dev;
@@ -21,7 +25,17 @@ typedef struct dtrng_operation {
 	char name[16];
 	unsigned char *sbuff;
 	unsigned int random[1];
-	struct completion dtrng_complete;
+	/* filled from the irq in the background, protected by lock */
+	spinlock_t lock;
+	struct kfifo pool;
+	wait_queue_head_t pool_wait;
+	bool filling;
+	bool polling;			/* a polled word owns the block */
+	struct mutex poll_mutex;	/* one polled word at a time */
+#if IS_ENABLED(CONFIG_HW_RANDOM)
+	struct hwrng rng;
+	bool rng_registered;
+#endif
 }dtrng_operation_t;
 
 #define miscdev_to_dtrngops(mdev) (container_of(mdev, struct dtrng_operation, dtrng_dev))
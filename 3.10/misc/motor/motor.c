@@ -23,6 +23,7 @@
 #include <linux/gpio.h>
 #include <linux/time.h>
 #include <linux/sched.h>
+#include <linux/poll.h>
 #include <linux/delay.h>
 #include <linux/module.h>
 #include <linux/debugfs.h>
@@ -30,6 +31,8 @@
 #include <linux/mfd/core.h>
 #include <linux/mempolicy.h>
 #include <linux/interrupt.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
 #ifdef CONFIG_SOC_T40
 #include <linux/mfd/ingenic-tcu.h>
 #else
@@ -69,6 +72,26 @@ static unsigned int vmaxstep = -1;
 module_param(vmaxstep, int, S_IRUGO);
 MODULE_PARM_DESC(vmaxstep, "The max steps of vertical motor");
 
+static unsigned int haccel = 0;
+module_param(haccel, uint, S_IRUGO);
+MODULE_PARM_DESC(haccel, "Horizontal motor acceleration in beats/s^2, 0 runs at constant speed");
+
+static unsigned int vaccel = 0;
+module_param(vaccel, uint, S_IRUGO);
+MODULE_PARM_DESC(vaccel, "Vertical motor acceleration in beats/s^2, 0 runs at constant speed");
+
+static unsigned int hjerk = 0;
+module_param(hjerk, uint, S_IRUGO);
+MODULE_PARM_DESC(hjerk, "Horizontal motor jerk in beats/s^3, 0 for a trapezoidal ramp");
+
+static unsigned int vjerk = 0;
+module_param(vjerk, uint, S_IRUGO);
+MODULE_PARM_DESC(vjerk, "Vertical motor jerk in beats/s^3, 0 for a trapezoidal ramp");
+
+static unsigned int start_speed = 200;
+module_param(start_speed, uint, S_IRUGO);
+MODULE_PARM_DESC(start_speed, "Speed in beats/s the ramps start and end at");
+
 /* custom definition for GPIOs (so it's generic rather than hardcoded) */
 int hmin = -1;
 module_param(hmin, int, S_IRUGO);
@@ -158,6 +181,21 @@ static void motor_set_direction(struct motor_device *mdev, int move_direction)
 	}
 }
 
+int gpio_port_write = 1;
+module_param(gpio_port_write, int, S_IRUGO);
+MODULE_PARM_DESC(gpio_port_write, "Write the four coil GPIOs of a motor together when they are on one port. Default: 1 (yes)");
+
+/*
+ * GPIO port layout of the SoCs with a known register map. Other SoCs, and
+ * motors whose coil GPIOs are spread over several ports, keep using one
+ * gpiolib call per pin.
+ */
+#if defined(CONFIG_SOC_T31) || defined(CONFIG_SOC_T40) || defined(CONFIG_SOC_T41)
+#define MOTOR_GPIO_PORT_OFF	0x1000
+#define MOTOR_GPIO_PXPAT0S	0x44
+#define MOTOR_GPIO_PXPAT0C	0x48
+#endif
+
 struct motor_platform_data motors_pdata[HAS_MOTOR_CNT] = {
 	{
 		.name = "Horizontal motor",
@@ -213,6 +251,63 @@ static unsigned char step_8[8] = {
 	0x09
 };
 
+static void motor_gpio_port_init(struct motor_driver *motor)
+{
+#ifdef MOTOR_GPIO_PORT_OFF
+	int gpios[4] = {
+		motor->pdata->motor_st1_gpio,
+		motor->pdata->motor_st2_gpio,
+		motor->pdata->motor_st3_gpio,
+		motor->pdata->motor_st4_gpio,
+	};
+	int i, port = -1;
+
+	motor->gpio_mask = 0;
+	if (!gpio_port_write)
+		return;
+	for (i = 0; i < 4; i++) {
+		if (gpios[i] < 0 || (port >= 0 && gpios[i] / 32 != port))
+			return;
+		port = gpios[i] / 32;
+		motor->gpio_pins[i] = 1 << (gpios[i] % 32);
+		motor->gpio_mask |= motor->gpio_pins[i];
+	}
+	/* the pins were made outputs by gpiolib, only the data bits change */
+	motor->gpio_port = ioremap(GPIO_IOBASE + port * MOTOR_GPIO_PORT_OFF, MOTOR_GPIO_PORT_OFF);
+#endif
+}
+
+/* coils: bit 3 drives st1 down to bit 0 for st4, as in step_8 */
+static void motor_write_coils(struct motor_driver *motor, unsigned int coils)
+{
+#ifdef MOTOR_GPIO_PORT_OFF
+	unsigned int set = 0;
+	int i;
+
+	if (motor->gpio_port) {
+		for (i = 0; i < 4; i++)
+			if (coils & (0x8 >> i))
+				set |= motor->gpio_pins[i];
+		writel(set, motor->gpio_port + MOTOR_GPIO_PXPAT0S);
+		writel(motor->gpio_mask & ~set, motor->gpio_port + MOTOR_GPIO_PXPAT0C);
+		return;
+	}
+#endif
+	// Only set GPIOs if they are valid (i.e., not -1)
+	if (motor->pdata->motor_st1_gpio != -1) {
+		gpio_direction_output(motor->pdata->motor_st1_gpio, coils & 0x8);
+	}
+	if (motor->pdata->motor_st2_gpio != -1) {
+		gpio_direction_output(motor->pdata->motor_st2_gpio, coils & 0x4);
+	}
+	if (motor->pdata->motor_st3_gpio != -1) {
+		gpio_direction_output(motor->pdata->motor_st3_gpio, coils & 0x2);
+	}
+	if (motor->pdata->motor_st4_gpio != -1) {
+		gpio_direction_output(motor->pdata->motor_st4_gpio, coils & 0x1);
+	}
+}
+
 static void motor_move_step(struct motor_device *mdev, int index)
 {
 	struct motor_driver *motor = NULL;
@@ -228,40 +323,53 @@ static void motor_move_step(struct motor_device *mdev, int index)
 			motor_set_direction(mdev, (index == HORIZONTAL_MOTOR) ? MOTOR_MOVE_RIGHT_UP : MOTOR_MOVE_LEFT_DOWN);
 		}
 
-		// Only set GPIOs if they are valid (i.e., not -1)
-		if (motor->pdata->motor_st1_gpio != -1) {
-			gpio_direction_output(motor->pdata->motor_st1_gpio, (step_8[step] ^ 0xff) & 0x8);
-		}
-		if (motor->pdata->motor_st2_gpio != -1) {
-			gpio_direction_output(motor->pdata->motor_st2_gpio, (step_8[step] ^ 0xff) & 0x4);
-		}
-		if (motor->pdata->motor_st3_gpio != -1) {
-			gpio_direction_output(motor->pdata->motor_st3_gpio, (step_8[step] ^ 0xff) & 0x2);
-		}
-		if (motor->pdata->motor_st4_gpio != -1) {
-			gpio_direction_output(motor->pdata->motor_st4_gpio, (step_8[step] ^ 0xff) & 0x1);
-		}
-
+		motor_write_coils(motor, (step_8[step] ^ 0xff) & 0xf);
 	} else {
-		// Reset GPIOs only if they are valid (not -1)
-		if (motor->pdata->motor_st1_gpio != -1) {
-			gpio_direction_output(motor->pdata->motor_st1_gpio, (0 ^ invert_gpio_dir) & 0x1);
-		}
-		if (motor->pdata->motor_st2_gpio != -1) {
-			gpio_direction_output(motor->pdata->motor_st2_gpio, (0 ^ invert_gpio_dir) & 0x1);
-		}
-		if (motor->pdata->motor_st3_gpio != -1) {
-			gpio_direction_output(motor->pdata->motor_st3_gpio, (0 ^ invert_gpio_dir) & 0x1);
-		}
-		if (motor->pdata->motor_st4_gpio != -1) {
-			gpio_direction_output(motor->pdata->motor_st4_gpio, (0 ^ invert_gpio_dir) & 0x1);
-		}
+		// Release all coils
+		motor_write_coils(motor, invert_gpio_dir ? 0xf : 0);
 	}
 	if(motor->state == MOTOR_OPS_RESET){
 		motor->total_steps++;
 	}
 }
 
+static unsigned int pos_event_ms = 0;
+module_param(pos_event_ms, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(pos_event_ms, "Period of the MOTOR_EVENT_POS records while moving, 0 disables them. Default: 0");
+
+/* may be called from the timer interrupt */
+static void motor_event(struct motor_device *mdev, unsigned int type, unsigned int axis)
+{
+	struct motor_event ev;
+	unsigned long flags;
+
+	ev.type = type;
+	ev.axis = axis;
+	ev.x = mdev->motors[HORIZONTAL_MOTOR].cur_steps;
+	ev.y = mdev->motors[VERTICAL_MOTOR].cur_steps;
+	ev.timestamp_ns = ktime_to_ns(ktime_get());
+
+	spin_lock_irqsave(&mdev->event_lock, flags);
+	if (kfifo_is_full(&mdev->events))
+		kfifo_skip(&mdev->events);
+	kfifo_in(&mdev->events, &ev, 1);
+	spin_unlock_irqrestore(&mdev->event_lock, flags);
+	wake_up_interruptible(&mdev->event_wait);
+}
+
+static void motor_event_pos(struct motor_device *mdev)
+{
+	ktime_t now;
+
+	if (!pos_event_ms)
+		return;
+	now = ktime_get();
+	if (ktime_to_ms(ktime_sub(now, mdev->event_pos_time)) < pos_event_ms)
+		return;
+	mdev->event_pos_time = now;
+	motor_event(mdev, MOTOR_EVENT_POS, 0);
+}
+
 static void move_to_min_pose_ops(struct motor_driver *motor)
 {
 	//	printk("%s min %d\n",motor->pdata->name,__LINE__);
@@ -301,14 +409,128 @@ static void move_to_max_pose_ops(struct motor_driver *motor,int index)
 }
 
 
+static void motor_set_period(struct motor_device *mdev, int speed)
+{
+#ifdef CONFIG_SOC_T40
+	ingenic_tcu_set_period(mdev->tcu->cib.id,(24000000 / 64 / speed));
+#else
+	jz_tcu_set_period(mdev->tcu, (24000000 / 64 / speed));
+#endif
+}
+
+static inline bool motor_ramp_valid(unsigned int accel, unsigned int jerk)
+{
+	return accel <= MOTOR_MAX_ACCEL && jerk <= MOTOR_MAX_JERK;
+}
+
+/* beats needed to slow down from the current speed to start_speed */
+static unsigned int motor_ramp_stop_steps(struct motor_ramp *ramp)
+{
+	unsigned int v = ramp->speed, vmin = ramp->start_speed;
+	u64 steps = 0;
+
+	if (!ramp->max_accel || v <= vmin)
+		return 0;
+
+	steps = div64_u64((u64)v * v - (u64)vmin * vmin, 2ULL * ramp->max_accel);
+	/* the S-curve spends extra beats turning the acceleration around */
+	if (ramp->jerk)
+		steps += div64_u64((u64)v * ramp->max_accel, 2ULL * ramp->jerk);
+	return (unsigned int)min_t(u64, steps + 1, UINT_MAX);
+}
+
+/*
+ * Called with slock held before the step clock is started. The ramp of
+ * the motor with the most beats to go drives the shared timer.
+ */
+static void motor_ramp_start(struct motor_device *mdev, int lead)
+{
+	struct motor_ramp *ramp = &mdev->ramp;
+
+	ramp->max_accel = mdev->motors[lead].accel;
+	ramp->jerk = mdev->motors[lead].jerk;
+	ramp->start_speed = min_t(unsigned int, max_t(unsigned int, start_speed, MOTOR_MIN_SPEED), mdev->tcu_speed);
+	ramp->accel = ramp->jerk ? 0 : ramp->max_accel;
+	ramp->phase = MOTOR_RAMP_ACCEL;
+	ramp->speed = ramp->max_accel ? ramp->start_speed : mdev->tcu_speed;
+	motor_set_period(mdev, ramp->speed);
+}
+
+/*
+ * One beat of the ramp, remaining is the number of beats left in the move
+ * (0 while cruising). Over one beat v^2 changes by 2a, so no time base is
+ * needed; the jerk changes the acceleration by jerk / v per beat.
+ */
+static void motor_ramp_next(struct motor_device *mdev, unsigned int remaining)
+{
+	struct motor_ramp *ramp = &mdev->ramp;
+	unsigned int vmax = mdev->tcu_speed, v = ramp->speed, vmin = ramp->start_speed;
+	unsigned int da = 0;
+	u64 v2 = 0;
+
+	if (!ramp->max_accel)
+		return;
+
+	if (remaining && remaining <= motor_ramp_stop_steps(ramp)) {
+		if (ramp->phase != MOTOR_RAMP_DECEL && ramp->jerk)
+			ramp->accel = 0;
+		ramp->phase = MOTOR_RAMP_DECEL;
+	} else if (v < vmax) {
+		ramp->phase = MOTOR_RAMP_ACCEL;
+	} else {
+		ramp->phase = MOTOR_RAMP_CRUISE;
+	}
+
+	if (ramp->jerk) {
+		da = max_t(unsigned int, ramp->jerk / v, 1);
+		if (ramp->phase == MOTOR_RAMP_CRUISE) {
+			ramp->accel = 0;
+		} else if ((u64)(ramp->phase == MOTOR_RAMP_ACCEL ? vmax - v : v - vmin) * 2 * ramp->jerk
+				<= (u64)ramp->accel * ramp->accel) {
+			/* close to the end speed, let the acceleration fall off */
+			ramp->accel = ramp->accel > da ? ramp->accel - da : da;
+		} else {
+			ramp->accel = min(ramp->accel + da, ramp->max_accel);
+		}
+	}
+
+	switch (ramp->phase) {
+	case MOTOR_RAMP_ACCEL:
+		/* clamped so int_sqrt() gets a value that fits its unsigned long */
+		v2 = min_t(u64, (u64)v * v + 2ULL * ramp->accel, (u64)vmax * vmax);
+		v = min_t(unsigned int, int_sqrt((unsigned long)v2), vmax);
+		break;
+	case MOTOR_RAMP_DECEL:
+		v2 = (u64)v * v;
+		v2 = v2 > (u64)vmin * vmin + 2ULL * ramp->accel ? v2 - 2ULL * ramp->accel : (u64)vmin * vmin;
+		v = max_t(unsigned int, int_sqrt((unsigned long)v2), vmin);
+		break;
+	default:
+		v = vmax;
+		break;
+	}
+
+	if (v != ramp->speed) {
+		ramp->speed = v;
+		motor_set_period(mdev, v);
+	}
+}
+
 static char skip_move_mode[4][4] = {{2,0,0,0},
 				    {3,2,0,0},
 				    {4,3,2,0},
 				    {4,3,2,1}};
 
+static char skip_move_none[4] = {1,1,1,1};
+
 static inline void calc_slow_mode(struct motor_device *mdev, unsigned int steps)
 {
 	int index = steps / 10;
+	/* the acceleration ramp already starts and ends slowly */
+	if (mdev->ramp.max_accel) {
+		mdev->skip_mode = skip_move_none;
+		return;
+	}
 	index = index > 3 ? 3 : index;
 	mdev->skip_mode = skip_move_mode[index];
 }
@@ -327,15 +549,129 @@ static inline int whether_move_func(struct motor_device *mdev, unsigned int rema
 		return 0;
 }
 
+/*
+ * Called with slock held, (x, y) are the beat counts of the move. The
+ * vertical axis still runs at most one beat per hmotor2vmotor ticks.
+ */
+static void motor_line_start(struct motor_device *mdev, int x, int y)
+{
+	mdev->dst_move.one.x = x;
+	mdev->dst_move.one.y = y;
+	mdev->cur_move.one.x = 0;
+	mdev->cur_move.one.y = 0;
+	motor_line_init(&mdev->line, x, y, hmotor2vmotor);
+}
+
+static void motor_line_axis(struct motor_device *mdev, int index, int *cur, int dst)
+{
+	struct motor_driver *motor = &mdev->motors[index];
+
+	if (!motor_line_beat(&mdev->line, index, dst))
+		return;
+
+	/* an axis stopped by its limit switch drops its remaining beats */
+	if (*cur < dst && motor->state != MOTOR_OPS_STOP) {
+		motor->cur_steps += motor->move_dir;
+		motor_move_step(mdev, index);
+		(*cur)++;
+	}
+}
+
+/*
+ * Called with slock held. Sets up a relative move of (x, y) beats and
+ * returns 0 when there is nothing to move.
+ */
+static int __motor_move_start(struct motor_device *mdev, int x, int y)
+{
+	struct motor_driver *motors = mdev->motors;
+	int x_dir = MOTOR_MOVE_STOP;
+	int y_dir = MOTOR_MOVE_STOP;
+	int x1 = 0;
+	int y1 = 0;
+	/* check x value */
+	if(x > 0){
+		if(motors[HORIZONTAL_MOTOR].cur_steps >= motors[HORIZONTAL_MOTOR].max_steps)
+			x = 0;
+	}else{
+		if(motors[HORIZONTAL_MOTOR].cur_steps <= 0)
+			x = 0;
+	}
+	/* check y value */
+	if(y > 0){
+		if(motors[VERTICAL_MOTOR].cur_steps >= motors[VERTICAL_MOTOR].max_steps)
+			y = 0;
+	}else{
+		if(motors[VERTICAL_MOTOR].cur_steps <= 0)
+			y = 0;
+	}
+
+	/*x_dir = x > 0 ? MOTOR_MOVE_RIGHT_UP : (x < 0 ? MOTOR_MOVE_LEFT_DOWN: MOTOR_MOVE_STOP);*/
+	/*y_dir = y > 0 ? MOTOR_MOVE_RIGHT_UP : (y < 0 ? MOTOR_MOVE_LEFT_DOWN: MOTOR_MOVE_STOP);*/
+	x_dir = x > 0 ? MOTOR_MOVE_RIGHT_UP : MOTOR_MOVE_LEFT_DOWN;
+	y_dir = y > 0 ? MOTOR_MOVE_RIGHT_UP : MOTOR_MOVE_LEFT_DOWN;
+	x1 = x < 0 ? 0 - x : x;
+	y1 = y < 0 ? 0 - y : y;
+
+	if(x1 + y1 == 0)
+		return 0;
+
+	motor_ramp_start(mdev, x1 >= y1 * (int)hmotor2vmotor ? HORIZONTAL_MOTOR : VERTICAL_MOTOR);
+	motor_line_start(mdev, x1, y1);
+	calc_slow_mode(mdev, mdev->line.ticks);
+	mdev->counter = 0;
+	mdev->dev_state = MOTOR_OPS_NORMAL;
+	motors[HORIZONTAL_MOTOR].state = MOTOR_OPS_NORMAL;
+	motors[HORIZONTAL_MOTOR].move_dir = x_dir;
+	motors[VERTICAL_MOTOR].state = MOTOR_OPS_NORMAL;
+	motors[VERTICAL_MOTOR].move_dir = y_dir;
+	/* printk("x_dir=%d,y_dir=%d\n",x_dir,y_dir); */
+	return 1;
+}
+
+/*
+ * Called from the timer interrupt once both motors stopped in a waypoint
+ * program. Returns 1 while the program keeps the step clock busy: waiting
+ * at a waypoint or starting the next leg.
+ */
+static int motor_waypoint_next(struct motor_device *mdev)
+{
+	struct motor_waypoint_queue *wp = &mdev->wp;
+	struct motor_waypoint *point = NULL;
+
+	/* the clock keeps running at the speed the leg ended with */
+	switch(motor_waypoint_step(wp, mdev->ramp.speed)){
+	case MOTOR_WP_DONE:
+		return 0;
+	case MOTOR_WP_DWELL:
+		motor_move_step(mdev, HORIZONTAL_MOTOR);
+		motor_move_step(mdev, VERTICAL_MOTOR);
+		return 1;
+	default:
+		break;
+	}
+
+	point = &wp->points[wp->cur];
+	if(point->speed >= MOTOR_MIN_SPEED && point->speed <= MOTOR_MAX_SPEED)
+		mdev->tcu_speed = point->speed;
+	__motor_move_start(mdev, point->x - mdev->motors[HORIZONTAL_MOTOR].cur_steps,
+			point->y - mdev->motors[VERTICAL_MOTOR].cur_steps);
+	return 1;
+}
+
 static irqreturn_t jz_timer_interrupt(int irq, void *dev_id)
 {
 	struct motor_device *mdev = dev_id;
 	struct motor_move *dst = &mdev->dst_move;
 	struct motor_move *cur = &mdev->cur_move;
 	struct motor_driver *motors = mdev->motors;
+	enum motor_ops_state hstate, vstate;
 
 	if(motors[HORIZONTAL_MOTOR].state == MOTOR_OPS_STOP
 			&& motors[VERTICAL_MOTOR].state == MOTOR_OPS_STOP){
+		if(mdev->dev_state == MOTOR_OPS_NORMAL && motor_waypoint_next(mdev))
+			return IRQ_HANDLED;
+		if(mdev->dev_state != MOTOR_OPS_STOP)
+			motor_event(mdev, MOTOR_EVENT_DONE, 0);
 		mdev->dev_state = MOTOR_OPS_STOP;
 		motor_move_step(mdev, HORIZONTAL_MOTOR);
 		motor_move_step(mdev, VERTICAL_MOTOR);
@@ -346,6 +682,9 @@ static irqreturn_t jz_timer_interrupt(int irq, void *dev_id)
 		return IRQ_HANDLED;
 	}
 
+	hstate = motors[HORIZONTAL_MOTOR].state;
+	vstate = motors[VERTICAL_MOTOR].state;
+
 	if(motors[HORIZONTAL_MOTOR].cur_steps <= 0)
 		move_to_min_pose_ops(&motors[HORIZONTAL_MOTOR]);
 
@@ -358,6 +697,14 @@ static irqreturn_t jz_timer_interrupt(int irq, void *dev_id)
 	if(motors[VERTICAL_MOTOR].cur_steps >= motors[VERTICAL_MOTOR].max_steps)
 		move_to_max_pose_ops(&motors[VERTICAL_MOTOR],VERTICAL_MOTOR);
 
+	/* an axis without beats in the move sits at its end too, that is no limit hit */
+	if(hstate == MOTOR_OPS_NORMAL && motors[HORIZONTAL_MOTOR].state == MOTOR_OPS_STOP
+			&& cur->one.x < dst->one.x)
+		motor_event(mdev, MOTOR_EVENT_LIMIT, HORIZONTAL_MOTOR);
+	if(vstate == MOTOR_OPS_NORMAL && motors[VERTICAL_MOTOR].state == MOTOR_OPS_STOP
+			&& cur->one.y < dst->one.y)
+		motor_event(mdev, MOTOR_EVENT_LIMIT, VERTICAL_MOTOR);
+
 	if(mdev->dev_state == MOTOR_OPS_CRUISE){
 		mdev->counter++;
 		motors[HORIZONTAL_MOTOR].cur_steps += motors[HORIZONTAL_MOTOR].move_dir;
@@ -365,6 +712,7 @@ static irqreturn_t jz_timer_interrupt(int irq, void *dev_id)
 			motors[VERTICAL_MOTOR].cur_steps += motors[VERTICAL_MOTOR].move_dir;
 		motor_move_step(mdev, HORIZONTAL_MOTOR);
 		motor_move_step(mdev, VERTICAL_MOTOR);
+		motor_ramp_next(mdev, 0);
 	}else if(mdev->dev_state == MOTOR_OPS_RESET){
 		if(motors[HORIZONTAL_MOTOR].state != MOTOR_OPS_STOP){
 			motors[HORIZONTAL_MOTOR].cur_steps += motors[HORIZONTAL_MOTOR].move_dir;
@@ -379,82 +727,37 @@ static irqreturn_t jz_timer_interrupt(int irq, void *dev_id)
 	}else{
 		mdev->counter++;
 
-		if(cur->one.x < dst->one.x && motors[HORIZONTAL_MOTOR].state != MOTOR_OPS_STOP){
-			if(whether_move_func(mdev, dst->one.x - cur->one.x)){
-				motors[HORIZONTAL_MOTOR].cur_steps += motors[HORIZONTAL_MOTOR].move_dir;
-				motor_move_step(mdev, HORIZONTAL_MOTOR);
-				cur->one.x++;
-			}
-		}else{
-			motors[HORIZONTAL_MOTOR].state = MOTOR_OPS_STOP;
+		if(mdev->line.n < mdev->line.ticks && whether_move_func(mdev, mdev->line.ticks - mdev->line.n)){
+			mdev->line.n++;
+			motor_line_axis(mdev, HORIZONTAL_MOTOR, &cur->one.x, dst->one.x);
+			motor_line_axis(mdev, VERTICAL_MOTOR, &cur->one.y, dst->one.y);
 		}
-
-		if(cur->one.y < dst->one.y && motors[VERTICAL_MOTOR].state != MOTOR_OPS_STOP){
-			if(mdev->counter % hmotor2vmotor == 0){
-				motors[VERTICAL_MOTOR].cur_steps += motors[VERTICAL_MOTOR].move_dir;
-				cur->one.y++;
-				motor_move_step(mdev, VERTICAL_MOTOR);
-			}
-		}else{
+		if(mdev->line.n >= mdev->line.ticks){
+			motors[HORIZONTAL_MOTOR].state = MOTOR_OPS_STOP;
 			motors[VERTICAL_MOTOR].state = MOTOR_OPS_STOP;
 		}
+		motor_ramp_next(mdev, mdev->line.ticks - mdev->line.n);
 	}
+	motor_event_pos(mdev);
 	return IRQ_HANDLED;
 }
 
 static long motor_ops_move(struct motor_device *mdev, int x, int y)
 {
-	struct motor_driver *motors = mdev->motors;
 	unsigned long flags;
-	int x_dir = MOTOR_MOVE_STOP;
-	int y_dir = MOTOR_MOVE_STOP;
-	int x1 = 0;
-	int y1 = 0;
-	/* check x value */
-	if(x > 0){
-		if(motors[HORIZONTAL_MOTOR].cur_steps >= motors[HORIZONTAL_MOTOR].max_steps)
-			x = 0;
-	}else{
-		if(motors[HORIZONTAL_MOTOR].cur_steps <= 0)
-			x = 0;
-	}
-	/* check y value */
-	if(y > 0){
-		if(motors[VERTICAL_MOTOR].cur_steps >= motors[VERTICAL_MOTOR].max_steps)
-			y = 0;
-	}else{
-		if(motors[VERTICAL_MOTOR].cur_steps <= 0)
-			y = 0;
-	}
-
-	/*x_dir = x > 0 ? MOTOR_MOVE_RIGHT_UP : (x < 0 ? MOTOR_MOVE_LEFT_DOWN: MOTOR_MOVE_STOP);*/
-	/*y_dir = y > 0 ? MOTOR_MOVE_RIGHT_UP : (y < 0 ? MOTOR_MOVE_LEFT_DOWN: MOTOR_MOVE_STOP);*/
-	x_dir = x > 0 ? MOTOR_MOVE_RIGHT_UP : MOTOR_MOVE_LEFT_DOWN;
-	y_dir = y > 0 ? MOTOR_MOVE_RIGHT_UP : MOTOR_MOVE_LEFT_DOWN;
-	x1 = x < 0 ? 0 - x : x;
-	y1 = y < 0 ? 0 - y : y;
-
-	if(x1 + y1 == 0)
-		return 0;
+	int ret = 0;
 
 	mutex_lock(&mdev->dev_mutex);
 	spin_lock_irqsave(&mdev->slock, flags);
-
-	calc_slow_mode(mdev, x1);
-	mdev->counter = 0;
-	mdev->dev_state = MOTOR_OPS_NORMAL;
-	mdev->dst_move.one.x = x1;
-	mdev->dst_move.one.y = y1;
-	mdev->cur_move.one.x = 0;
-	mdev->cur_move.one.y = 0;
-	motors[HORIZONTAL_MOTOR].state = MOTOR_OPS_NORMAL;
-	motors[HORIZONTAL_MOTOR].move_dir = x_dir;
-	motors[VERTICAL_MOTOR].state = MOTOR_OPS_NORMAL;
-	motors[VERTICAL_MOTOR].move_dir = y_dir;
+	/* an explicit move replaces a running waypoint program */
+	mdev->wp.count = 0;
+	mdev->wp.dwell = 0;
+	ret = __motor_move_start(mdev, x, y);
 	spin_unlock_irqrestore(&mdev->slock, flags);
 	mutex_unlock(&mdev->dev_mutex);
+	if(!ret)
+		return 0;
 	/* printk("%s%d x=%d y=%d t=%d\n",__func__,__LINE__,mdev->dst_move.one.x,mdev->dst_move.one.y,mdev->dst_move.times); */
-	/* printk("x_dir=%d,y_dir=%d\n",x_dir,y_dir); */
 #ifdef CONFIG_SOC_T40
 	ingenic_tcu_counter_begin(mdev->tcu);
 #else
@@ -467,7 +770,7 @@ static void motor_ops_stop(struct motor_device *mdev)
 {
 	unsigned long flags;
 	long ret = 0;
-	unsigned int remainder = 0;
+	unsigned int remainder = 0, ticks = 0;
 	struct motor_driver *motors = mdev->motors;
 	struct motor_move *dst = &mdev->dst_move;
 	struct motor_move *cur = &mdev->cur_move;
@@ -479,16 +782,17 @@ static void motor_ops_stop(struct motor_device *mdev)
 	mutex_lock(&mdev->dev_mutex);
 	spin_lock_irqsave(&mdev->slock, flags);
 
+	/* the current leg still ends with its tail, the program is dropped */
+	mdev->wp.count = 0;
+	mdev->wp.dwell = 0;
+
 	if(mdev->dev_state == MOTOR_OPS_NORMAL){
-		remainder = dst->one.x - cur->one.x;
-		if(remainder > 30){
-			dst->one.x = 29;
-			cur->one.x = 0;
-		}
-		remainder = dst->one.y - cur->one.y;
-		if(remainder > 8){
-			dst->one.y = 6;
-			cur->one.y = 0;
+		/* finish along the same line over a short tail */
+		remainder = mdev->line.ticks - mdev->line.n;
+		ticks = mdev->ramp.max_accel ? motor_ramp_stop_steps(&mdev->ramp) : 29;
+		if(remainder > ticks){
+			motor_line_start(mdev, (dst->one.x - cur->one.x) * ticks / remainder,
+					(dst->one.y - cur->one.y) * ticks / remainder);
 		}
 	}
 
@@ -496,10 +800,12 @@ static void motor_ops_stop(struct motor_device *mdev)
 		mdev->dev_state = MOTOR_OPS_NORMAL;
 		motors[HORIZONTAL_MOTOR].state = MOTOR_OPS_NORMAL;
 		motors[VERTICAL_MOTOR].state = MOTOR_OPS_NORMAL;
-		dst->one.x = 0;
-		cur->one.x = 0;
-		dst->one.y = 0;
-		cur->one.y = 0;
+		/* keep going the cruise way, the ramp slows it over the tail */
+		if(mdev->ramp.max_accel){
+			ticks = motor_ramp_stop_steps(&mdev->ramp);
+			mdev->skip_mode = skip_move_none;
+		}
+		motor_line_start(mdev, ticks, ticks / hmotor2vmotor);
 	}
 
 	mdev->counter = 0;
@@ -525,6 +831,56 @@ static void motor_ops_stop(struct motor_device *mdev)
 	return;
 }
 
+static long motor_ops_waypoints(struct motor_device *mdev, struct motor_waypoints *wps)
+{
+	struct motor_waypoint *points = NULL, *old = NULL;
+	unsigned long flags;
+	long ret = 0;
+
+	if(wps->count == 0 || wps->count > MOTOR_MAX_WAYPOINTS)
+		return -EINVAL;
+
+	points = kmalloc(wps->count * sizeof(struct motor_waypoint), GFP_KERNEL);
+	if(!points)
+		return -ENOMEM;
+	if (copy_from_user(points, (void __user *)wps->points, wps->count * sizeof(struct motor_waypoint))) {
+		dev_err(mdev->dev, "[%s][%d] copy from user error\n", __func__, __LINE__);
+		kfree(points);
+		return -EFAULT;
+	}
+
+	mutex_lock(&mdev->dev_mutex);
+	spin_lock_irqsave(&mdev->slock, flags);
+	if(mdev->dev_state != MOTOR_OPS_STOP){
+		ret = -EBUSY;
+		old = points;
+	}else{
+		old = mdev->wp.points;
+		mdev->wp.points = points;
+		mdev->wp.count = wps->count;
+		mdev->wp.loop = wps->loop;
+		mdev->wp.cur = -1;
+		mdev->wp.dwell = 0;
+		mdev->wp.arrived = true;
+		/* the first leg is started by the next tick */
+		mdev->motors[HORIZONTAL_MOTOR].state = MOTOR_OPS_STOP;
+		mdev->motors[VERTICAL_MOTOR].state = MOTOR_OPS_STOP;
+		mdev->dev_state = MOTOR_OPS_NORMAL;
+	}
+	spin_unlock_irqrestore(&mdev->slock, flags);
+	mutex_unlock(&mdev->dev_mutex);
+	kfree(old);
+	if(ret)
+		return ret;
+
+#ifdef CONFIG_SOC_T40
+	ingenic_tcu_counter_begin(mdev->tcu);
+#else
+	jz_tcu_enable_counter(mdev->tcu);
+#endif
+	return 0;
+}
+
 static long motor_ops_goback(struct motor_device *mdev)
 {
 	struct motor_driver *motors = mdev->motors;
@@ -545,6 +901,7 @@ static long motor_ops_cruise(struct motor_device *mdev)
 	motor_ops_goback(mdev);
 	mutex_lock(&mdev->dev_mutex);
 	spin_lock_irqsave(&mdev->slock, flags);
+	motor_ramp_start(mdev, HORIZONTAL_MOTOR);
 	mdev->dev_state = MOTOR_OPS_CRUISE;
 	motors[HORIZONTAL_MOTOR].state = MOTOR_OPS_CRUISE;
 	motors[VERTICAL_MOTOR].state = MOTOR_OPS_CRUISE;
@@ -688,11 +1045,36 @@ static int motor_speed(struct motor_device *mdev, int speed)
 	__asm__("ssnop");
 
 	mdev->tcu_speed = speed;
-#ifdef CONFIG_SOC_T40
-	ingenic_tcu_set_period(mdev->tcu->cib.id,(24000000 / 64 / mdev->tcu_speed));
-#else
-	jz_tcu_set_period(mdev->tcu, (24000000 / 64 / mdev->tcu_speed));
-#endif
+	/* a running ramp picks the new top speed up on its next beat */
+	if (!mdev->ramp.max_accel || mdev->dev_state == MOTOR_OPS_STOP)
+		motor_set_period(mdev, mdev->tcu_speed);
+	return 0;
+}
+
+static long motor_set_ramp(struct motor_device *mdev, struct motor_ramp_data *rdata)
+{
+	unsigned long flags;
+
+	if (rdata->start_speed < MOTOR_MIN_SPEED || rdata->start_speed > MOTOR_MAX_SPEED) {
+		dev_err(mdev->dev, "start speed(%d) set error\n", rdata->start_speed);
+		return -EINVAL;
+	}
+	if (!motor_ramp_valid(rdata->x_accel, rdata->x_jerk) ||
+	    !motor_ramp_valid(rdata->y_accel, rdata->y_jerk)) {
+		dev_err(mdev->dev, "ramp accel(%u, %u) jerk(%u, %u) set error\n",
+				rdata->x_accel, rdata->y_accel, rdata->x_jerk, rdata->y_jerk);
+		return -EINVAL;
+	}
+
+	/* takes effect from the next move */
+	spin_lock_irqsave(&mdev->slock, flags);
+	mdev->motors[HORIZONTAL_MOTOR].accel = rdata->x_accel;
+	mdev->motors[VERTICAL_MOTOR].accel = rdata->y_accel;
+	mdev->motors[HORIZONTAL_MOTOR].jerk = rdata->x_jerk;
+	mdev->motors[VERTICAL_MOTOR].jerk = rdata->y_jerk;
+	start_speed = rdata->start_speed;
+	spin_unlock_irqrestore(&mdev->slock, flags);
+
 	return 0;
 }
 
@@ -700,12 +1082,16 @@ static int motor_open(struct inode *inode, struct file *file)
 {
 	struct miscdevice *dev = file->private_data;
 	struct motor_device *mdev = container_of(dev, struct motor_device, misc_dev);
+	unsigned long flags;
 	int ret = 0;
 	if(mdev->flag){
 		ret = -EBUSY;
 		dev_err(mdev->dev, "Motor driver busy now!\n");
 	}else{
 		mdev->flag = 1;
+		spin_lock_irqsave(&mdev->event_lock, flags);
+		kfifo_reset(&mdev->events);
+		spin_unlock_irqrestore(&mdev->event_lock, flags);
 	}
 
 	return ret;
@@ -809,6 +1195,28 @@ static long motor_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 			/*printk("MOTOR_CRUISE!!!!!!!!!!!!!!!!!!!!!!!\n");*/
 			ret = motor_ops_cruise(mdev);
 			break;
+		case MOTOR_WAYPOINTS:
+			{
+				struct motor_waypoints wps;
+
+				if (copy_from_user(&wps, (void __user *)arg, sizeof(wps))) {
+					dev_err(mdev->dev, "[%s][%d] copy from user error\n", __func__, __LINE__);
+					return -EFAULT;
+				}
+				ret = motor_ops_waypoints(mdev, &wps);
+			}
+			break;
+		case MOTOR_SET_RAMP:
+			{
+				struct motor_ramp_data rdata;
+
+				if (copy_from_user(&rdata, (void __user *)arg, sizeof(rdata))) {
+					dev_err(mdev->dev, "[%s][%d] copy from user error\n", __func__, __LINE__);
+					return -EFAULT;
+				}
+				ret = motor_set_ramp(mdev, &rdata);
+			}
+			break;
 		default:
 			return -EINVAL;
 	}
@@ -816,9 +1224,57 @@ static long motor_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	return ret;
 }
 
+static ssize_t motor_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+	struct miscdevice *dev = file->private_data;
+	struct motor_device *mdev = container_of(dev, struct motor_device, misc_dev);
+	struct motor_event ev;
+	unsigned long flags;
+	size_t done = 0;
+	int ret = 0;
+
+	if (count < sizeof(ev))
+		return -EINVAL;
+
+	while (!done) {
+		if (kfifo_is_empty(&mdev->events)) {
+			if (file->f_flags & O_NONBLOCK)
+				return -EAGAIN;
+			ret = wait_event_interruptible(mdev->event_wait, !kfifo_is_empty(&mdev->events));
+			if (ret)
+				return ret;
+		}
+		while (done + sizeof(ev) <= count) {
+			spin_lock_irqsave(&mdev->event_lock, flags);
+			ret = kfifo_out(&mdev->events, &ev, 1);
+			spin_unlock_irqrestore(&mdev->event_lock, flags);
+			if (!ret)
+				break;
+			if (copy_to_user(buf + done, &ev, sizeof(ev)))
+				return done ? done : -EFAULT;
+			done += sizeof(ev);
+		}
+	}
+
+	return done;
+}
+
+static unsigned int motor_poll(struct file *file, poll_table *wait)
+{
+	struct miscdevice *dev = file->private_data;
+	struct motor_device *mdev = container_of(dev, struct motor_device, misc_dev);
+
+	poll_wait(file, &mdev->event_wait, wait);
+	if (!kfifo_is_empty(&mdev->events))
+		return POLLIN | POLLRDNORM;
+	return 0;
+}
+
 static struct file_operations motor_fops = {
 	.open = motor_open,
 	.release = motor_release,
+	.read = motor_read,
+	.poll = motor_poll,
 	.unlocked_ioctl = motor_ioctl,
 };
 
@@ -835,9 +1291,13 @@ static int motor_info_show(struct seq_file *m, void *v)
 	seq_printf(m ,"The status of motor is %s\n", msg.status ? "running" : "stop");
 	seq_printf(m ,"The pos of motor is (%d, %d)\n", msg.x, msg.y);
 	seq_printf(m ,"The speed of motor is %d\n", msg.speed);
+	seq_printf(m ,"The step rate is %u, ramp start speed %u\n", mdev->ramp.speed, start_speed);
+	if (mdev->wp.count)
+		seq_printf(m ,"Waypoint %d of %u%s\n", mdev->wp.cur + 1, mdev->wp.count, mdev->wp.loop ? " (loop)" : "");
 
 	for (index = 0; index < HAS_MOTOR_CNT; index++) {
 		seq_printf(m ,"## %s ##\n", mdev->motors[index].pdata->name);
+		seq_printf(m ,"accel %u beats/s^2, jerk %u beats/s^3\n", mdev->motors[index].accel, mdev->motors[index].jerk);
 
 #ifdef CONFIG_SOC_T40
 		seq_printf(m ,"max steps %d\n", mdev->motors[index].max_steps);
@@ -1003,6 +1463,21 @@ static int motor_probe(struct platform_device *pdev)
 		}
 	}
 
+	/* out of range parameters fall back to the constant speed of old */
+	if (motor_ramp_valid(haccel, hjerk)) {
+		mdev->motors[HORIZONTAL_MOTOR].accel = haccel;
+		mdev->motors[HORIZONTAL_MOTOR].jerk = hjerk;
+	} else {
+		dev_err(&pdev->dev, "haccel(%u) hjerk(%u) out of range, ramp disabled\n", haccel, hjerk);
+	}
+	if (motor_ramp_valid(vaccel, vjerk)) {
+		mdev->motors[VERTICAL_MOTOR].accel = vaccel;
+		mdev->motors[VERTICAL_MOTOR].jerk = vjerk;
+	} else {
+		dev_err(&pdev->dev, "vaccel(%u) vjerk(%u) out of range, ramp disabled\n", vaccel, vjerk);
+	}
+	mdev->ramp.speed = mdev->tcu_speed;
+
 	mdev->motors[HORIZONTAL_MOTOR].max_steps = hmaxstep+100;
 	mdev->motors[VERTICAL_MOTOR].max_steps = vmaxstep+30;
 
@@ -1018,6 +1493,10 @@ static int motor_probe(struct platform_device *pdev)
 		goto error_get_irq;
 	}
 
+	INIT_KFIFO(mdev->events);
+	spin_lock_init(&mdev->event_lock);
+	init_waitqueue_head(&mdev->event_wait);
+
 	ret = request_irq(mdev->run_step_irq, jz_timer_interrupt, 0,
 				"jz_timer_interrupt", mdev);
 	if (ret) {
@@ -1048,6 +1527,11 @@ static int motor_probe(struct platform_device *pdev)
 	proc_create_data("motor_info", S_IRUGO, proc, &motor_info_fops, (void *)mdev);
 
 	motor_set_default(mdev);
+	for(i = 0; i < HAS_MOTOR_CNT; i++) {
+		motor_gpio_port_init(&mdev->motors[i]);
+		if (mdev->motors[i].gpio_port)
+			dev_info(&pdev->dev, "'%s' coils written as one gpio port\n", mdev->motors[i].pdata->name);
+	}
 	mdev->flag = 0;
 	//printk("%s%d\n",__func__,__LINE__);
 #ifdef CONFIG_SOC_T40
@@ -1121,6 +1605,9 @@ static int motor_remove(struct platform_device *pdev)
 
 		if (motor->pdata->motor_st4_gpio != -1)
 			gpio_free(motor->pdata->motor_st4_gpio);
+		if (motor->gpio_port)
+			iounmap(motor->gpio_port);
+		motor->gpio_port = NULL;
 		motor->pdata = 0;
 		motor->min_pos_irq = 0;
 		motor->max_pos_irq = 0;
@@ -1131,6 +1618,7 @@ static int motor_remove(struct platform_device *pdev)
 	if (mdev->proc)
 		proc_remove(mdev->proc);
 	misc_deregister(&mdev->misc_dev);
+	kfree(mdev->wp.points);
 
 	kfree(mdev);
 	return 0;
@@ -15,10 +15,13 @@
 #define __MOTOR_H__
 
 #include <linux/wait.h>
+#include <linux/kfifo.h>
 #include <linux/spinlock.h>
 #include <linux/seq_file.h>
 #include <linux/proc_fs.h>
 #include <jz_proc.h>
+
+#include "motor_path.h"
 /*
  *  HORIZONTAL is X axis and VERTICAL is Y axis;
  *  while the Zero point is left-bottom, Origin point
@@ -30,12 +33,6 @@
 /*#define PLATFORM_HAS_HORIZONTAL_MOTOR 	1*/
 /*#define PLATFORM_HAS_VERTICAL_MOTOR 	1*/
 
-enum jz_motor_cnt {
-	HORIZONTAL_MOTOR,
-	VERTICAL_MOTOR,
-	HAS_MOTOR_CNT,
-};
-
 /* ioctl cmd */
 #define MOTOR_STOP		0x1
 #define MOTOR_RESET		0x2
@@ -45,17 +42,42 @@ enum jz_motor_cnt {
 #define MOTOR_GOBACK	0x6
 #define MOTOR_CRUISE	0x7
 #define MOTOR_GET_MAXSTEPS 0x8
+#define MOTOR_SET_RAMP	0x9
+#define MOTOR_WAYPOINTS	0xa
 
 /* motor speed */
 #define MOTOR_MAX_SPEED	2000		/**< unit: beats per second */
 #define MOTOR_DEF_SPEED	900		/**< unit: beats per second */
 #define MOTOR_MIN_SPEED	1
+#define MOTOR_MAX_ACCEL	(MOTOR_MAX_SPEED * MOTOR_MAX_SPEED)	/**< unit: beats/s^2 */
+#define MOTOR_MAX_JERK	(MOTOR_MAX_ACCEL * 100)	/**< unit: beats/s^3 */
 
 enum motor_status {
 	MOTOR_IS_STOP,
 	MOTOR_IS_RUNNING,
 };
 
+/*
+ * read() on /dev/motor returns whole struct motor_event records, poll()
+ * reports POLLIN while some are pending. x/y are the positions reported
+ * by MOTOR_GET_STATUS, timestamp_ns is ktime_get() (CLOCK_MONOTONIC).
+ */
+enum motor_event_type {
+	MOTOR_EVENT_DONE = 1,	/* move, reset or stop finished */
+	MOTOR_EVENT_LIMIT,	/* axis was stopped at its min/max position */
+	MOTOR_EVENT_POS,	/* sample every pos_event_ms while moving */
+};
+
+struct motor_event {
+	unsigned int type;
+	unsigned int axis;	/* HORIZONTAL_MOTOR or VERTICAL_MOTOR for LIMIT */
+	int x;
+	int y;
+	unsigned long long timestamp_ns;
+};
+
+#define MOTOR_EVENT_CNT	32
+
 struct motor_message {
 	int x;
 	int y;
@@ -65,6 +87,35 @@ struct motor_message {
 	unsigned int y_max_steps;
 };
 
+/*
+ * Acceleration profile of MOTOR_MOVE and MOTOR_CRUISE. Moves start at
+ * start_speed and ramp up to the MOTOR_SPEED rate, accel is in
+ * beats/s^2 and 0 keeps the constant speed of old. A non zero jerk
+ * (beats/s^3) rounds the corners of the ramp into an S-curve. Values
+ * above MOTOR_MAX_ACCEL or MOTOR_MAX_JERK fail with -EINVAL.
+ */
+struct motor_ramp_data {
+	unsigned int x_accel;
+	unsigned int y_accel;
+	unsigned int x_jerk;
+	unsigned int y_jerk;
+	unsigned int start_speed;
+};
+
+/*
+ * MOTOR_WAYPOINTS: patrol through count absolute positions (as reported
+ * by MOTOR_GET_STATUS), waiting dwell_ms at each one. A non zero speed
+ * becomes the MOTOR_SPEED of that leg. With loop set the path repeats
+ * until MOTOR_STOP.
+ */
+#define MOTOR_MAX_WAYPOINTS	64
+
+struct motor_waypoints {
+	unsigned int count;
+	unsigned int loop;
+	struct motor_waypoint *points;
+};
+
 struct motors_steps{
 	int x;
 	int y;
@@ -116,6 +167,18 @@ struct motor_driver {
 	enum motor_ops_state state;
 	struct completion reset_completion;
 
+	/*
+	 * st1..st4 on one gpio port: the coils are written through the port
+	 * set/clear registers at gpio_port, gpio_pins[] are the port bits.
+	 */
+	void __iomem *gpio_port;
+	unsigned int gpio_pins[4];
+	unsigned int gpio_mask;
+
+	/* ramp used when this motor has the most steps to go */
+	unsigned int accel;
+	unsigned int jerk;
+
 	struct timer_list min_timer;
 	struct timer_list max_timer;
 	/* debug parameters */
@@ -128,6 +191,22 @@ struct motor_move {
 	short times;
 };
 
+enum motor_ramp_phase {
+	MOTOR_RAMP_ACCEL,
+	MOTOR_RAMP_CRUISE,
+	MOTOR_RAMP_DECEL,
+};
+
+/* step clock state, updated once per timer interrupt */
+struct motor_ramp {
+	unsigned int speed;		/* current beats per second */
+	unsigned int accel;		/* current acceleration */
+	unsigned int max_accel;		/* 0: constant speed */
+	unsigned int jerk;
+	unsigned int start_speed;
+	enum motor_ramp_phase phase;
+};
+
 struct motor_device {
 	struct platform_device *pdev;
 	const struct mfd_cell *cell;
@@ -144,6 +223,7 @@ struct motor_device {
 	struct jz_tcu_chn *tcu;
 #endif
 	int tcu_speed;
+	struct motor_ramp ramp;
 
 	struct mutex dev_mutex;
 	spinlock_t slock;
@@ -152,6 +232,14 @@ struct motor_device {
 	struct motor_message msg;
 	struct motor_move dst_move;
 	struct motor_move cur_move;
+	struct motor_line line;
+	struct motor_waypoint_queue wp;
+
+	/* oldest records are dropped when the reader falls behind */
+	DECLARE_KFIFO(events, struct motor_event, MOTOR_EVENT_CNT);
+	spinlock_t event_lock;
+	wait_queue_head_t event_wait;
+	ktime_t event_pos_time;
 
 	int run_step_irq;
 	int flag;
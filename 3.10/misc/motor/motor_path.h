@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2015 Ingenic Semiconductor Co.,Ltd
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Path arithmetic of the step interrupt: the line of coordinated moves
+ * and the leg/dwell sequencing of waypoint programs. Nothing here touches
+ * the hardware, motor_test/ runs the same code on the host.
+ */
+#ifndef __MOTOR_PATH_H__
+#define __MOTOR_PATH_H__
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#else
+#include <stdbool.h>
+#include <stdint.h>
+typedef uint64_t u64;
+#define div_u64(a, b)	((a) / (b))
+#define max(a, b)	((a) > (b) ? (a) : (b))
+#endif
+
+enum jz_motor_cnt {
+	HORIZONTAL_MOTOR,
+	VERTICAL_MOTOR,
+	HAS_MOTOR_CNT,
+};
+
+struct motor_waypoint {
+	int x;
+	int y;
+	int speed;
+	unsigned int dwell_ms;
+};
+
+/*
+ * Coordinated MOTOR_MOVE: every tick of the line each axis adds its
+ * beat count to err and takes a beat once err reaches ticks, so both
+ * axes run along a straight line and finish on the same tick.
+ */
+struct motor_line {
+	unsigned int ticks;
+	unsigned int n;
+	int err[HAS_MOTOR_CNT];
+};
+
+/* waypoint program, run from the timer interrupt */
+struct motor_waypoint_queue {
+	struct motor_waypoint *points;
+	unsigned int count;
+	unsigned int loop;
+	int cur;			/* leg being run, -1 before the first */
+	unsigned int dwell;		/* ticks left at the current waypoint */
+	bool arrived;			/* dwell of cur was loaded */
+};
+
+enum motor_wp_action {
+	MOTOR_WP_DONE,			/* program over, the motors stop */
+	MOTOR_WP_DWELL,			/* wait one tick at the waypoint */
+	MOTOR_WP_LEG,			/* start the leg to points[cur] */
+};
+
+/*
+ * (x, y) are the beat counts of the move, the vertical axis runs at most
+ * one beat per ratio ticks.
+ */
+static inline void motor_line_init(struct motor_line *line, int x, int y, unsigned int ratio)
+{
+	int index = 0;
+
+	line->ticks = max(x, y * (int)ratio);
+	line->n = 0;
+	/* start half way so the beats of the slower axis are centered */
+	for (index = 0; index < HAS_MOTOR_CNT; index++)
+		line->err[index] = line->ticks >> 1;
+}
+
+/* one tick of axis index with dst beats to go in all, 1 when it takes a beat */
+static inline int motor_line_beat(struct motor_line *line, int index, int dst)
+{
+	line->err[index] += dst;
+	if (line->err[index] < (int)line->ticks)
+		return 0;
+	line->err[index] -= line->ticks;
+	return 1;
+}
+
+/*
+ * Called once both motors stopped, speed is the beat rate the clock keeps
+ * running at. The dwell at a waypoint is counted in ticks of that clock.
+ */
+static inline enum motor_wp_action motor_waypoint_step(struct motor_waypoint_queue *wp, unsigned int speed)
+{
+	if(!wp->count)
+		return MOTOR_WP_DONE;
+
+	if(!wp->arrived){
+		wp->arrived = true;
+		if(wp->cur >= 0)
+			wp->dwell = div_u64((u64)wp->points[wp->cur].dwell_ms * speed, 1000);
+	}
+	if(wp->dwell){
+		wp->dwell--;
+		return MOTOR_WP_DWELL;
+	}
+
+	if(++wp->cur >= wp->count){
+		if(!wp->loop){
+			wp->count = 0;
+			return MOTOR_WP_DONE;
+		}
+		wp->cur = 0;
+	}
+	/* a waypoint already reached only waits its dwell time */
+	wp->arrived = false;
+	return MOTOR_WP_LEG;
+}
+
+#endif /* __MOTOR_PATH_H__ */
@@ -0,0 +1,265 @@
+/*
+ * Host side step simulator for the motor driver.
+ *
+ * Runs waypoint programs through motor_path.h the way jz_timer_interrupt
+ * does, one call per tick, and checks every path: each leg lands on its
+ * waypoint with exactly |dx| and |dy| beats, both axes stay within half a
+ * beat of the straight line on every tick, and the dwell, loop and end of
+ * program behave as MOTOR_WAYPOINTS documents.
+ *
+ * make && ./motor_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../motor_path.h"
+
+#define MAX_STEPS	4000
+
+struct sim {
+	struct motor_line line;
+	struct motor_waypoint_queue wp;
+	unsigned int ratio;		/* hmotor2vmotor */
+	unsigned int speed;		/* beats per second of the step clock */
+	int pos[HAS_MOTOR_CNT];
+	int dir[HAS_MOTOR_CNT];
+	int dst[HAS_MOTOR_CNT];
+	int cur[HAS_MOTOR_CNT];
+	int moving;
+	unsigned long ticks;
+	unsigned long dwell_ticks;
+	unsigned int legs;
+	unsigned int arrivals;
+};
+
+static int failures;
+
+#define CHECK(cond, ...) do {						\
+	if (!(cond)) {							\
+		printf("FAIL %s:%d: ", __func__, __LINE__);		\
+		printf(__VA_ARGS__);					\
+		printf("\n");						\
+		failures++;						\
+	}								\
+} while (0)
+
+/* __motor_move_start, without the limit switches */
+static int sim_move_start(struct sim *s, int x, int y)
+{
+	int d[HAS_MOTOR_CNT] = { x, y };
+	int index = 0;
+
+	for (index = 0; index < HAS_MOTOR_CNT; index++) {
+		s->dir[index] = d[index] > 0 ? 1 : -1;
+		s->dst[index] = abs(d[index]);
+		s->cur[index] = 0;
+	}
+	if (s->dst[HORIZONTAL_MOTOR] + s->dst[VERTICAL_MOTOR] == 0)
+		return 0;
+
+	motor_line_init(&s->line, s->dst[HORIZONTAL_MOTOR], s->dst[VERTICAL_MOTOR], s->ratio);
+	s->moving = 1;
+	s->legs++;
+	return 1;
+}
+
+/* a beat is never more than half a beat off the line from the start of the leg */
+static void sim_check_line(struct sim *s)
+{
+	int index = 0;
+	long long off = 0;
+
+	for (index = 0; index < HAS_MOTOR_CNT; index++) {
+		off = 2 * ((long long)s->cur[index] * s->line.ticks - (long long)s->line.n * s->dst[index]);
+		CHECK(llabs(off) <= s->line.ticks,
+		      "axis %d off the line: %d of %d beats after %u of %u ticks",
+		      index, s->cur[index], s->dst[index], s->line.n, s->line.ticks);
+	}
+}
+
+/* one timer interrupt, returns 0 once the program is over */
+static int sim_tick(struct sim *s)
+{
+	struct motor_waypoint *point = NULL;
+	int index = 0;
+
+	s->ticks++;
+	if (!s->moving) {
+		switch (motor_waypoint_step(&s->wp, s->speed)) {
+		case MOTOR_WP_DONE:
+			return 0;
+		case MOTOR_WP_DWELL:
+			s->dwell_ticks++;
+			return 1;
+		default:
+			break;
+		}
+		point = &s->wp.points[s->wp.cur];
+		if (point->speed > 0)
+			s->speed = point->speed;
+		if (!sim_move_start(s, point->x - s->pos[HORIZONTAL_MOTOR], point->y - s->pos[VERTICAL_MOTOR]))
+			s->arrivals++;
+		return 1;
+	}
+
+	s->line.n++;
+	for (index = 0; index < HAS_MOTOR_CNT; index++) {
+		if (!motor_line_beat(&s->line, index, s->dst[index]))
+			continue;
+		CHECK(s->cur[index] < s->dst[index], "axis %d beat past its %d beats", index, s->dst[index]);
+		if (s->cur[index] < s->dst[index]) {
+			s->cur[index]++;
+			s->pos[index] += s->dir[index];
+		}
+	}
+	sim_check_line(s);
+
+	if (s->line.n >= s->line.ticks) {
+		for (index = 0; index < HAS_MOTOR_CNT; index++)
+			CHECK(s->cur[index] == s->dst[index], "axis %d did %d of %d beats",
+			      index, s->cur[index], s->dst[index]);
+		point = &s->wp.points[s->wp.cur];
+		CHECK(s->pos[HORIZONTAL_MOTOR] == point->x && s->pos[VERTICAL_MOTOR] == point->y,
+		      "leg %d ended at (%d, %d) instead of (%d, %d)", s->wp.cur,
+		      s->pos[HORIZONTAL_MOTOR], s->pos[VERTICAL_MOTOR], point->x, point->y);
+		s->moving = 0;
+		s->arrivals++;
+	}
+	return 1;
+}
+
+static void sim_init(struct sim *s, struct motor_waypoint *points, unsigned int count,
+		     unsigned int loop, unsigned int ratio, int x, int y)
+{
+	memset(s, 0, sizeof(*s));
+	s->wp.points = points;
+	s->wp.count = count;
+	s->wp.loop = loop;
+	s->wp.cur = -1;
+	s->wp.arrived = true;
+	s->ratio = ratio;
+	s->speed = 900;
+	s->pos[HORIZONTAL_MOTOR] = x;
+	s->pos[VERTICAL_MOTOR] = y;
+}
+
+static void sim_run(struct sim *s, unsigned long max_ticks)
+{
+	while (s->ticks < max_ticks && sim_tick(s))
+		;
+}
+
+/* every pair of end points on a grid, for each speed ratio */
+static void test_lines(void)
+{
+	static struct motor_waypoint point;
+	static const int coords[] = { -1500, -317, -64, -7, -1, 0, 1, 2, 3, 10, 99, 256, 1023 };
+	unsigned int ratio = 0, i = 0, j = 0;
+	struct sim s;
+	int n = sizeof(coords) / sizeof(coords[0]);
+
+	for (ratio = 1; ratio <= 3; ratio++) {
+		for (i = 0; i < n; i++) {
+			for (j = 0; j < n; j++) {
+				point.x = 2000 + coords[i];
+				point.y = 2000 + coords[j];
+				sim_init(&s, &point, 1, 0, ratio, 2000, 2000);
+				sim_run(&s, 1000000);
+				CHECK(s.wp.count == 0, "program (%d, %d) ratio %u never ended",
+				      coords[i], coords[j], ratio);
+				CHECK(s.legs == (coords[i] || coords[j]), "(%d, %d) ran %u legs",
+				      coords[i], coords[j], s.legs);
+				CHECK(s.ticks == (unsigned long)max(abs(coords[i]), abs(coords[j]) * (int)ratio) + 2,
+				      "(%d, %d) ratio %u took %lu ticks", coords[i], coords[j], ratio, s.ticks);
+			}
+		}
+	}
+}
+
+/* dwell_ms at the speed the clock runs at, none after the last point of a program */
+static void test_dwell(void)
+{
+	struct motor_waypoint points[] = {
+		{ 100, 50, 0, 20 },
+		{ 100, 50, 500, 10 },	/* already there, only waits */
+		{ 0, 0, 0, 0 },
+	};
+	struct sim s;
+
+	sim_init(&s, points, 3, 0, 1, 0, 0);
+	sim_run(&s, 1000000);
+	CHECK(s.wp.count == 0, "program never ended");
+	CHECK(s.legs == 2, "ran %u legs, expected 2", s.legs);
+	CHECK(s.arrivals == 3, "reached %u waypoints, expected 3", s.arrivals);
+	/* 20 ms at 900 beats/s, then 10 ms at the 500 beats/s of the second point */
+	CHECK(s.dwell_ticks == 18 + 5, "dwelt %lu ticks, expected 23", s.dwell_ticks);
+	CHECK(s.pos[HORIZONTAL_MOTOR] == 0 && s.pos[VERTICAL_MOTOR] == 0, "ended at (%d, %d)",
+	      s.pos[HORIZONTAL_MOTOR], s.pos[VERTICAL_MOTOR]);
+}
+
+/* a looping program keeps cycling through the same positions */
+static void test_loop(void)
+{
+	struct motor_waypoint points[] = {
+		{ 300, 0, 0, 0 },
+		{ 300, 120, 0, 5 },
+		{ 0, 120, 0, 0 },
+		{ 0, 0, 0, 5 },
+	};
+	struct sim s;
+	unsigned int round = 0;
+
+	sim_init(&s, points, 4, 1, 2, 0, 0);
+	for (round = 0; round < 5; round++) {
+		while (s.ticks < 10000000 && sim_tick(&s) &&
+		       !(s.wp.cur == 3 && !s.moving && s.wp.arrived && !s.wp.dwell))
+			;
+		CHECK(s.wp.count == 4, "loop ended in round %u", round);
+		CHECK(s.pos[HORIZONTAL_MOTOR] == 0 && s.pos[VERTICAL_MOTOR] == 0,
+		      "round %u ended at (%d, %d)", round, s.pos[HORIZONTAL_MOTOR], s.pos[VERTICAL_MOTOR]);
+		CHECK(s.legs == 4 * (round + 1), "round %u ran %u legs", round, s.legs);
+		sim_tick(&s);
+	}
+}
+
+/* random programs, positions stay on the grid and every leg ends on its point */
+static void test_random(void)
+{
+	struct motor_waypoint points[16];
+	struct sim s;
+	unsigned int run = 0, i = 0, count = 0;
+
+	srand(4041);
+	for (run = 0; run < 500; run++) {
+		count = 1 + rand() % 16;
+		for (i = 0; i < count; i++) {
+			points[i].x = rand() % MAX_STEPS;
+			points[i].y = rand() % (MAX_STEPS / 4);
+			points[i].speed = rand() % 3 ? 0 : 100 + rand() % 1900;
+			points[i].dwell_ms = rand() % 4 ? 0 : rand() % 50;
+		}
+		sim_init(&s, points, count, 0, 1 + rand() % 3, rand() % MAX_STEPS, rand() % (MAX_STEPS / 4));
+		sim_run(&s, 100000000);
+		CHECK(s.wp.count == 0, "run %u never ended", run);
+		CHECK(s.arrivals == count, "run %u reached %u of %u waypoints", run, s.arrivals, count);
+		CHECK(s.pos[HORIZONTAL_MOTOR] == points[count - 1].x && s.pos[VERTICAL_MOTOR] == points[count - 1].y,
+		      "run %u ended off its last point", run);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	test_lines();
+	test_dwell();
+	test_loop();
+	test_random();
+
+	if (failures) {
+		printf("%d check(s) failed\n", failures);
+		return 1;
+	}
+	printf("motor path: all checks passed\n");
+	return 0;
+}
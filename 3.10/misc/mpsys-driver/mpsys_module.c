@@ -2,6 +2,7 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/miscdevice.h>
+#include "include/private-funcs.h"
 
 #ifdef CONFIG_SOC_T41
     #define MPSYS_BORD "T41"
@@ -24,6 +25,7 @@ static int __init mpsys_init(void)
 
 	printk("@@@@ multi-process system init sucess (Board: %s, Version: %s) @@@\n", MPSYS_BORD, MPSYS_VERSION);
 
+	private_funcs_stats_init();
 	ret = mpsys_utils_init();
 	if (ret)
 	{
@@ -43,6 +45,7 @@ static int __init mpsys_init(void)
 err_data_init:
     mpsys_utils_exit();
 err_utils_init:
+	private_funcs_stats_exit();
 	return ret;
 }
 
@@ -52,6 +55,7 @@ static void __exit mpsys_exit(void)
 
 	mpsys_utils_exit();
 	mpsys_data_exit();
+	private_funcs_stats_exit();
 }
 
 module_init(mpsys_init);
@@ -23,6 +23,7 @@
 #include <linux/gpio.h>
 #include <linux/time.h>
 #include <linux/sched.h>
+#include <linux/poll.h>
 #include <linux/delay.h>
 #include <linux/module.h>
 #include <linux/debugfs.h>
@@ -71,6 +72,71 @@ static unsigned int vdir = 0;
 module_param(vdir, int, S_IRUGO);
 MODULE_PARM_DESC(hdir, "The down is forward when vdir is 0; The down is opposite when vdir is 1");
 
+static unsigned int pos_event_ms = 0;
+module_param(pos_event_ms, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(pos_event_ms, "Period of the MOTOR_EVENT_POS records while moving, 0 disables them");
+
+/* may be called from the timer interrupt and its thread */
+static void motor_event(struct motor_device *mdev, unsigned int type, unsigned int axis)
+{
+	struct motor_event ev;
+	unsigned long flags;
+
+	ev.type = type;
+	ev.axis = axis;
+	ev.x = mdev->motors[HORIZONTAL_MOTOR].cur_position;
+	ev.y = mdev->motors[VERTICAL_MOTOR].cur_position;
+	ev.timestamp_ns = ktime_to_ns(ktime_get());
+
+	spin_lock_irqsave(&mdev->event_lock, flags);
+	if (kfifo_is_full(&mdev->events))
+		kfifo_skip(&mdev->events);
+	kfifo_in(&mdev->events, &ev, 1);
+	spin_unlock_irqrestore(&mdev->event_lock, flags);
+	wake_up_interruptible(&mdev->event_wait);
+}
+
+static void motor_event_pos(struct motor_device *mdev)
+{
+	ktime_t now;
+
+	if (!pos_event_ms)
+		return;
+	now = ktime_get();
+	if (ktime_to_ms(ktime_sub(now, mdev->event_pos_time)) < pos_event_ms)
+		return;
+	mdev->event_pos_time = now;
+	motor_event(mdev, MOTOR_EVENT_POS, 0);
+}
+
+/* high torque at low speed, less current when cruising */
+static const struct ms419xx_profile ms419xx_profiles[] = {
+	/* max_speed		duty	intct	ctrl */
+	{ 300,			0xc8c8,	0x01aa,	MS419XX_FORWARD },
+	{ 500,			0xa0a0,	0x0100,	MS419XX_FORWARD },
+	{ MOTOR_MAX_SPEED,	0x8080,	0x008e,	MS419XX_FORWARD },
+};
+
+static const struct ms419xx_profile *ms419xx_profile_get(int speed)
+{
+	int i;
+
+	for(i = 0; i < ARRAY_SIZE(ms419xx_profiles) - 1; i++)
+		if(speed <= ms419xx_profiles[i].max_speed)
+			break;
+	return &ms419xx_profiles[i];
+}
+
+static void ms419xx_set_period(struct motor_device *mdev, int speed)
+{
+#ifdef CONFIG_SOC_T40
+	ingenic_tcu_set_period(mdev->tcu->cib.id,(24000000 / 64 / speed));
+#else
+	jz_tcu_set_period(mdev->tcu, (24000000 / 64 / speed));
+#endif
+	mdev->tcu_speed_cur = speed;
+}
+
 static irqreturn_t jz_timer_interrupt(int irq, void *dev_id)
 {
 	struct motor_device *mdev = dev_id;
@@ -100,7 +166,11 @@ static irqreturn_t jz_timer_interrupt(int irq, void *dev_id)
 		/* operate register */
 		if(mdev->reg_state == REGISTER_SYNC){
 			mdev->reg_state = REGISTER_UPDATE;
+			mdev->profile = mdev->profile_prebuild;
 		}
+		/* the step rate changes together with the coil profile it was chosen for */
+		if(mdev->profile == mdev->profile_prebuild && mdev->tcu_speed_cur != mdev->tcu_speed)
+			ms419xx_set_period(mdev, mdev->tcu_speed);
 		for(i = 0; i < HAS_MOTOR_CNT; i++){
 			if(mdev->reg_state == REGISTER_UPDATE){
 				motors[i].move_dir = motors[i].move_dir_prebuild;
@@ -133,10 +203,12 @@ static irqreturn_t jz_timer_interrupt(int irq, void *dev_id)
 					motors[i].move_dir_prebuild = MOTOR_MOVE_STOP;
 					motors[i].cur_position = 0;
 					mdev->reg_state = REGISTER_CHANGE;
+					motor_event(mdev, MOTOR_EVENT_LIMIT, i);
 				} else if(motors[i].cur_position >= motors[i].max_position){
 					motors[i].move_dir_prebuild = MOTOR_MOVE_STOP;
 					motors[i].cur_position = motors[i].max_position;
 					mdev->reg_state = REGISTER_CHANGE;
+					motor_event(mdev, MOTOR_EVENT_LIMIT, i);
 				} else {
 					if(motors[i].cur_steps == motors[i].dst_steps){
 						motors[i].move_dir_prebuild = MOTOR_MOVE_STOP;
@@ -145,6 +217,7 @@ static irqreturn_t jz_timer_interrupt(int irq, void *dev_id)
 				}
 			}
 		}
+		motor_event_pos(mdev);
 	}
 
 	switch(mdev->reg_state){
@@ -167,7 +240,7 @@ static irqreturn_t jz_timer_interrupt(int irq, void *dev_id)
 	return ret;
 }
 
-static int direction_to_motor(unsigned int motor, int direction)
+static int direction_to_motor(unsigned int motor, int direction, const struct ms419xx_profile *profile)
 {
 	int dir = 0;
 
@@ -177,55 +250,76 @@ static int direction_to_motor(unsigned int motor, int direction)
 	if(motor == HORIZONTAL_MOTOR){
 		if(hdir == MOTOR_LEFT_FORWARD){
 			if(direction == MOTOR_MOVE_LEFT_DOWN)
-				dir = MS419XX_FORWARD;
+				dir = profile->ctrl;
 			else
-				dir = MS419XX_REVERSE;
+				dir = profile->ctrl | MS419XX_CCWCW;
 		}else{
 			/* hdir == MOTOR_LEFT_REVERSE */
 			if(direction == MOTOR_MOVE_LEFT_DOWN)
-				dir = MS419XX_REVERSE;
+				dir = profile->ctrl | MS419XX_CCWCW;
 			else
-				dir = MS419XX_FORWARD;
+				dir = profile->ctrl;
 		}
 	}else{
 		if(vdir == MOTOR_DOWN_FORWARD){
 			if(direction == MOTOR_MOVE_LEFT_DOWN)
-				dir = MS419XX_FORWARD;
+				dir = profile->ctrl;
 			else
-				dir = MS419XX_REVERSE;
+				dir = profile->ctrl | MS419XX_CCWCW;
 		}else{
 			/* vdir == MOTOR_DOWN_REVERSE */
 			if(direction == MOTOR_MOVE_LEFT_DOWN)
-				dir = MS419XX_REVERSE;
+				dir = profile->ctrl | MS419XX_CCWCW;
 			else
-				dir = MS419XX_FORWARD;
+				dir = profile->ctrl;
 		}
 	}
 	return dir;
 }
 
 
-static irqreturn_t jz_timer_thread_handle(int this_irq, void *dev_id)
+/* the new directions are in the chip, resume VDFZ */
+static void motor_reg_batch_done(void *context, int status)
 {
 	unsigned long flags;
+	struct motor_device *mdev = context;
+
+	spin_lock_irqsave(&mdev->slock, flags);
+	mdev->reg_state = REGISTER_SYNC;
+	mdev->vdfz_valid = 1;
+	spin_unlock_irqrestore(&mdev->slock, flags);
+}
+
+static irqreturn_t jz_timer_thread_handle(int this_irq, void *dev_id)
+{
 	struct motor_device *mdev = dev_id;
 	struct motor_driver *motors = mdev->motors;
+	struct jz_spidev_batch *batch = &mdev->reg_batch;
+	const struct ms419xx_profile *profile = NULL;
 	int value = MS419XX_STOP;
 
 	if(mdev->reg_state == REGISTER_CHANGE){
-		if(motors[HORIZONTAL_MOTOR].move_dir != motors[HORIZONTAL_MOTOR].move_dir_prebuild){
-			value = direction_to_motor(HORIZONTAL_MOTOR, motors[HORIZONTAL_MOTOR].move_dir_prebuild);
-			jz_spidev_write(0x24, 1, value, 2);
+		/* the timer keeps waking us until the batch in flight completes */
+		if(batch->busy)
+			return IRQ_HANDLED;
+		profile = mdev->profile_prebuild;
+		if(profile != mdev->profile){
+			jz_spidev_batch_add(batch, 0x23, profile->duty);
+			jz_spidev_batch_add(batch, 0x28, profile->duty);
+			jz_spidev_batch_add(batch, 0x25, profile->intct);
+			jz_spidev_batch_add(batch, 0x2a, profile->intct);
+		}
+		if(profile != mdev->profile || motors[HORIZONTAL_MOTOR].move_dir != motors[HORIZONTAL_MOTOR].move_dir_prebuild){
+			value = direction_to_motor(HORIZONTAL_MOTOR, motors[HORIZONTAL_MOTOR].move_dir_prebuild, profile);
+			jz_spidev_batch_add(batch, 0x24, value);
 		}
-		if(motors[VERTICAL_MOTOR].move_dir != motors[VERTICAL_MOTOR].move_dir_prebuild){
-			value = direction_to_motor(VERTICAL_MOTOR, motors[VERTICAL_MOTOR].move_dir_prebuild);
-			jz_spidev_write(0x29, 1, value, 2);
+		if(profile != mdev->profile || motors[VERTICAL_MOTOR].move_dir != motors[VERTICAL_MOTOR].move_dir_prebuild){
+			value = direction_to_motor(VERTICAL_MOTOR, motors[VERTICAL_MOTOR].move_dir_prebuild, profile);
+			jz_spidev_batch_add(batch, 0x29, value);
 		}
 
-		spin_lock_irqsave(&mdev->slock, flags);
-		mdev->reg_state = REGISTER_SYNC;
-		mdev->vdfz_valid = 1;
-		spin_unlock_irqrestore(&mdev->slock, flags);
+		if(!batch->count || jz_spidev_batch_async(batch, motor_reg_batch_done, mdev))
+			motor_reg_batch_done(mdev, 0);
 	}else{
 		if(motors[HORIZONTAL_MOTOR].move_dir == MOTOR_MOVE_STOP && motors[VERTICAL_MOTOR].move_dir == MOTOR_MOVE_STOP){
 			#ifdef CONFIG_SOC_T40
@@ -233,6 +327,7 @@ static irqreturn_t jz_timer_thread_handle(int this_irq, void *dev_id)
 			#else
 			jz_tcu_disable_counter(mdev->tcu);
 			#endif
+			motor_event(mdev, MOTOR_EVENT_DONE, 0);
 			if(mdev->wait_stop){
 				mdev->wait_stop = 0;
 				complete(&mdev->stop_completion);
@@ -406,6 +501,8 @@ static long motor_ops_reset(struct motor_device *mdev, struct motor_reset_data *
 	long ret = 0;
 	int times = 0;
 	struct motor_message msg;
+	struct jz_spidev_batch batch;
+	const struct ms419xx_profile *profile = NULL;
 	printk("%s%d\n",__func__,__LINE__);
 
 	if(mdev == NULL || rdata == NULL){
@@ -413,14 +510,23 @@ static long motor_ops_reset(struct motor_device *mdev, struct motor_reset_data *
 		return -EPERM;
 	}
 
-	jz_spidev_write(0x20, 1, 0x1e01, 2);
-	jz_spidev_write(0x22, 1, 0x0001, 2);
-	jz_spidev_write(0x27, 1, 0x0001, 2); //
-	jz_spidev_write(0x23, 1, 0xa0a0, 2); // AB PWM duty
-	jz_spidev_write(0x28, 1, 0xa0a0, 2); // CD PWM duty
+	mutex_lock(&mdev->dev_mutex);
+	spin_lock_irqsave(&mdev->slock, flags);
+	profile = mdev->profile_prebuild;
+	mdev->profile = profile;
+	spin_unlock_irqrestore(&mdev->slock, flags);
+	mutex_unlock(&mdev->dev_mutex);
+
+	jz_spidev_batch_init(&batch);
+	jz_spidev_batch_add(&batch, 0x20, 0x1e01);
+	jz_spidev_batch_add(&batch, 0x22, 0x0001);
+	jz_spidev_batch_add(&batch, 0x27, 0x0001); //
+	jz_spidev_batch_add(&batch, 0x23, profile->duty); // AB PWM duty
+	jz_spidev_batch_add(&batch, 0x28, profile->duty); // CD PWM duty
 
-	jz_spidev_write(0x25, 1, 0x0100, 2); // INTCTAB, when frequenc division is 64, the time is 4.1ms pre angle.
-	jz_spidev_write(0x2a, 1, 0x0100, 2); // INTCTCD,
+	jz_spidev_batch_add(&batch, 0x25, profile->intct); // INTCTAB, when frequenc division is 64, the time is 4.1ms pre angle.
+	jz_spidev_batch_add(&batch, 0x2a, profile->intct); // INTCTCD,
+	jz_spidev_batch_sync(&batch);
 
 	if(motor_ops_reset_check_params(rdata) == 0){
 		/* app set max steps and current pos */
@@ -477,18 +583,29 @@ exit:
 
 static int motor_speed(struct motor_device *mdev, int speed)
 {
-	return 0;
+	unsigned long flags;
+	const struct ms419xx_profile *profile = NULL;
+
 	if ((speed < MOTOR_MIN_SPEED) || (speed > MOTOR_MAX_SPEED)) {
 		dev_err(mdev->dev, "speed(%d) set error\n", speed);
 		return -1;
 	}
 
+	profile = ms419xx_profile_get(speed);
+	mutex_lock(&mdev->dev_mutex);
+	spin_lock_irqsave(&mdev->slock, flags);
 	mdev->tcu_speed = speed;
-#ifdef CONFIG_SOC_T40
-	ingenic_tcu_set_prescale(mdev->tcu->cib.id,TCU_PRESCALE_64);
-#else
-	jz_tcu_set_period(mdev->tcu, (24000000 / 64 / mdev->tcu_speed));
-#endif
+	/*
+	 * the registers are swapped by the irq thread before the next VDFZ
+	 * edge, the timer interrupt moves the step clock to the new speed on
+	 * that edge
+	 */
+	if (profile != mdev->profile_prebuild) {
+		mdev->profile_prebuild = profile;
+		mdev->reg_state = REGISTER_CHANGE;
+	}
+	spin_unlock_irqrestore(&mdev->slock, flags);
+	mutex_unlock(&mdev->dev_mutex);
 	return 0;
 }
 
@@ -496,12 +613,16 @@ static int motor_open(struct inode *inode, struct file *file)
 {
 	struct miscdevice *dev = file->private_data;
 	struct motor_device *mdev = container_of(dev, struct motor_device, misc_dev);
+	unsigned long flags;
 	int ret = 0;
 	if(mdev->flag){
 		ret = -EBUSY;
 		dev_err(mdev->dev, "Motor driver busy now!\n");
 	}else{
 		mdev->flag = 1;
+		spin_lock_irqsave(&mdev->event_lock, flags);
+		kfifo_reset(&mdev->events);
+		spin_unlock_irqrestore(&mdev->event_lock, flags);
 	}
 
 	return ret;
@@ -612,9 +733,57 @@ static long motor_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	return ret;
 }
 
+static ssize_t motor_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+	struct miscdevice *dev = file->private_data;
+	struct motor_device *mdev = container_of(dev, struct motor_device, misc_dev);
+	struct motor_event ev;
+	unsigned long flags;
+	size_t done = 0;
+	int ret = 0;
+
+	if (count < sizeof(ev))
+		return -EINVAL;
+
+	while (!done) {
+		if (kfifo_is_empty(&mdev->events)) {
+			if (file->f_flags & O_NONBLOCK)
+				return -EAGAIN;
+			ret = wait_event_interruptible(mdev->event_wait, !kfifo_is_empty(&mdev->events));
+			if (ret)
+				return ret;
+		}
+		while (done + sizeof(ev) <= count) {
+			spin_lock_irqsave(&mdev->event_lock, flags);
+			ret = kfifo_out(&mdev->events, &ev, 1);
+			spin_unlock_irqrestore(&mdev->event_lock, flags);
+			if (!ret)
+				break;
+			if (copy_to_user(buf + done, &ev, sizeof(ev)))
+				return done ? done : -EFAULT;
+			done += sizeof(ev);
+		}
+	}
+
+	return done;
+}
+
+static unsigned int motor_poll(struct file *file, poll_table *wait)
+{
+	struct miscdevice *dev = file->private_data;
+	struct motor_device *mdev = container_of(dev, struct motor_device, misc_dev);
+
+	poll_wait(file, &mdev->event_wait, wait);
+	if (!kfifo_is_empty(&mdev->events))
+		return POLLIN | POLLRDNORM;
+	return 0;
+}
+
 static struct file_operations motor_fops = {
 	.open = motor_open,
 	.release = motor_release,
+	.read = motor_read,
+	.poll = motor_poll,
 	.unlocked_ioctl = motor_ioctl,
 };
 
@@ -633,6 +802,8 @@ static int motor_info_show(struct seq_file *m, void *v)
 	seq_printf(m ,"The status of motor is %s\n", msg.status?"running":"stop");
 	seq_printf(m ,"The pos of motor is (%d, %d)\n", msg.x, msg.y);
 	seq_printf(m ,"The speed of motor is %d\n", msg.speed);
+	seq_printf(m ,"Current profile: duty 0x%04x intct 0x%04x ctrl 0x%04x\n",
+			mdev->profile->duty, mdev->profile->intct, mdev->profile->ctrl);
 
 	for(index = 0; index < HAS_MOTOR_CNT; index++){
 		seq_printf(m ,"## motor is %s ##\n", mdev->motors[index].pdata->name);
@@ -651,6 +822,8 @@ static int motor_info_show(struct seq_file *m, void *v)
 	len += seq_printf(m ,"The status of motor is %s\n", msg.status?"running":"stop");
 	len += seq_printf(m ,"The pos of motor is (%d, %d)\n", msg.x, msg.y);
 	len += seq_printf(m ,"The speed of motor is %d\n", msg.speed);
+	len += seq_printf(m ,"Current profile: duty 0x%04x intct 0x%04x ctrl 0x%04x\n",
+			mdev->profile->duty, mdev->profile->intct, mdev->profile->ctrl);
 
 	for(index = 0; index < HAS_MOTOR_CNT; index++){
 		len += seq_printf(m ,"## motor is %s ##\n", mdev->motors[index].pdata->name);
@@ -720,6 +893,9 @@ static int motor_probe(struct platform_device *pdev)
 	mdev->tcu->irq_type = FULL_IRQ_MODE;
 	mdev->tcu->clk_src = TCU_CLKSRC_EXT;
 	mdev->tcu_speed = 500;
+	mdev->tcu_speed_cur = mdev->tcu_speed;
+	mdev->profile = ms419xx_profile_get(mdev->tcu_speed);
+	mdev->profile_prebuild = mdev->profile;
 #ifdef CONFIG_SOC_T40
 	mdev->tcu->is_pwm = 0;
 	mdev->tcu->cib.func = TRACKBALL_FUNC;
@@ -751,6 +927,11 @@ static int motor_probe(struct platform_device *pdev)
 		dev_err(&pdev->dev, "Failed to get platform irq: %d\n", ret);
 		goto error_get_irq;
 	}
+	jz_spidev_batch_init(&mdev->reg_batch);
+	INIT_KFIFO(mdev->events);
+	spin_lock_init(&mdev->event_lock);
+	init_waitqueue_head(&mdev->event_wait);
+
 	ret = request_threaded_irq(mdev->run_step_irq, jz_timer_interrupt, jz_timer_thread_handle, IRQF_ONESHOT, "jz_motor", mdev);
 	if (ret) {
 		dev_err(&pdev->dev, "Failed to run request_irq() !\n");
@@ -812,6 +993,7 @@ static int motor_remove(struct platform_device *pdev)
 	mutex_destroy(&mdev->dev_mutex);
 
 	free_irq(mdev->run_step_irq, mdev);
+	jz_spidev_batch_wait(&mdev->reg_batch);
 
 	if (mdev->proc)
 		proc_remove(mdev->proc);
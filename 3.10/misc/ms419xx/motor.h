@@ -15,10 +15,12 @@
 #define __MOTOR_H__
 
 #include <linux/wait.h>
+#include <linux/kfifo.h>
 #include <linux/spinlock.h>
 #include <linux/seq_file.h>
 #include <linux/proc_fs.h>
 #include <jz_proc.h>
+#include "ms419xx_spi_dev.h"
 /*
  *  HORIZONTAL is X axis and VERTICAL is Y axis;
  *  while the Zero point is left-bottom, Origin point
@@ -62,6 +64,22 @@ enum jz_motor_cnt {
 #define MS419XX_STOP 0x3000
 #define MS419XX_FORWARD 0x3408
 #define MS419XX_REVERSE 0x3508
+#define MS419XX_CCWCW 0x0100
+
+/*
+ * Register values used up to max_speed (MOTOR_SPEED). duty goes to the
+ * PWM duty registers 0x23/0x28 (coil current), intct to the step cycle
+ * registers 0x25/0x2a and ctrl to the direction registers 0x24/0x29 as
+ * the forward word (MICRO/ENDIS/PSUM), reverse also sets MS419XX_CCWCW.
+ * Every entry must move the same distance per VDFZ period, positions are
+ * counted in VDFZ periods.
+ */
+struct ms419xx_profile {
+	int max_speed;
+	unsigned short duty;
+	unsigned short intct;
+	unsigned short ctrl;
+};
 
 enum register_state {
 	REGISTER_NOCHANGE,
@@ -75,6 +93,27 @@ enum motor_status {
 	MOTOR_IS_RUNNING,
 };
 
+/*
+ * read() on /dev/motor returns whole struct motor_event records, poll()
+ * reports POLLIN while some are pending. x/y are the absolute positions
+ * (0 .. max steps), timestamp_ns is ktime_get() (CLOCK_MONOTONIC).
+ */
+enum motor_event_type {
+	MOTOR_EVENT_DONE = 1,	/* both motors stopped */
+	MOTOR_EVENT_LIMIT,	/* axis was stopped at its min/max position */
+	MOTOR_EVENT_POS,	/* sample every pos_event_ms while moving */
+};
+
+struct motor_event {
+	unsigned int type;
+	unsigned int axis;	/* HORIZONTAL_MOTOR or VERTICAL_MOTOR for LIMIT */
+	int x;
+	int y;
+	unsigned long long timestamp_ns;
+};
+
+#define MOTOR_EVENT_CNT	32
+
 struct motor_message {
 	int x;
 	int y;
@@ -157,6 +196,7 @@ struct motor_device {
 	struct jz_tcu_chn *tcu;
 #endif
 	int tcu_speed;
+	int tcu_speed_cur;		/* rate the step clock runs at */
 
 	struct mutex dev_mutex;
 	spinlock_t slock;
@@ -178,6 +218,17 @@ struct motor_device {
 	unsigned int vdfz_valid;
 	unsigned int vdfz_state; // high or low
 	unsigned int rtimer_cnt;
+	/* direction registers of both motors, written from the irq thread */
+	struct jz_spidev_batch reg_batch;
+	/* profile in the chip and the one to switch to at the next VDFZ edge */
+	const struct ms419xx_profile *profile;
+	const struct ms419xx_profile *profile_prebuild;
+
+	/* oldest records are dropped when the reader falls behind */
+	DECLARE_KFIFO(events, struct motor_event, MOTOR_EVENT_CNT);
+	spinlock_t event_lock;
+	wait_queue_head_t event_wait;
+	ktime_t event_pos_time;
 
 	/* debug parameters */
 	struct proc_dir_entry *proc;
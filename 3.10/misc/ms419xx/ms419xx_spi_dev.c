@@ -82,6 +82,101 @@ int jz_spidev_write(int addr, char addr_size, int value, char value_size)
 	return ret;
 }
 
+void jz_spidev_batch_init(struct jz_spidev_batch *batch)
+{
+	int i;
+
+	memset(batch, 0, sizeof(*batch));
+	init_completion(&batch->done);
+	for (i = 0; i < JZ_SPIDEV_BATCH_MAX; i++) {
+		batch->transfer[i].tx_buf = batch->wbuf[i];
+		batch->transfer[i].len = 3;
+		batch->transfer[i].cs_change = 1;
+	}
+}
+
+int jz_spidev_batch_add(struct jz_spidev_batch *batch, int addr, int value)
+{
+	unsigned char *wbuf;
+
+	if (batch->busy || batch->count >= JZ_SPIDEV_BATCH_MAX)
+		return -EBUSY;
+
+	wbuf = batch->wbuf[batch->count++];
+	wbuf[0] = addr & 0xff;
+	wbuf[1] = value & 0xff;
+	wbuf[2] = (value >> 8) & 0xff;
+	return 0;
+}
+
+static void jz_spidev_batch_prepare(struct jz_spidev_batch *batch)
+{
+	int i;
+
+	spi_message_init(&batch->message);
+	for (i = 0; i < batch->count; i++)
+		spi_message_add_tail(&batch->transfer[i], &batch->message);
+}
+
+int jz_spidev_batch_sync(struct jz_spidev_batch *batch)
+{
+	int ret = 0;
+
+	if (!batch->count)
+		return 0;
+	jz_spidev_batch_prepare(batch);
+	ret = spi_sync(g_spi, &batch->message);
+	batch->count = 0;
+	if(ret) {
+		printk("spi_sync error ! %s %s %d\n",__FILE__,__func__,__LINE__);
+		ret=-EIO;
+	}
+	return ret;
+}
+
+static void jz_spidev_batch_complete(void *context)
+{
+	struct jz_spidev_batch *batch = context;
+
+	batch->count = 0;
+	batch->busy = false;
+	if (batch->complete)
+		batch->complete(batch->context, batch->message.status);
+	complete(&batch->done);
+}
+
+int jz_spidev_batch_async(struct jz_spidev_batch *batch,
+		void (*complete)(void *context, int status), void *context)
+{
+	int ret = 0;
+
+	if (batch->busy)
+		return -EBUSY;
+
+	jz_spidev_batch_prepare(batch);
+	batch->message.complete = jz_spidev_batch_complete;
+	batch->message.context = batch;
+	batch->complete = complete;
+	batch->context = context;
+	batch->busy = true;
+	INIT_COMPLETION(batch->done);
+
+	ret = spi_async(g_spi, &batch->message);
+	if (ret) {
+		printk("spi_async error ! %s %s %d\n",__FILE__,__func__,__LINE__);
+		batch->count = 0;
+		batch->busy = false;
+		complete_all(&batch->done);
+	}
+	return ret;
+}
+
+/* wait for the message in flight, if any */
+void jz_spidev_batch_wait(struct jz_spidev_batch *batch)
+{
+	if (batch->busy)
+		wait_for_completion(&batch->done);
+}
 
 static int jz_spidev_probe(struct spi_device *spi)
 {
@@ -2,6 +2,7 @@
 #define __JZ_SPI_DEV_H__
 
 #include <linux/wait.h>
+#include <linux/completion.h>
 #include <linux/seq_file.h>
 #include <linux/proc_fs.h>
 #ifndef CONFIG_SOC_T40
@@ -14,6 +15,31 @@
 int jz_spidev_read(int addr, char addr_size, int *value, char value_size);
 int jz_spidev_write(int addr, char addr_size, int value, char value_size);
 
+/*
+ * Several 16 bit register writes sent as one spi_message, the chip select
+ * still toggles between registers. A batch must not be refilled while
+ * busy, complete() is called from the spi controller's completion context.
+ */
+#define JZ_SPIDEV_BATCH_MAX	8
+
+struct jz_spidev_batch {
+	struct spi_message message;
+	struct spi_transfer transfer[JZ_SPIDEV_BATCH_MAX];
+	unsigned char wbuf[JZ_SPIDEV_BATCH_MAX][4];
+	int count;
+	bool busy;
+	struct completion done;
+	void (*complete)(void *context, int status);
+	void *context;
+};
+
+void jz_spidev_batch_init(struct jz_spidev_batch *batch);
+int jz_spidev_batch_add(struct jz_spidev_batch *batch, int addr, int value);
+int jz_spidev_batch_sync(struct jz_spidev_batch *batch);
+int jz_spidev_batch_async(struct jz_spidev_batch *batch,
+		void (*complete)(void *context, int status), void *context);
+void jz_spidev_batch_wait(struct jz_spidev_batch *batch);
+
 int __init jz_spidev_init(void);
 void __exit jz_spidev_exit(void);
 
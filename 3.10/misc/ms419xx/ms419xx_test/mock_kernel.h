@@ -0,0 +1,248 @@
+/*
+ * Just enough of the kernel for ms419xx_spi_dev.c on the host, with a mock
+ * SPI master behind spi_sync() and spi_async().
+ *
+ * The master keeps a simulated clock in ns. A message costs
+ * MOCK_SPI_MSG_NS of queueing, controller kthread switch and wakeup, then
+ * MOCK_SPI_CS_NS per chip select frame and the bits at max_speed_hz.
+ * spi_sync() blocks the caller for all of it, spi_async() for
+ * MOCK_SPI_ASYNC_NS and the message goes out when the test runs the bus.
+ * Every frame that reaches the bus is logged.
+ */
+#ifndef __MOCK_KERNEL_H__
+#define __MOCK_KERNEL_H__
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#define __init
+#define __exit
+#define THIS_MODULE	NULL
+#define printk		printf
+
+#define MOCK_SPI_MSG_NS		25000ULL
+#define MOCK_SPI_CS_NS		1000ULL
+#define MOCK_SPI_ASYNC_NS	3000ULL
+#define MOCK_SPI_HZ		1200000ULL
+
+#define MOCK_SPI_MAX_XFERS	16
+#define MOCK_SPI_MAX_FRAMES	256
+#define MOCK_SPI_QUEUE		4
+
+struct completion {
+	unsigned int done;
+};
+
+#define INIT_COMPLETION(x)	((x).done = 0)
+
+static inline void init_completion(struct completion *x)
+{
+	x->done = 0;
+}
+
+static inline void complete(struct completion *x)
+{
+	x->done++;
+}
+
+static inline void complete_all(struct completion *x)
+{
+	x->done = ~0U >> 1;
+}
+
+#define SPI_CPHA		0x01
+#define SPI_CPOL		0x02
+#define SPI_MODE_3		(SPI_CPOL | SPI_CPHA)
+#define SPI_CS_HIGH		0x04
+#define SPI_LSB_FIRST		0x08
+
+struct spi_master {
+	int bus_num;
+};
+
+struct spi_device {
+	struct spi_master *master;
+	unsigned int mode;
+};
+
+struct spi_device_id {
+	char name[32];
+};
+
+struct device_driver {
+	const char *name;
+	void *owner;
+};
+
+struct spi_driver {
+	struct device_driver driver;
+	const struct spi_device_id *id_table;
+	int (*probe)(struct spi_device *spi);
+	int (*remove)(struct spi_device *spi);
+	void (*shutdown)(struct spi_device *spi);
+};
+
+struct spi_board_info {
+	const char *modalias;
+	int bus_num;
+	int chip_select;
+	unsigned int max_speed_hz;
+	unsigned int mode;
+};
+
+struct spi_transfer {
+	const void *tx_buf;
+	void *rx_buf;
+	unsigned int len;
+	unsigned int cs_change:1;
+};
+
+struct spi_message {
+	struct spi_transfer *xfers[MOCK_SPI_MAX_XFERS];
+	int n;
+	void (*complete)(void *context);
+	void *context;
+	int status;
+};
+
+/* one chip select frame on the bus */
+struct mock_spi_frame {
+	unsigned char data[8];
+	unsigned int len;
+	unsigned long long end_ns;
+};
+
+struct mock_spi {
+	unsigned long long now_ns;
+	struct spi_message *queue[MOCK_SPI_QUEUE];
+	int queued;
+	int fail;				/* next spi_async/spi_sync returns this */
+	unsigned int messages;
+	struct mock_spi_frame frames[MOCK_SPI_MAX_FRAMES];
+	int nframes;
+};
+
+static struct mock_spi mock_spi;
+
+static inline void spi_message_init(struct spi_message *m)
+{
+	memset(m, 0, sizeof(*m));
+}
+
+static inline void spi_message_add_tail(struct spi_transfer *t, struct spi_message *m)
+{
+	if (m->n < MOCK_SPI_MAX_XFERS)
+		m->xfers[m->n++] = t;
+}
+
+/* clock the message out, frames end where cs_change or the message ends */
+static inline void mock_spi_transfer(struct spi_message *m)
+{
+	struct mock_spi_frame *frame = NULL;
+	struct spi_transfer *t;
+	unsigned int i;
+	int x;
+
+	mock_spi.now_ns += MOCK_SPI_MSG_NS;
+	mock_spi.messages++;
+	for (x = 0; x < m->n; x++) {
+		t = m->xfers[x];
+		if (!frame && mock_spi.nframes < MOCK_SPI_MAX_FRAMES) {
+			frame = &mock_spi.frames[mock_spi.nframes++];
+			frame->len = 0;
+			mock_spi.now_ns += MOCK_SPI_CS_NS;
+		}
+		for (i = 0; i < t->len; i++) {
+			if (frame && frame->len < sizeof(frame->data))
+				frame->data[frame->len++] = t->tx_buf ? ((const unsigned char *)t->tx_buf)[i] : 0;
+			if (t->rx_buf)
+				((unsigned char *)t->rx_buf)[i] = 0;
+		}
+		mock_spi.now_ns += t->len * 8ULL * 1000000000ULL / MOCK_SPI_HZ;
+		if (frame)
+			frame->end_ns = mock_spi.now_ns;
+		if (t->cs_change)
+			frame = NULL;
+	}
+	m->status = 0;
+}
+
+static inline int spi_sync(struct spi_device *spi, struct spi_message *m)
+{
+	int ret = mock_spi.fail;
+
+	mock_spi.fail = 0;
+	if (ret)
+		return ret;
+	mock_spi_transfer(m);
+	return m->status;
+}
+
+static inline int spi_async(struct spi_device *spi, struct spi_message *m)
+{
+	int ret = mock_spi.fail;
+
+	mock_spi.fail = 0;
+	mock_spi.now_ns += MOCK_SPI_ASYNC_NS;
+	if (ret)
+		return ret;
+	if (mock_spi.queued >= MOCK_SPI_QUEUE)
+		return -EBUSY;
+	mock_spi.queue[mock_spi.queued++] = m;
+	return 0;
+}
+
+/* the controller kthread works off the queue and completes each message */
+static inline void mock_spi_run(void)
+{
+	struct spi_message *m;
+	int i;
+
+	while (mock_spi.queued) {
+		m = mock_spi.queue[0];
+		for (i = 1; i < mock_spi.queued; i++)
+			mock_spi.queue[i - 1] = mock_spi.queue[i];
+		mock_spi.queued--;
+		mock_spi_transfer(m);
+		if (m->complete)
+			m->complete(m->context);
+	}
+}
+
+static inline void wait_for_completion(struct completion *x)
+{
+	if (!x->done)
+		mock_spi_run();
+	if (x->done)
+		x->done--;
+}
+
+static struct spi_master mock_spi_master;
+static struct spi_device mock_spi_device = { &mock_spi_master, 0 };
+
+static inline struct spi_master *spi_busnum_to_master(int bus_num)
+{
+	return &mock_spi_master;
+}
+
+static inline struct spi_device *spi_new_device(struct spi_master *master, struct spi_board_info *info)
+{
+	return &mock_spi_device;
+}
+
+static inline int spi_register_driver(struct spi_driver *drv)
+{
+	return drv->probe(&mock_spi_device);
+}
+
+static inline void spi_unregister_driver(struct spi_driver *drv)
+{
+}
+
+static inline void spi_unregister_device(struct spi_device *spi)
+{
+}
+
+#endif /* __MOCK_KERNEL_H__ */
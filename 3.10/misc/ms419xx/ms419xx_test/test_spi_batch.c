@@ -0,0 +1,210 @@
+/*
+ * Host side check of the ms419xx SPI register batches.
+ *
+ * Builds ms419xx_spi_dev.c against the mock SPI master of mock_kernel.h
+ * and checks what reaches the bus: one chip select frame of address, low
+ * and high byte per register, in the order they were added, with the
+ * completion called once when the message is done. It then plays the
+ * direction change of jz_timer_thread_handle both ways, as two
+ * jz_spidev_write() calls and as one jz_spidev_batch_async(), and prints
+ * how long the irq thread is held and when the last register is in the
+ * chip, in the timing model of the mock master.
+ *
+ * make && ./ms419xx_test
+ */
+
+#include "../ms419xx_spi_dev.c"
+
+static int failures;
+
+#define CHECK(cond, ...) do {						\
+	if (!(cond)) {							\
+		printf("FAIL %s:%d: ", __func__, __LINE__);		\
+		printf(__VA_ARGS__);					\
+		printf("\n");						\
+		failures++;						\
+	}								\
+} while (0)
+
+struct done_log {
+	int calls;
+	int status;
+	bool busy;			/* batch->busy seen from the callback */
+	unsigned long long at_ns;
+	struct jz_spidev_batch *batch;
+};
+
+static void batch_done(void *context, int status)
+{
+	struct done_log *log = context;
+
+	log->calls++;
+	log->status = status;
+	log->busy = log->batch->busy;
+	log->at_ns = mock_spi.now_ns;
+}
+
+static void mock_reset(void)
+{
+	memset(&mock_spi, 0, sizeof(mock_spi));
+}
+
+static void check_frame(int i, int addr, int value)
+{
+	struct mock_spi_frame *frame = &mock_spi.frames[i];
+
+	CHECK(i < mock_spi.nframes, "frame %d of %d", i, mock_spi.nframes);
+	CHECK(frame->len == 3, "frame %d is %u bytes", i, frame->len);
+	CHECK(frame->data[0] == addr && frame->data[1] == (value & 0xff) && frame->data[2] == (value >> 8),
+	      "frame %d is %02x %02x %02x, expected %02x %02x %02x", i,
+	      frame->data[0], frame->data[1], frame->data[2], addr, value & 0xff, value >> 8);
+}
+
+/* the direction registers of both motors in one message, off the caller */
+static void test_async(void)
+{
+	static struct jz_spidev_batch batch;
+	struct done_log log = { 0 };
+	int ret = 0;
+
+	mock_reset();
+	jz_spidev_batch_init(&batch);
+	log.batch = &batch;
+	jz_spidev_batch_add(&batch, 0x24, 0x0305);
+	jz_spidev_batch_add(&batch, 0x29, 0x0105);
+	ret = jz_spidev_batch_async(&batch, batch_done, &log);
+	CHECK(ret == 0, "jz_spidev_batch_async returned %d", ret);
+	CHECK(batch.busy, "batch not busy while queued");
+	CHECK(mock_spi.nframes == 0 && log.calls == 0, "message went out before the bus ran");
+
+	/* the thread is woken again while the message is in flight */
+	ret = jz_spidev_batch_add(&batch, 0x24, 0x0000);
+	CHECK(ret == -EBUSY, "add to a busy batch returned %d", ret);
+	ret = jz_spidev_batch_async(&batch, batch_done, &log);
+	CHECK(ret == -EBUSY, "second async on a busy batch returned %d", ret);
+
+	mock_spi_run();
+	CHECK(mock_spi.messages == 1, "%u messages for one batch", mock_spi.messages);
+	CHECK(mock_spi.nframes == 2, "%d frames for two registers", mock_spi.nframes);
+	check_frame(0, 0x24, 0x0305);
+	check_frame(1, 0x29, 0x0105);
+	CHECK(log.calls == 1 && log.status == 0, "completion called %d times, status %d", log.calls, log.status);
+	CHECK(!log.busy, "batch still busy in its completion");
+	CHECK(!batch.busy && batch.count == 0, "batch busy %d count %d after completion", batch.busy, batch.count);
+
+	/* and it is ready for the next direction change */
+	jz_spidev_batch_add(&batch, 0x29, 0x0205);
+	ret = jz_spidev_batch_async(&batch, batch_done, &log);
+	CHECK(ret == 0, "reused batch returned %d", ret);
+	jz_spidev_batch_wait(&batch);
+	CHECK(log.calls == 2 && !batch.busy, "wait left calls %d busy %d", log.calls, batch.busy);
+	check_frame(2, 0x29, 0x0205);
+}
+
+/* motor_ops_reset: the register setup as one synchronous message */
+static void test_sync(void)
+{
+	static const int regs[][2] = {
+		{ 0x20, 0x1e01 }, { 0x22, 0x0001 }, { 0x27, 0x0001 }, { 0x23, 0xa0a0 },
+		{ 0x28, 0xa0a0 }, { 0x25, 0x0100 }, { 0x2a, 0x0100 },
+	};
+	struct jz_spidev_batch batch;
+	int i = 0, ret = 0;
+
+	mock_reset();
+	jz_spidev_batch_init(&batch);
+	for (i = 0; i < 7; i++)
+		jz_spidev_batch_add(&batch, regs[i][0], regs[i][1]);
+	ret = jz_spidev_batch_sync(&batch);
+	CHECK(ret == 0, "jz_spidev_batch_sync returned %d", ret);
+	CHECK(mock_spi.messages == 1, "%u messages for one batch", mock_spi.messages);
+	CHECK(mock_spi.nframes == 7, "%d frames for 7 registers", mock_spi.nframes);
+	for (i = 0; i < 7; i++)
+		check_frame(i, regs[i][0], regs[i][1]);
+	CHECK(batch.count == 0, "count %d after sync", batch.count);
+
+	/* no more than JZ_SPIDEV_BATCH_MAX registers */
+	for (i = 0; i < JZ_SPIDEV_BATCH_MAX; i++)
+		CHECK(jz_spidev_batch_add(&batch, 0x24, i) == 0, "add %d refused", i);
+	CHECK(jz_spidev_batch_add(&batch, 0x24, i) == -EBUSY, "add past JZ_SPIDEV_BATCH_MAX taken");
+}
+
+/* a failed submit leaves the batch free and nobody waiting */
+static void test_error(void)
+{
+	static struct jz_spidev_batch batch;
+	struct done_log log = { 0 };
+	int ret = 0;
+
+	mock_reset();
+	jz_spidev_batch_init(&batch);
+	log.batch = &batch;
+	jz_spidev_batch_add(&batch, 0x24, 0x0305);
+	mock_spi.fail = -EIO;
+	ret = jz_spidev_batch_async(&batch, batch_done, &log);
+	CHECK(ret == -EIO, "jz_spidev_batch_async returned %d", ret);
+	CHECK(!batch.busy && batch.count == 0, "batch busy %d count %d after the error", batch.busy, batch.count);
+	jz_spidev_batch_wait(&batch);
+	CHECK(log.calls == 0 && mock_spi.nframes == 0, "failed batch reached the bus");
+
+	jz_spidev_batch_add(&batch, 0x29, 0x0105);
+	mock_spi.fail = -EIO;
+	ret = jz_spidev_batch_sync(&batch);
+	CHECK(ret == -EIO, "jz_spidev_batch_sync returned %d", ret);
+	CHECK(batch.count == 0, "count %d after the error", batch.count);
+}
+
+/* both motors change direction on the same VDFZ edge */
+static void test_latency(void)
+{
+	static struct jz_spidev_batch batch;
+	struct done_log log = { 0 };
+	unsigned long long write_held = 0, write_done = 0, batch_held = 0, batch_done_ns = 0;
+
+	mock_reset();
+	jz_spidev_write(0x24, 1, 0x0305, 2);
+	jz_spidev_write(0x29, 1, 0x0105, 2);
+	write_held = mock_spi.now_ns;
+	write_done = mock_spi.frames[mock_spi.nframes - 1].end_ns;
+	check_frame(0, 0x24, 0x0305);
+	check_frame(1, 0x29, 0x0105);
+
+	mock_reset();
+	jz_spidev_batch_init(&batch);
+	log.batch = &batch;
+	jz_spidev_batch_add(&batch, 0x24, 0x0305);
+	jz_spidev_batch_add(&batch, 0x29, 0x0105);
+	jz_spidev_batch_async(&batch, batch_done, &log);
+	batch_held = mock_spi.now_ns;
+	mock_spi_run();
+	batch_done_ns = log.at_ns;
+	check_frame(0, 0x24, 0x0305);
+	check_frame(1, 0x29, 0x0105);
+
+	printf("two registers, %llu ns message overhead, %llu Hz:\n", MOCK_SPI_MSG_NS, MOCK_SPI_HZ);
+	printf("  jz_spidev_write x2:    irq thread held %6llu ns, registers in after %6llu ns\n",
+	       write_held, write_done);
+	printf("  jz_spidev_batch_async: irq thread held %6llu ns, registers in after %6llu ns\n",
+	       batch_held, batch_done_ns);
+	CHECK(batch_held < write_held, "batch holds the thread %llu ns, writes %llu ns", batch_held, write_held);
+	CHECK(batch_done_ns < write_done, "batch done after %llu ns, writes after %llu ns", batch_done_ns, write_done);
+}
+
+int main(int argc, char **argv)
+{
+	jz_spidev_init();
+
+	test_async();
+	test_sync();
+	test_error();
+	test_latency();
+
+	jz_spidev_exit();
+
+	if (failures) {
+		printf("%d check(s) failed\n", failures);
+		return 1;
+	}
+	printf("ms419xx spi: all checks passed\n");
+	return 0;
+}
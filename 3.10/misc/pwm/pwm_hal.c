@@ -22,6 +22,11 @@
 #include <linux/mfd/jz_tcu.h>
 #endif
 #include <linux/spinlock.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
+
+#include "pwm_ramp.h"
 
 #if defined(CONFIG_SOC_T30) || defined(CONFIG_SOC_T40)
 #define PWM_NUM		8
@@ -33,6 +38,9 @@
 #define PWM_ENABLE		0x010
 #define PWM_DISABLE		0x100
 #define PWM_QUERY_STATUS	0x200
+#define PWM_RAMP		0x400
+#define PWM_CONFIG_BATCH	0x800
+#define PWM_QUERY_ALL		0x1000
 
 struct platform_device pwm_device = {
 	.name = "pwm-jz",
@@ -102,12 +110,61 @@ struct pwm_ioctl_t {
 	int enabled;
 };
 
+/*
+ * PWM_RAMP: move the duty of an enabled channel from start_duty to end_duty
+ * over duration_ms. Falling ramps mirror the curve in time, so a gamma fade
+ * out looks like a gamma fade in played backwards. Any other duty change
+ * on the channel, or a new ramp, cancels the running one.
+ */
+struct pwm_ramp_t {
+	int index;
+	int start_duty;
+	int end_duty;
+	int duration_ms;
+	int curve;
+};
+
+/*
+ * PWM_CONFIG_BATCH: count entries at chns, one per channel. Every entry is
+ * checked as for PWM_CONFIG first, then all channels get their period,
+ * duty, polarity and enabled state back to back.
+ */
+struct pwm_batch_t {
+	int count;
+	struct pwm_ioctl_t *chns;
+};
+
+/*
+ * PWM_QUERY_ALL copies this snapshot of the cached channel state, the same
+ * data is also mapped read only at offset 0 of /dev/pwm. Page readers
+ * retry while seq is odd or changed under them. Channels that are not
+ * available report index -1.
+ */
+struct pwm_status_t {
+	unsigned int seq;
+	int num;
+	struct pwm_ioctl_t chn[PWM_NUM];
+};
+
+struct pwm_jz_t;
+
 struct pwm_device_t {
 	int duty;
 	int period;
 	int polarity;
 	int enabled;
 	struct pwm_device *pwm_device;
+
+	struct pwm_jz_t *gpwm;
+	int index;
+
+	/* PWM_RAMP state, only touched by the timer while it is queued */
+	struct hrtimer ramp_timer;
+	ktime_t ramp_start;
+	s64 ramp_ns;
+	int ramp_from;
+	int ramp_to;
+	int ramp_curve;
 };
 
 struct pwm_jz_t {
@@ -116,8 +173,192 @@ struct pwm_jz_t {
 	struct pwm_device_t *pwm_device_t[PWM_NUM];
 	spinlock_t pwm_lock;
 	struct mutex mlock;
+	/* status page, updated under pwm_lock */
+	struct pwm_status_t *status;
 };
 
+static unsigned int pwm_ramp_step_us = 5000;
+module_param(pwm_ramp_step_us, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(pwm_ramp_step_us, "Interval between duty updates of PWM_RAMP");
+
+static void pwm_status_update(struct pwm_jz_t *gpwm, int id)
+{
+	struct pwm_device_t *pwm = gpwm->pwm_device_t[id];
+	struct pwm_ioctl_t *chn = &gpwm->status->chn[id];
+	unsigned long flags;
+
+	spin_lock_irqsave(&gpwm->pwm_lock, flags);
+	gpwm->status->seq++;
+	smp_wmb();
+	if (pwm && pwm->pwm_device) {
+		chn->index = id;
+		chn->duty = pwm->duty;
+		chn->period = pwm->period;
+		chn->polarity = pwm->polarity;
+		chn->enabled = pwm->enabled;
+	} else {
+		chn->index = -1;
+		chn->duty = -1;
+		chn->period = -1;
+		chn->polarity = -1;
+		chn->enabled = 0;
+	}
+	smp_wmb();
+	gpwm->status->seq++;
+	spin_unlock_irqrestore(&gpwm->pwm_lock, flags);
+}
+
+/*
+ * Runs in hardirq context. pwm_config() ends in jz_pwm_config() of
+ * pwm_core.c, which only computes the TCU counts and writes the TCU and
+ * GPIO function registers, none of that sleeps. The ioctls cancel the
+ * timer before they touch the channel themselves.
+ */
+static enum hrtimer_restart pwm_ramp_timer(struct hrtimer *timer)
+{
+	struct pwm_device_t *pwm = container_of(timer, struct pwm_device_t, ramp_timer);
+	s64 elapsed = ktime_to_ns(ktime_sub(ktime_get(), pwm->ramp_start));
+	unsigned int t = pwm_ramp_pos(elapsed, pwm->ramp_ns);
+	int duty = pwm_ramp_duty(pwm->ramp_from, pwm->ramp_to, pwm->ramp_curve, t);
+
+	if (duty != pwm->duty) {
+		pwm->duty = duty;
+		pwm_config(pwm->pwm_device, pwm->duty, pwm->period);
+		pwm_status_update(pwm->gpwm, pwm->index);
+	}
+	if (t >= 4096)
+		return HRTIMER_NORESTART;
+
+	hrtimer_forward_now(timer, ns_to_ktime((u64)max(pwm_ramp_step_us, 100U) * NSEC_PER_USEC));
+	return HRTIMER_RESTART;
+}
+
+/* called with mlock held */
+static int pwm_ramp_start(struct pwm_jz_t *gpwm, struct pwm_ramp_t *ramp)
+{
+	struct pwm_device_t *pwm;
+	int id = ramp->index;
+
+	if ((id >= PWM_NUM) || (id < 0) || (gpwm->pwm_device_t[id] == NULL)) {
+		dev_err(gpwm->dev, "ioctl error(%d) !\n", __LINE__);
+		return -EINVAL;
+	}
+	pwm = gpwm->pwm_device_t[id];
+	if ((pwm->pwm_device == NULL) || !pwm->enabled) {
+		dev_err(gpwm->dev, "pwm%d is not enabled !\n", id);
+		return -EINVAL;
+	}
+	if ((ramp->start_duty < 0) || (ramp->start_duty > pwm->period) ||
+	    (ramp->end_duty < 0) || (ramp->end_duty > pwm->period)) {
+		dev_err(gpwm->dev, "duty error !\n");
+		return -EINVAL;
+	}
+	if ((ramp->duration_ms < 0) || (ramp->curve < PWM_RAMP_LINEAR) || (ramp->curve > PWM_RAMP_EXP)) {
+		dev_err(gpwm->dev, "ramp error !\n");
+		return -EINVAL;
+	}
+
+	hrtimer_cancel(&pwm->ramp_timer);
+	pwm->ramp_from = ramp->start_duty;
+	pwm->ramp_to = ramp->end_duty;
+	pwm->ramp_curve = ramp->curve;
+	pwm->ramp_ns = (s64)ramp->duration_ms * NSEC_PER_MSEC;
+	pwm->ramp_start = ktime_get();
+	/* the first step applies start_duty right away */
+	hrtimer_start(&pwm->ramp_timer, ktime_set(0, 0), HRTIMER_MODE_REL);
+
+	return 0;
+}
+
+static void pwm_ramp_cancel(struct pwm_jz_t *gpwm, int id)
+{
+	if ((id < PWM_NUM) && (id >= 0) && gpwm->pwm_device_t[id])
+		hrtimer_cancel(&gpwm->pwm_device_t[id]->ramp_timer);
+}
+
+static int pwm_ioctl_check(struct pwm_jz_t *gpwm, struct pwm_ioctl_t *pwm_ioctl)
+{
+	int id = pwm_ioctl->index;
+
+	if ((id >= PWM_NUM) || (id < 0)) {
+		dev_err(gpwm->dev, "ioctl error(%d) !\n", __LINE__);
+		return -1;
+	}
+
+	if ((pwm_ioctl->period > 1000000000) || (pwm_ioctl->period < 200)) {
+		dev_err(gpwm->dev, "period error !\n");
+		return -1;
+	}
+
+	if ((pwm_ioctl->duty > pwm_ioctl->period) || (pwm_ioctl->duty < 0)) {
+		dev_err(gpwm->dev, "duty error !\n");
+		return -1;
+	}
+
+	if ((pwm_ioctl->polarity > 1) || (pwm_ioctl->polarity < 0)) {
+		dev_err(gpwm->dev, "polarity error !\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* called with mlock held */
+static int pwm_config_batch(struct pwm_jz_t *gpwm, struct pwm_batch_t *batch)
+{
+	struct pwm_ioctl_t chns[PWM_NUM];
+	struct pwm_device_t *pwm;
+	unsigned int mask = 0;
+	int i, id;
+
+	if ((batch->count <= 0) || (batch->count > PWM_NUM)) {
+		dev_err(gpwm->dev, "ioctl error(%d) !\n", __LINE__);
+		return -1;
+	}
+	if (copy_from_user(chns, (void __user *)batch->chns, batch->count * sizeof(chns[0]))) {
+		dev_err(gpwm->dev, "Error copying data from user space!\n");
+		return -EFAULT;
+	}
+
+	for (i = 0; i < batch->count; i++) {
+		if (pwm_ioctl_check(gpwm, &chns[i]))
+			return -1;
+		id = chns[i].index;
+		if ((mask & (1 << id)) || (gpwm->pwm_device_t[id] == NULL) ||
+		    (gpwm->pwm_device_t[id]->pwm_device == NULL) || (IS_ERR(gpwm->pwm_device_t[id]->pwm_device))) {
+			dev_err(gpwm->dev, "pwm%d could not work !\n", id);
+			return -1;
+		}
+		mask |= 1 << id;
+	}
+
+	for (i = 0; i < batch->count; i++) {
+		pwm = gpwm->pwm_device_t[chns[i].index];
+		hrtimer_cancel(&pwm->ramp_timer);
+		pwm->period = chns[i].period;
+		pwm->duty = chns[i].duty;
+		pwm->polarity = chns[i].polarity;
+
+		if (!chns[i].enabled) {
+			if (pwm->enabled)
+				pwm_disable(pwm->pwm_device);
+			pwm->enabled = 0;
+			continue;
+		}
+		if (!pwm->enabled) {
+			if (pwm->polarity == 0)
+				pwm_set_polarity(pwm->pwm_device, PWM_POLARITY_INVERSED);
+			else
+				pwm_set_polarity(pwm->pwm_device, PWM_POLARITY_NORMAL);
+			pwm_enable(pwm->pwm_device);
+			pwm->enabled = 1;
+		}
+		pwm_config(pwm->pwm_device, pwm->duty, pwm->period);
+	}
+
+	return 0;
+}
+
 static int pwm_jz_open(struct inode *inode, struct file *filp)
 {
 	return 0;
@@ -145,31 +386,12 @@ static long pwm_jz_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 				break;
 			}
 
-			id = pwm_ioctl.index;
-			if ((id >= PWM_NUM) || (id < 0)) {
-				dev_err(gpwm->dev, "ioctl error(%d) !\n", __LINE__);
-				ret = -1;
-				break;
-			}
-
-			if ((pwm_ioctl.period > 1000000000) || (pwm_ioctl.period < 200)) {
-				dev_err(gpwm->dev, "period error !\n");
-				ret = -1;
-				break;
-			}
-
-			if ((pwm_ioctl.duty > pwm_ioctl.period) || (pwm_ioctl.duty < 0)) {
-				dev_err(gpwm->dev, "duty error !\n");
-				ret = -1;
-				break;
-			}
-
-			if ((pwm_ioctl.polarity > 1) || (pwm_ioctl.polarity < 0)) {
-				dev_err(gpwm->dev, "polarity error !\n");
-				ret = -1;
+			ret = pwm_ioctl_check(gpwm, &pwm_ioctl);
+			if (ret)
 				break;
-			}
 
+			id = pwm_ioctl.index;
+			pwm_ramp_cancel(gpwm, id);
 			gpwm->pwm_device_t[id]->period = pwm_ioctl.period;
 			gpwm->pwm_device_t[id]->duty = pwm_ioctl.duty;
 			gpwm->pwm_device_t[id]->polarity = pwm_ioctl.polarity;
@@ -188,6 +410,7 @@ static long pwm_jz_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 				break;
 			}
 			id = pwm_ioctl.index;
+			pwm_ramp_cancel(gpwm, id);
 			gpwm->pwm_device_t[id]->duty = pwm_ioctl.duty;
 			pwm_config(gpwm->pwm_device_t[id]->pwm_device, gpwm->pwm_device_t[id]->duty, gpwm->pwm_device_t[id]->period);
 
@@ -213,6 +436,7 @@ static long pwm_jz_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 				break;
 			}
 
+			pwm_ramp_cancel(gpwm, id);
 			if (gpwm->pwm_device_t[id]->polarity == 0)
 				pwm_set_polarity(gpwm->pwm_device_t[id]->pwm_device, PWM_POLARITY_INVERSED);
 			else
@@ -244,6 +468,7 @@ static long pwm_jz_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 				break;
 			}
 
+			pwm_ramp_cancel(gpwm, id);
 			pwm_disable(gpwm->pwm_device_t[id]->pwm_device);
 			gpwm->pwm_device_t[id]->enabled = 0;
 
@@ -257,20 +482,18 @@ static long pwm_jz_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 
 			id = pwm_ioctl.index;
 
-			if ((id >= PWM_NUM) || (id < 0)) {
+			if ((id >= PWM_NUM) || (id < 0) || (gpwm->pwm_device_t[id] == NULL)) {
 				dev_err(gpwm->dev, "ioctl error(%d) !\n", __LINE__);
 				ret = -1;
 				break;
 			}
 
-			dev_info(gpwm->dev, "Queried PWM Channel: %d\n", id);
-
 			pwm_ioctl.duty = gpwm->pwm_device_t[id]->duty;
 			pwm_ioctl.period = gpwm->pwm_device_t[id]->period;
 			pwm_ioctl.polarity = gpwm->pwm_device_t[id]->polarity;
 			pwm_ioctl.enabled = gpwm->pwm_device_t[id]->enabled;
 
-			dev_info(gpwm->dev, "Channel %d - Duty: %d, Period: %d, Polarity: %d\n",
+			dev_dbg(gpwm->dev, "Channel %d - Duty: %d, Period: %d, Polarity: %d\n",
 				id, pwm_ioctl.duty, pwm_ioctl.period, pwm_ioctl.polarity);
 
 			if (copy_to_user((void __user *)arg, &pwm_ioctl, sizeof(pwm_ioctl))) {
@@ -279,21 +502,78 @@ static long pwm_jz_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 			}
 			break;
 
+		case PWM_QUERY_ALL:
+			{
+				struct pwm_status_t status;
+				unsigned long flags;
+
+				spin_lock_irqsave(&gpwm->pwm_lock, flags);
+				status = *gpwm->status;
+				spin_unlock_irqrestore(&gpwm->pwm_lock, flags);
+				if (copy_to_user((void __user *)arg, &status, sizeof(status))) {
+					dev_err(gpwm->dev, "Error copying data to user space!\n");
+					ret = -EFAULT;
+				}
+			}
+			break;
+		case PWM_CONFIG_BATCH:
+			{
+				struct pwm_batch_t batch;
+
+				if (copy_from_user(&batch, (void __user *)arg, sizeof(batch))) {
+					dev_err(gpwm->dev, "Error copying data from user space!\n");
+					ret = -EFAULT;
+					break;
+				}
+				ret = pwm_config_batch(gpwm, &batch);
+			}
+			break;
+		case PWM_RAMP:
+			{
+				struct pwm_ramp_t ramp;
+
+				if (copy_from_user(&ramp, (void __user *)arg, sizeof(ramp))) {
+					dev_err(gpwm->dev, "Error copying data from user space!\n");
+					ret = -EFAULT;
+					break;
+				}
+				ret = pwm_ramp_start(gpwm, &ramp);
+			}
+			break;
+
 		default:
 			dev_err(gpwm->dev, "unsupport cmd !\n");
 			break;
 	}
 
+	for (id = 0; id < PWM_NUM; id++)
+		pwm_status_update(gpwm, id);
 	mutex_unlock(&gpwm->mlock);
 
 	return ret;
 }
 
+static int pwm_jz_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct miscdevice *dev = filp->private_data;
+	struct pwm_jz_t *gpwm = container_of(dev, struct pwm_jz_t, mdev);
+
+	if ((vma->vm_pgoff != 0) || (vma->vm_end - vma->vm_start > PAGE_SIZE))
+		return -EINVAL;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	return remap_pfn_range(vma, vma->vm_start, virt_to_phys(gpwm->status) >> PAGE_SHIFT,
+			vma->vm_end - vma->vm_start, vma->vm_page_prot);
+}
+
 static struct file_operations pwm_jz_fops = {
 	.owner		= THIS_MODULE,
 	.open		= pwm_jz_open,
 	.release	= pwm_jz_release,
 	.unlocked_ioctl	= pwm_jz_ioctl,
+	.mmap		= pwm_jz_mmap,
 };
 
 static int jz_pwm_probe(struct platform_device *pdev)
@@ -348,6 +628,10 @@ static int jz_pwm_probe(struct platform_device *pdev)
 			dev_err(&pdev->dev, "devm_kzalloc pwm_device_t error !\n");
 			return -ENOMEM;
 		}
+		gpwm->pwm_device_t[i]->gpwm = gpwm;
+		gpwm->pwm_device_t[i]->index = i;
+		hrtimer_init(&gpwm->pwm_device_t[i]->ramp_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+		gpwm->pwm_device_t[i]->ramp_timer.function = pwm_ramp_timer;
 
 		sprintf(pd_name, "pwm-jz.%d", i);
 		gpwm->pwm_device_t[i]->pwm_device = devm_pwm_get(&pdev->dev, pd_name);
@@ -371,12 +655,21 @@ static int jz_pwm_probe(struct platform_device *pdev)
 
 	spin_lock_init(&gpwm->pwm_lock);
 	mutex_init(&gpwm->mlock);
+	gpwm->status = (struct pwm_status_t *)get_zeroed_page(GFP_KERNEL);
+	if (gpwm->status == NULL) {
+		dev_err(&pdev->dev, "get_zeroed_page status error !\n");
+		return -ENOMEM;
+	}
+	gpwm->status->num = PWM_NUM;
+	for (i = 0; i < PWM_NUM; i++)
+		pwm_status_update(gpwm, i);
 	gpwm->mdev.minor = MISC_DYNAMIC_MINOR;
 	gpwm->mdev.name = "pwm";
 	gpwm->mdev.fops = &pwm_jz_fops;
 	ret = misc_register(&gpwm->mdev);
 	if (ret < 0) {
 		dev_err(&pdev->dev, "misc_register failed !\n");
+		free_page((unsigned long)gpwm->status);
 		return ret;
 	}
 
@@ -397,12 +690,16 @@ static int jz_pwm_remove(struct platform_device *pdev)
 		return 0;
 	misc_deregister(&gpwm->mdev);
 
+	for(i = 0; i < PWM_NUM; i++)
+		pwm_ramp_cancel(gpwm, i);
+
 	for(i = 0; i < PWM_NUM; i++) {
 		if (gpwm->pwm_device_t[i]->pwm_device) {
 			devm_pwm_put(&pdev->dev, gpwm->pwm_device_t[i]->pwm_device);
 			devm_kfree(&pdev->dev, gpwm->pwm_device_t[i]);
 		}
 	}
+	free_page((unsigned long)gpwm->status);
 	devm_kfree(&pdev->dev, gpwm);
 	platform_set_drvdata(pdev, NULL);
 	return 0;
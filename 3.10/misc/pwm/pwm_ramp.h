@@ -0,0 +1,87 @@
+/*
+ * PWM_RAMP curves;
+ *
+ * Copyright (c) 2015 Ingenic
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * Duty arithmetic of the PWM_RAMP timer. Nothing here touches the
+ * hardware, pwm_ramp_test/ runs the same code on the host.
+ */
+#ifndef __PWM_RAMP_H__
+#define __PWM_RAMP_H__
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/math64.h>
+#else
+#include <stdint.h>
+typedef int64_t s64;
+#define div_s64(a, b)		((a) / (b))
+#define div64_s64(a, b)		((a) / (b))
+#endif
+
+/* PWM_RAMP curves */
+#define PWM_RAMP_LINEAR		0
+#define PWM_RAMP_GAMMA		1	/* gamma 2.2, even steps of perceived brightness */
+#define PWM_RAMP_EXP		2	/* 2^(8t), slow start and fast end */
+
+/* curve(t) for t = 0..32/32, 4096 is 1.0 */
+static const unsigned short pwm_ramp_gamma[33] = {
+	0, 2, 9, 22, 42, 69, 103, 145, 194, 251, 317, 391, 473, 565, 665, 773,
+	891, 1019, 1155, 1301, 1456, 1621, 1796, 1981, 2175, 2380, 2594, 2819,
+	3053, 3298, 3554, 3820, 4096,
+};
+
+static const unsigned short pwm_ramp_exp[33] = {
+	0, 3, 7, 11, 16, 22, 29, 38, 48, 60, 75, 92, 112, 137, 166, 200,
+	241, 290, 347, 416, 498, 595, 711, 848, 1012, 1206, 1438, 1713,
+	2040, 2429, 2892, 3442, 4096,
+};
+
+/* t and the result are in 1/4096 */
+static inline unsigned int pwm_ramp_curve(int curve, unsigned int t)
+{
+	const unsigned short *table;
+	unsigned int i, frac;
+
+	if (curve == PWM_RAMP_GAMMA)
+		table = pwm_ramp_gamma;
+	else if (curve == PWM_RAMP_EXP)
+		table = pwm_ramp_exp;
+	else
+		return t;
+
+	i = t >> 7;
+	frac = t & 0x7f;
+	if (i >= 32)
+		return 4096;
+	return table[i] + (((table[i + 1] - table[i]) * frac) >> 7);
+}
+
+/* position in the ramp after elapsed of ramp_ns, in 1/4096 */
+static inline unsigned int pwm_ramp_pos(s64 elapsed, s64 ramp_ns)
+{
+	if (elapsed >= ramp_ns)
+		return 4096;
+	if (elapsed <= 0)
+		return 0;
+	return div64_s64(elapsed * 4096, ramp_ns);
+}
+
+/*
+ * duty at position t of a ramp from..to, falling ramps run the curve
+ * backwards in time
+ */
+static inline int pwm_ramp_duty(int from, int to, int curve, unsigned int t)
+{
+	if (to >= from)
+		return from + (int)div_s64((s64)(to - from) * pwm_ramp_curve(curve, t), 4096);
+	return to + (int)div_s64((s64)(from - to) * pwm_ramp_curve(curve, 4096 - t), 4096);
+}
+
+#endif /* __PWM_RAMP_H__ */
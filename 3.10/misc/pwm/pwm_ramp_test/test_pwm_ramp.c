@@ -0,0 +1,159 @@
+/*
+ * Host side check of the PWM_RAMP timer.
+ *
+ * Runs ramps through pwm_ramp.h the way pwm_ramp_timer does, one call per
+ * expiry with the expiries late by a random amount, and checks that the
+ * duty never steps backwards: rising ramps only go up, falling ramps only
+ * go down, every ramp starts at start_duty and ends on end_duty.
+ *
+ * make && ./pwm_ramp_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../pwm_ramp.h"
+
+#define NSEC_PER_USEC	1000LL
+#define NSEC_PER_MSEC	1000000LL
+
+static const int curves[] = { PWM_RAMP_LINEAR, PWM_RAMP_GAMMA, PWM_RAMP_EXP };
+#define CURVE_CNT	(int)(sizeof(curves) / sizeof(curves[0]))
+
+static int failures;
+
+#define CHECK(cond, ...) do {						\
+	if (!(cond)) {							\
+		printf("FAIL %s:%d: ", __func__, __LINE__);		\
+		printf(__VA_ARGS__);					\
+		printf("\n");						\
+		failures++;						\
+	}								\
+} while (0)
+
+/* every curve runs 0..4096 and never falls */
+static void test_curves(void)
+{
+	unsigned int t = 0, v = 0, prev = 0;
+	int c = 0;
+
+	for (c = 0; c < CURVE_CNT; c++) {
+		CHECK(pwm_ramp_curve(curves[c], 0) == 0, "curve %d starts at %u", curves[c], pwm_ramp_curve(curves[c], 0));
+		CHECK(pwm_ramp_curve(curves[c], 4096) == 4096, "curve %d ends at %u", curves[c], pwm_ramp_curve(curves[c], 4096));
+		prev = 0;
+		for (t = 0; t <= 4096; t++) {
+			v = pwm_ramp_curve(curves[c], t);
+			CHECK(v >= prev, "curve %d falls from %u to %u at t %u", curves[c], prev, v, t);
+			CHECK(v <= 4096, "curve %d reaches %u at t %u", curves[c], v, t);
+			prev = v;
+		}
+	}
+}
+
+/* duty over every position, rising and falling, up to the 1 s period limit */
+static void test_duty(void)
+{
+	static const int duties[] = { 0, 1, 2, 7, 100, 999, 4096, 40000, 1000000, 999999999, 1000000000 };
+	int n = sizeof(duties) / sizeof(duties[0]);
+	int i = 0, j = 0, c = 0, d = 0, prev = 0;
+	unsigned int t = 0;
+
+	for (c = 0; c < CURVE_CNT; c++) {
+		for (i = 0; i < n; i++) {
+			for (j = 0; j < n; j++) {
+				prev = pwm_ramp_duty(duties[i], duties[j], curves[c], 0);
+				CHECK(prev == duties[i], "%d..%d curve %d starts at %d",
+				      duties[i], duties[j], curves[c], prev);
+				for (t = 1; t <= 4096; t++) {
+					d = pwm_ramp_duty(duties[i], duties[j], curves[c], t);
+					if (duties[j] >= duties[i])
+						CHECK(d >= prev && d <= duties[j], "%d..%d curve %d: %d after %d at t %u",
+						      duties[i], duties[j], curves[c], d, prev, t);
+					else
+						CHECK(d <= prev && d >= duties[j], "%d..%d curve %d: %d after %d at t %u",
+						      duties[i], duties[j], curves[c], d, prev, t);
+					prev = d;
+				}
+				CHECK(prev == duties[j], "%d..%d curve %d ends at %d",
+				      duties[i], duties[j], curves[c], prev);
+			}
+		}
+	}
+}
+
+/*
+ * pwm_ramp_timer: the first expiry is right at the start, then one every
+ * step_us, each late by up to late_us. Returns the number of expiries.
+ */
+static unsigned int run_ramp(int from, int to, int curve, int duration_ms,
+			     unsigned int step_us, unsigned int late_us)
+{
+	s64 ramp_ns = (s64)duration_ms * NSEC_PER_MSEC;
+	s64 now = 0, expires = 0;
+	unsigned int t = 0, expiries = 0;
+	int duty = -1, prev = from;
+
+	do {
+		now = expires + (late_us ? (s64)(rand() % late_us) * NSEC_PER_USEC : 0);
+		t = pwm_ramp_pos(now, ramp_ns);
+		duty = pwm_ramp_duty(from, to, curve, t);
+		if (now == 0 && ramp_ns > 0)
+			CHECK(duty == from, "%d..%d in %d ms started at %d", from, to, duration_ms, duty);
+		if (to >= from)
+			CHECK(duty >= prev, "%d..%d in %d ms went down from %d to %d",
+			      from, to, duration_ms, prev, duty);
+		else
+			CHECK(duty <= prev, "%d..%d in %d ms went up from %d to %d",
+			      from, to, duration_ms, prev, duty);
+		prev = duty;
+		expiries++;
+		/* hrtimer_forward_now: the next expiry after now, on the step grid */
+		while (expires <= now)
+			expires += (s64)step_us * NSEC_PER_USEC;
+	} while (t < 4096 && expiries < 10000000);
+
+	CHECK(duty == to, "%d..%d in %d ms ended at %d", from, to, duration_ms, duty);
+	return expiries;
+}
+
+/* a ramp of d ms at the default 5 ms step takes d / 5 + 1 expiries */
+static void test_timer(void)
+{
+	unsigned int n = 0;
+
+	n = run_ramp(0, 1000000, PWM_RAMP_LINEAR, 0, 5000, 0);
+	CHECK(n == 1, "a 0 ms ramp took %u expiries", n);
+	n = run_ramp(0, 1000000, PWM_RAMP_GAMMA, 1000, 5000, 0);
+	CHECK(n == 201, "a 1 s ramp took %u expiries", n);
+	n = run_ramp(1000000, 0, PWM_RAMP_EXP, 1002, 5000, 0);
+	CHECK(n == 202, "a 1002 ms ramp took %u expiries", n);
+}
+
+/* random ramps with late expiries */
+static void test_random(void)
+{
+	unsigned int run = 0;
+	int period = 0;
+
+	srand(4046);
+	for (run = 0; run < 20000; run++) {
+		period = 200 + rand() % 1000000;
+		run_ramp(rand() % (period + 1), rand() % (period + 1), curves[rand() % CURVE_CNT],
+			 rand() % 3000, 100 + rand() % 20000, rand() % 4 ? rand() % 5000 : 0);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	test_curves();
+	test_duty();
+	test_timer();
+	test_random();
+
+	if (failures) {
+		printf("%d check(s) failed\n", failures);
+		return 1;
+	}
+	printf("pwm ramp: all checks passed\n");
+	return 0;
+}
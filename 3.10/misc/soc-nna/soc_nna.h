@@ -19,6 +19,21 @@
 #define IOCTL_SOC_NNA_RDCH_START    _IOWR(SOC_NNA_MAGIC, 4, int)
 #define IOCTL_SOC_NNA_WRCH_START    _IOWR(SOC_NNA_MAGIC, 5, int)
 #define IOCTL_SOC_NNA_VERSION    	_IOWR(SOC_NNA_MAGIC, 6, int)
+#define IOCTL_SOC_NNA_WAIT          _IOWR(SOC_NNA_MAGIC, 7, int)
+#define IOCTL_SOC_NNA_DES_INVALIDATE _IO(SOC_NNA_MAGIC, 8)
+#define IOCTL_SOC_NNA_SUBMIT        _IOWR(SOC_NNA_MAGIC, 9, int)
+#define IOCTL_SOC_NNA_WAIT_FENCE    _IOWR(SOC_NNA_MAGIC, 10, int)
+#define IOCTL_SOC_NNA_FLUSHCACHE_BATCH _IOWR(SOC_NNA_MAGIC, 11, int)
+#define IOCTL_SOC_NNA_ORAM_ALLOC    _IOWR(SOC_NNA_MAGIC, 12, int)
+#define IOCTL_SOC_NNA_ORAM_FREE     _IOWR(SOC_NNA_MAGIC, 13, int)
+#define IOCTL_SOC_NNA_JOB_PROF      _IOWR(SOC_NNA_MAGIC, 14, int)
+
+/* dma channels, chn_mask bits are (1 << SOC_NNA_CHN_xx) */
+#define SOC_NNA_CHN_RD              0
+#define SOC_NNA_CHN_WR              1
+#define SOC_NNA_CHN_CNT             2
+/* soc_nna_event_t.chn of a finished IOCTL_SOC_NNA_SUBMIT job */
+#define SOC_NNA_EVENT_JOB           SOC_NNA_CHN_CNT
 
 /*
  * dir value defined in  enum dma_data_direction in linux/dma-direction.h
@@ -30,6 +45,86 @@ struct flush_cache_info {
 	unsigned int	dir;
 };
 
+/*
+ * read() on the device returns one record per finished channel started
+ * from this file, poll() reports POLLIN while records are pending.
+ */
+typedef struct soc_nna_event {
+    unsigned int    chn;
+    unsigned int    seq;            /* completions of chn since probe */
+} soc_nna_event_t;
+
+/*
+ * IOCTL_SOC_NNA_ORAM_ALLOC/FREE: page aligned ORAM regions owned by the
+ * file. Once any region exists, ORAM can only be mmapped inside the
+ * regions of the calling file; allocation fails with -EBUSY while an
+ * unpartitioned ORAM mapping is alive, and freeing a region fails with
+ * -EBUSY while it is still mapped.
+ */
+typedef struct soc_nna_oram {
+    unsigned int    paddr;
+    unsigned int    size;
+} soc_nna_oram_t;
+
+/* IOCTL_SOC_NNA_WAIT: sleep until every channel in chn_mask is idle */
+typedef struct soc_nna_wait {
+    unsigned int    chn_mask;
+    unsigned int    timeout_ms;     /* 0 waits forever */
+} soc_nna_wait_t;
+
+/*
+ * IOCTL_SOC_NNA_SUBMIT: queue the read and write chains starting at the
+ * given descriptor indexes (as for RDCH_START/WRCH_START). Jobs run in
+ * submission order, the next one is started from the completion of the
+ * previous one. dep_seq, when not 0, must be the fence of an already
+ * submitted job. The fence of the new job is returned in seq. The chains
+ * are not copied: while jobs are queued SETUP_DES writes the half of the
+ * desram their chains leave free (or the room left in it) and fails with
+ * -EBUSY when no chain fits. SUBMIT fails with -EBUSY when the chains lie
+ * in the range SETUP_DES is rewriting.
+ */
+typedef struct soc_nna_job {
+    unsigned int    rd_des_addr;
+    unsigned int    wr_des_addr;
+    unsigned int    dep_seq;
+    unsigned int    seq;
+} soc_nna_job_t;
+
+/* IOCTL_SOC_NNA_WAIT_FENCE: sleep until job seq is done */
+typedef struct soc_nna_fence {
+    unsigned int    seq;
+    unsigned int    timeout_ms;     /* 0 waits forever */
+} soc_nna_fence_t;
+
+/*
+ * IOCTL_SOC_NNA_JOB_PROF: profile of one of the last SOC_NNA_PROF_CNT
+ * finished jobs, selected by seq. Times are ktime_get() in ns, the end of
+ * a chain is seen by the dma status poll. Returns -ENOENT while the job
+ * is pending or after its record was reused.
+ */
+#define SOC_NNA_PROF_CNT            32
+typedef struct soc_nna_job_prof {
+    unsigned int        seq;
+    unsigned int        rd_bytes;       /* total_bytes of the chains */
+    unsigned int        wr_bytes;
+    unsigned int        reserved;
+    unsigned long long  submit_ns;
+    unsigned long long  rd_start_ns;
+    unsigned long long  rd_end_ns;
+    unsigned long long  wr_start_ns;
+    unsigned long long  wr_end_ns;
+} soc_nna_job_prof_t;
+
+/*
+ * IOCTL_SOC_NNA_FLUSHCACHE_BATCH: count ranges at info, overlapping or
+ * adjacent ones are merged. A range that wraps fails with -EINVAL.
+ */
+#define SOC_NNA_FLUSH_BATCH_MAX     256
+struct flush_cache_batch {
+	unsigned int            count;
+	struct flush_cache_info *info;
+};
+
 struct soc_nna_buf {
     void        *vaddr;
     void        *paddr;
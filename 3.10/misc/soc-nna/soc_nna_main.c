@@ -5,10 +5,22 @@
 #include <linux/syscalls.h>
 #include <linux/slab.h>
 #include <linux/dma-mapping.h>
+#include <linux/interrupt.h>
+#include <linux/bitmap.h>
+#include <linux/hrtimer.h>
+#include <linux/jhash.h>
+#include <linux/kfifo.h>
+#include <linux/poll.h>
+#include <linux/math64.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/sort.h>
+#include <linux/wait.h>
 
 
 #include <linux/fs.h>
 #include <linux/uaccess.h>
+#include <jz_proc.h>
 
 #include "soc_nna_common.h"
 
@@ -28,6 +40,46 @@ static int nna_clk = 200000000;
 module_param(nna_clk, int, S_IRUGO);
 MODULE_PARM_DESC(nna_clk, "nna clock");
 
+/*
+ * Channel completion is polled from a hrtimer while any channel is busy.
+ * The dma done irq is not used, how to ack it is not known, so on a level
+ * triggered line the handler would never return the line to idle.
+ */
+#define SOC_NNA_POLL_MIN_US     20
+#define SOC_NNA_POLL_MAX_US     10000
+static unsigned int nna_poll_us = 100;
+module_param(nna_poll_us, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(nna_poll_us, "dma status poll period, clamped to 20..10000");
+
+/*
+ * Descriptor chains generated by IOCTL_SOC_NNA_SETUP_DES are kept for
+ * the last nna_des_cache_cnt command sets, so running the same network
+ * again only costs a hash and a compare of the commands. Entries are
+ * matched on the physical addresses the caller's commands resolve to, so
+ * another process or a remapped buffer never reuses a chain built for
+ * other memory.
+ */
+static int nna_des_cache_cnt = 8;
+module_param(nna_des_cache_cnt, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(nna_des_cache_cnt, "cached descriptor chains, 0 to disable");
+
+/*
+ * IOCTL_SOC_NNA_MALLOC carves page aligned buffers out of a few large
+ * coherent regions owned by the calling file instead of allocating each
+ * buffer on its own. The regions are given back when the file is closed.
+ */
+static int nna_arena_size = 0x200000;
+module_param(nna_arena_size, int, S_IRUGO);
+MODULE_PARM_DESC(nna_arena_size, "per process nna memory region, 0 allocates every buffer separately");
+
+/* 0 uses the L1 dcache size, as the mips dma cache ops do for one range */
+
+#define SOC_NNA_EVENT_CNT           16
+#define SOC_NNA_JOB_MAX             64
+#define SOC_NNA_DRAIN_TIMEOUT_MS    5000
+/* while jobs are queued SETUP_DES writes one half of the desram */
+#define SOC_NNA_DES_BANK            (SOC_NNA_MAX_DES_CHN_CNT / 2)
+
 static uint32_t  num_all = 0;
 struct buf{
 	uint32_t version_buf;
@@ -54,6 +106,20 @@ do {                                \
     );                              \
 } while(0)
 
+struct soc_nna_stats {
+    ktime_t         reset;
+    ktime_t         busy_start;
+    ktime_t         chn_start[SOC_NNA_CHN_CNT];
+    unsigned int    chn_cur_bytes[SOC_NNA_CHN_CNT];
+    u64             busy_ns;                /* any channel running */
+    u64             chn_ns[SOC_NNA_CHN_CNT];
+    u64             chn_bytes[SOC_NNA_CHN_CNT];
+    unsigned int    chn_runs[SOC_NNA_CHN_CNT];
+    unsigned int    jobs;
+    u64             job_ns;                 /* submit to done */
+    u64             job_max_ns;
+};
+
 struct soc_nna {
     char                name[16];
     struct miscdevice   mdev;       /* miscdevice */
@@ -70,6 +136,66 @@ struct soc_nna {
     struct kmem_cache   *memory_cache;
 
     nna_dma_des_info_t  des_info[2];
+
+    /* descriptor chain cache, protected by mlock */
+    struct list_head    des_cache;
+    int                 des_cache_num;
+    struct soc_nna_des_cache *des_loaded;       /* entry held by the desram */
+    unsigned int        des_loaded_base;        /* at this descriptor index */
+    unsigned long long  *des_scratch;
+
+    /* dma completion, protected by irq_lock */
+    spinlock_t          irq_lock;
+    wait_queue_head_t   done_wq;
+    struct hrtimer      poll_timer;
+    unsigned int        busy;
+    unsigned int        seq[SOC_NNA_CHN_CNT];
+    struct soc_nna_file *owner[SOC_NNA_CHN_CNT];
+
+    /* job queue, protected by irq_lock */
+    struct list_head    job_queue;
+    struct soc_nna_job_entry *job_cur;
+    unsigned int        job_cnt;
+    unsigned int        job_seq;                /* last submitted fence */
+    unsigned int        job_done;               /* last finished fence */
+    unsigned int        des_wr_lo;              /* desram range SETUP_DES is rewriting */
+    unsigned int        des_wr_hi;
+
+    /* dma profiling, protected by irq_lock */
+    struct soc_nna_stats stats;
+    soc_nna_job_prof_t  prof[SOC_NNA_PROF_CNT];
+
+    /* oram partitions, protected by mlock */
+    struct list_head    oram_list;
+    unsigned int        oram_size;
+    unsigned int        oram_pages;
+    unsigned long       *oram_bitmap;
+    atomic_t            oram_legacy_maps;
+    struct proc_dir_entry *proc;
+};
+
+struct soc_nna_oram_region {
+    struct list_head    list;
+    struct soc_nna_file *owner;
+    pid_t               tgid;
+    char                comm[TASK_COMM_LEN];
+    soc_nna_oram_t      oram;
+    atomic_t            maps;           /* live user mappings, ORAM_FREE is refused while set */
+};
+
+struct soc_nna_job_entry {
+    struct list_head    list;
+    struct soc_nna_file *owner;
+    soc_nna_job_t       job;
+    soc_nna_job_prof_t  prof;
+    unsigned int        des_lo;         /* desram range of its chains */
+    unsigned int        des_hi;
+};
+
+struct soc_nna_file {
+    struct soc_nna      *pnna;
+    struct list_head    arenas;         /* protected by pnna->mlock */
+    DECLARE_KFIFO(events, soc_nna_event_t, SOC_NNA_EVENT_CNT);
 };
 
 struct soc_nna_memory_cache {
@@ -77,13 +203,180 @@ struct soc_nna_memory_cache {
     struct soc_nna_buf  buf;
 };
 
+struct soc_nna_des_cache {
+    struct list_head    list;           /* most recently used first */
+    u32                 hash;
+    unsigned int        idx[4];         /* rd/wr cmd_st_idx and cmd_cnt */
+    nna_dma_cmd_t       *cmd;
+    unsigned int        cmd_cnt;
+    u32                 *pa;            /* 3 per cmd, see soc_nna_des_cache_pa */
+    unsigned long long  *des;
+    unsigned int        des_cnt;
+    unsigned int        des_cap;        /* desram room it was generated for */
+    unsigned int        *chn;           /* relative to the start of des */
+    des_gen_result_t    des_rslt;
+};
+
+struct soc_nna_arena {
+    struct list_head    list;
+    void                *vaddr;
+    dma_addr_t          paddr;
+    unsigned int        size;
+    unsigned int        pages;
+    unsigned int        used;
+    unsigned long       *bitmap;
+    unsigned int        *len;           /* pages of the buffer starting at a page */
+};
+
+static void soc_nna_des_cache_invalidate(struct soc_nna *pnna);
+static bool soc_nna_idle(struct soc_nna *pnna, unsigned int chn_mask);
+static bool soc_nna_fence_done(struct soc_nna *pnna, unsigned int seq);
+static long soc_nna_oram_alloc(struct soc_nna *pnna, struct soc_nna_file *pf, long usr_arg);
+static long soc_nna_oram_free(struct soc_nna *pnna, struct soc_nna_file *pf, long usr_arg);
+static void soc_nna_oram_region_free(struct soc_nna *pnna, struct soc_nna_oram_region *region);
+
+static struct soc_nna_arena *soc_nna_arena_create(struct soc_nna *pnna, unsigned int size)
+{
+    struct soc_nna_arena *arena = NULL;
+    void *page = NULL;
+
+    arena = kzalloc(sizeof(struct soc_nna_arena), GFP_KERNEL);
+    if (!arena)
+        return NULL;
+
+    arena->size = PAGE_ALIGN(size);
+    arena->pages = arena->size >> PAGE_SHIFT;
+    arena->bitmap = kzalloc(BITS_TO_LONGS(arena->pages) * sizeof(unsigned long), GFP_KERNEL);
+    arena->len = kzalloc(arena->pages * sizeof(unsigned int), GFP_KERNEL);
+    if (!arena->bitmap || !arena->len)
+        goto err_kzalloc;
+
+    arena->vaddr = dma_alloc_coherent(pnna->mdev.this_device, arena->size, &arena->paddr, GFP_KERNEL);
+    if (!arena->vaddr) {
+        dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:dma_alloc_coherent failed, size=0x%x\n", __func__, __LINE__, current->tgid, current->pid, arena->size);
+        goto err_dma_alloc_coherent;
+    }
+
+    for (page = arena->vaddr; page < arena->vaddr + arena->size; page += PAGE_SIZE)
+        SetPageReserved(virt_to_page(page));
+
+    dev_info(pnna->mdev.this_device, "%s(%d) [%d:%d]:arena vaddr=%p, paddr=0x%x, size=0x%x\n", __func__, __LINE__, current->tgid, current->pid, arena->vaddr, arena->paddr, arena->size);
+
+    return arena;
+
+err_dma_alloc_coherent:
+err_kzalloc:
+    kfree(arena->len);
+    kfree(arena->bitmap);
+    kfree(arena);
+    return NULL;
+}
+
+static void soc_nna_arena_destroy(struct soc_nna *pnna, struct soc_nna_arena *arena)
+{
+    void *page = NULL;
+
+    for (page = arena->vaddr; page < arena->vaddr + arena->size; page += PAGE_SIZE)
+        ClearPageReserved(virt_to_page(page));
+    dma_free_coherent(pnna->mdev.this_device, arena->size, arena->vaddr, arena->paddr);
+    kfree(arena->len);
+    kfree(arena->bitmap);
+    kfree(arena);
+}
+
+static long soc_nna_arena_alloc(struct soc_nna *pnna, struct soc_nna_file *pf, struct soc_nna_buf *buf)
+{
+    struct soc_nna_arena *arena = NULL;
+    unsigned int pages = 0, start = 0;
+
+    if (buf->size <= 0)
+        return -EINVAL;
+    pages = PAGE_ALIGN(buf->size) >> PAGE_SHIFT;
+
+    mutex_lock(&pnna->mlock);
+    list_for_each_entry(arena, &pf->arenas, list) {
+        if (arena->pages - arena->used < pages)
+            continue;
+        start = bitmap_find_next_zero_area(arena->bitmap, arena->pages, 0, pages, 0);
+        if (start < arena->pages)
+            goto found;
+    }
+
+    arena = soc_nna_arena_create(pnna, max_t(unsigned int, nna_arena_size, pages << PAGE_SHIFT));
+    if (!arena) {
+        mutex_unlock(&pnna->mlock);
+        return -ENOMEM;
+    }
+    list_add_tail(&arena->list, &pf->arenas);
+    start = 0;
+
+found:
+    bitmap_set(arena->bitmap, start, pages);
+    arena->len[start] = pages;
+    arena->used += pages;
+    mutex_unlock(&pnna->mlock);
+
+    buf->size = pages << PAGE_SHIFT;
+    buf->vaddr = arena->vaddr + (start << PAGE_SHIFT);
+    buf->paddr = (void *)(arena->paddr + (start << PAGE_SHIFT));
+
+    return 0;
+}
+
+/* returns -ENOENT when buf was not carved out of an arena of this file */
+static long soc_nna_arena_free(struct soc_nna *pnna, struct soc_nna_file *pf, struct soc_nna_buf *buf)
+{
+    struct soc_nna_arena *arena = NULL;
+    dma_addr_t paddr = (dma_addr_t)buf->paddr;
+    unsigned int start = 0;
+    long ret = -ENOENT;
+
+    mutex_lock(&pnna->mlock);
+    list_for_each_entry(arena, &pf->arenas, list) {
+        if (paddr < arena->paddr || paddr >= arena->paddr + arena->size)
+            continue;
+
+        start = (paddr - arena->paddr) >> PAGE_SHIFT;
+        if ((paddr & ~PAGE_MASK) || !arena->len[start] || buf->vaddr != arena->vaddr + (start << PAGE_SHIFT)) {
+            ret = -EINVAL;
+            break;
+        }
+
+        bitmap_clear(arena->bitmap, start, arena->len[start]);
+        arena->used -= arena->len[start];
+        arena->len[start] = 0;
+        /* cached chains may point into the freed pages */
+        soc_nna_des_cache_invalidate(pnna);
+
+        /* keep the first region for the next model, give back the overflow ones */
+        if (!arena->used && arena != list_first_entry(&pf->arenas, struct soc_nna_arena, list)) {
+            list_del(&arena->list);
+            soc_nna_arena_destroy(pnna, arena);
+        }
+        ret = 0;
+        break;
+    }
+    mutex_unlock(&pnna->mlock);
+
+    return ret;
+}
+
 int soc_nna_open(struct inode *inode, struct file *file)
 {
     struct miscdevice *mdev = file->private_data;
     struct soc_nna *pnna = list_entry(mdev, struct soc_nna, mdev);
+    struct soc_nna_file *pf = NULL;
     bool b_first_open = false;
 	unsigned int cp0_status = 0;
 
+    pf = kzalloc(sizeof(struct soc_nna_file), GFP_KERNEL);
+    if (!pf)
+        return -ENOMEM;
+    pf->pnna = pnna;
+    INIT_LIST_HEAD(&pf->arenas);
+    INIT_KFIFO(pf->events);
+    file->private_data = pf;
+
 	mutex_lock(&pnna->mlock);
 #ifdef CONFIG_SOC_T41
 	__asm__ volatile(
@@ -131,9 +424,69 @@ int soc_nna_open(struct inode *inode, struct file *file)
 
 int soc_nna_release(struct inode *inode, struct file *file)
 {
-    struct miscdevice *mdev = file->private_data;
-    struct soc_nna *pnna = list_entry(mdev, struct soc_nna, mdev);
-    bool b_last_release = false;
+    struct soc_nna_file *pf = file->private_data;
+    struct soc_nna *pnna = pf->pnna;
+    struct soc_nna_job_entry *job = NULL;
+    struct soc_nna_oram_region *region = NULL, *rnext = NULL;
+    bool b_last_release = false, has_job = false, drained = true;
+    unsigned int chn_mask = 0, last_seq = 0;
+    unsigned long flags;
+    int chn = 0;
+
+    spin_lock_irqsave(&pnna->irq_lock, flags);
+    for (chn = 0; chn < SOC_NNA_CHN_CNT; chn++) {
+        if (pnna->owner[chn] == pf) {
+            pnna->owner[chn] = NULL;
+            chn_mask |= pnna->busy & (1 << chn);
+        }
+    }
+    /* queued jobs still run, others may depend on their fences */
+    if (pnna->job_cur && pnna->job_cur->owner == pf) {
+        pnna->job_cur->owner = NULL;
+        last_seq = pnna->job_cur->job.seq;
+        has_job = true;
+    }
+    list_for_each_entry(job, &pnna->job_queue, list) {
+        if (job->owner == pf) {
+            job->owner = NULL;
+            last_seq = job->job.seq;
+            has_job = true;
+        }
+    }
+    spin_unlock_irqrestore(&pnna->irq_lock, flags);
+
+    /* the dma may still read or write the arenas and oram of this file */
+    if ((has_job || chn_mask) &&
+        !wait_event_timeout(pnna->done_wq, (!has_job || soc_nna_fence_done(pnna, last_seq)) && soc_nna_idle(pnna, chn_mask),
+                            msecs_to_jiffies(SOC_NNA_DRAIN_TIMEOUT_MS))) {
+        /* leaking is safer than handing out memory the dma still writes */
+        dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]: dma did not drain, leaking nna memory\n", __func__, __LINE__, current->tgid, current->pid);
+        INIT_LIST_HEAD(&pf->arenas);
+        drained = false;
+    }
+
+    if (!list_empty(&pf->arenas)) {
+        struct soc_nna_arena *arena = NULL, *next = NULL;
+        mutex_lock(&pnna->mlock);
+        list_for_each_entry_safe(arena, next, &pf->arenas, list) {
+            list_del(&arena->list);
+            soc_nna_arena_destroy(pnna, arena);
+        }
+        soc_nna_des_cache_invalidate(pnna);
+        mutex_unlock(&pnna->mlock);
+    }
+    mutex_lock(&pnna->mlock);
+    /* the mappings of the regions held a reference on file, they are gone */
+    list_for_each_entry_safe(region, rnext, &pnna->oram_list, list) {
+        if (region->owner != pf)
+            continue;
+        if (drained)
+            soc_nna_oram_region_free(pnna, region);
+        else
+            region->owner = NULL;
+    }
+    mutex_unlock(&pnna->mlock);
+    kfree(pf);
 
     mutex_lock(&pnna->mlock);
     if ((pnna->refcnt > 0) && (--pnna->refcnt == 0)) {
@@ -151,6 +504,7 @@ int soc_nna_release(struct inode *inode, struct file *file)
             dma_free_coherent(pnna->mdev.this_device, pelem->buf.size, pelem->buf.vaddr, (dma_addr_t)pelem->buf.paddr);
             kmem_cache_free(pnna->memory_cache, pelem);
         }
+        soc_nna_des_cache_invalidate(pnna);
         mutex_unlock(&pnna->mlock);
 #ifndef CPU_SIMULATOR
         clk_disable(pnna->clk);
@@ -169,12 +523,368 @@ static loff_t soc_nna_llseek(struct file *file, loff_t offset, int origin)
     return 0;
 }
 
-static ssize_t soc_nna_read(struct file *file, char *buf, size_t size, loff_t *offset)
+/* total_bytes from the DES_CFG_CNT descriptor heading the chain at des_idx */
+static unsigned int soc_nna_chain_bytes(struct soc_nna *pnna, unsigned int des_idx)
 {
-    //TODO
+    unsigned long long des = *((volatile unsigned long long *)pnna->dmamem + des_idx);
+
+    if (((des & DES_CFG_FLAG_MASK) >> DES_CFG_FLAG) != DES_CFG_CNT)
+        return 0;
+
+    return (des & DES_TOTAL_BYTES_MASK) >> DES_TOTAL_BYTES;
+}
+
+/* called with irq_lock held */
+static void __soc_nna_chn_start(struct soc_nna *pnna, struct soc_nna_file *pf, int chn, unsigned int value)
+{
+    static const unsigned int cfg_reg[SOC_NNA_CHN_CNT] = { NNA_DMA_RCFG, NNA_DMA_WCFG };
+    struct soc_nna_stats *stats = &pnna->stats;
+    ktime_t now = ktime_get();
+
+    if (!pnna->busy)
+        stats->busy_start = now;
+    stats->chn_start[chn] = now;
+    /* RCFG and WCFG share the layout */
+    stats->chn_cur_bytes[chn] = soc_nna_chain_bytes(pnna, (value & RCFG_DES_ADDR_MASK) >> RCFG_DES_ADDR);
+
+    pnna->busy |= 1 << chn;
+    pnna->owner[chn] = pf;
+    soc_nna_writel(pnna, cfg_reg[chn], value);
+}
+
+/* called with irq_lock held, starts the next queued job once the dma is idle */
+static void __soc_nna_job_kick(struct soc_nna *pnna)
+{
+    struct soc_nna_job_entry *job = NULL;
+
+    if (pnna->job_cur || pnna->busy || list_empty(&pnna->job_queue))
+        return;
+
+    job = list_first_entry(&pnna->job_queue, struct soc_nna_job_entry, list);
+    list_del(&job->list);
+    pnna->job_cur = job;
+
+    __soc_nna_chn_start(pnna, NULL, SOC_NNA_CHN_RD, ((job->job.rd_des_addr << RCFG_DES_ADDR) & RCFG_DES_ADDR_MASK) | (1 << RCFG_START));
+    __soc_nna_chn_start(pnna, NULL, SOC_NNA_CHN_WR, ((job->job.wr_des_addr << WCFG_DES_ADDR) & WCFG_DES_ADDR_MASK) | (1 << WCFG_START));
+
+    job->prof.rd_start_ns = ktime_to_ns(pnna->stats.chn_start[SOC_NNA_CHN_RD]);
+    job->prof.wr_start_ns = ktime_to_ns(pnna->stats.chn_start[SOC_NNA_CHN_WR]);
+    job->prof.rd_bytes = pnna->stats.chn_cur_bytes[SOC_NNA_CHN_RD];
+    job->prof.wr_bytes = pnna->stats.chn_cur_bytes[SOC_NNA_CHN_WR];
+}
+
+/* called from the poll timer */
+static void soc_nna_check_done(struct soc_nna *pnna)
+{
+    static const unsigned int cfg_reg[SOC_NNA_CHN_CNT] = { NNA_DMA_RCFG, NNA_DMA_WCFG };
+    struct soc_nna_stats *stats = &pnna->stats;
+    struct soc_nna_job_entry *job = NULL;
+    soc_nna_event_t event;
+    unsigned long flags;
+    ktime_t now = ktime_get();
+    bool wake = false;
+    int chn = 0;
+    u64 ns = 0;
+
+    spin_lock_irqsave(&pnna->irq_lock, flags);
+    for (chn = 0; chn < SOC_NNA_CHN_CNT; chn++) {
+        if (!(pnna->busy & (1 << chn)))
+            continue;
+        /* the start bit is cleared by hardware once the chain is done */
+        if (soc_nna_readl(pnna, cfg_reg[chn]) & (1 << RCFG_START))
+            continue;
+
+        pnna->busy &= ~(1 << chn);
+        if (!pnna->busy)
+            stats->busy_ns += ktime_to_ns(ktime_sub(now, stats->busy_start));
+        stats->chn_ns[chn] += ktime_to_ns(ktime_sub(now, stats->chn_start[chn]));
+        stats->chn_bytes[chn] += stats->chn_cur_bytes[chn];
+        stats->chn_runs[chn]++;
+        if (pnna->job_cur) {
+            if (chn == SOC_NNA_CHN_RD)
+                pnna->job_cur->prof.rd_end_ns = ktime_to_ns(now);
+            else
+                pnna->job_cur->prof.wr_end_ns = ktime_to_ns(now);
+        }
+        pnna->seq[chn]++;
+        if (pnna->owner[chn]) {
+            event.chn = chn;
+            event.seq = pnna->seq[chn];
+            kfifo_in(&pnna->owner[chn]->events, &event, 1);
+        }
+        wake = true;
+    }
+
+    if (pnna->job_cur && !pnna->busy) {
+        job = pnna->job_cur;
+        pnna->job_cur = NULL;
+        pnna->job_cnt--;
+        pnna->job_done = job->job.seq;
+        job->prof.seq = job->job.seq;
+        pnna->prof[job->job.seq % SOC_NNA_PROF_CNT] = job->prof;
+        ns = ktime_to_ns(now) - job->prof.submit_ns;
+        stats->jobs++;
+        stats->job_ns += ns;
+        if (ns > stats->job_max_ns)
+            stats->job_max_ns = ns;
+        if (job->owner) {
+            event.chn = SOC_NNA_EVENT_JOB;
+            event.seq = job->job.seq;
+            kfifo_in(&job->owner->events, &event, 1);
+        }
+    }
+    __soc_nna_job_kick(pnna);
+    spin_unlock_irqrestore(&pnna->irq_lock, flags);
+
+    kfree(job);
+    if (wake)
+        wake_up_all(&pnna->done_wq);
+}
+
+/* nna_poll_us is root writable at any time, keep it off a timer storm */
+static ktime_t soc_nna_poll_period(void)
+{
+    unsigned int us = clamp_t(unsigned int, ACCESS_ONCE(nna_poll_us),
+                              SOC_NNA_POLL_MIN_US, SOC_NNA_POLL_MAX_US);
+
+    return ns_to_ktime((u64)us * NSEC_PER_USEC);
+}
+
+static enum hrtimer_restart soc_nna_poll_timer(struct hrtimer *timer)
+{
+    struct soc_nna *pnna = container_of(timer, struct soc_nna, poll_timer);
+
+    soc_nna_check_done(pnna);
+    if (!ACCESS_ONCE(pnna->busy))
+        return HRTIMER_NORESTART;
+
+    hrtimer_forward_now(timer, soc_nna_poll_period());
+    return HRTIMER_RESTART;
+}
+
+static void soc_nna_poll_start(struct soc_nna *pnna)
+{
+    hrtimer_start(&pnna->poll_timer, soc_nna_poll_period(), HRTIMER_MODE_REL);
+}
+
+static long soc_nna_chn_start(struct soc_nna *pnna, struct soc_nna_file *pf, int chn, unsigned int value)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&pnna->irq_lock, flags);
+    /* the queue owns the channels while jobs are pending */
+    if (pnna->job_cnt) {
+        spin_unlock_irqrestore(&pnna->irq_lock, flags);
+        return -EBUSY;
+    }
+    __soc_nna_chn_start(pnna, pf, chn, value);
+    spin_unlock_irqrestore(&pnna->irq_lock, flags);
+
+    soc_nna_poll_start(pnna);
+
+    return 0;
+}
+
+/* end of the chain heading at des_idx, one past its DES_CFG_END descriptor */
+static unsigned int soc_nna_chain_end(struct soc_nna *pnna, unsigned int des_idx)
+{
+    volatile unsigned long long *des = (volatile unsigned long long *)pnna->dmamem;
+    unsigned int i = 0;
+
+    for (i = des_idx + 1; i < SOC_NNA_MAX_DES_CHN_CNT; i++)
+        if (((des[i] & DES_CFG_FLAG_MASK) >> DES_CFG_FLAG) == DES_CFG_END)
+            return i + 1;
+
+    return SOC_NNA_MAX_DES_CHN_CNT;
+}
+
+/* the desram the chains of job use, SETUP_DES leaves it alone until the job is done */
+static void soc_nna_job_range(struct soc_nna *pnna, struct soc_nna_job_entry *job)
+{
+    unsigned int rd = ((job->job.rd_des_addr << RCFG_DES_ADDR) & RCFG_DES_ADDR_MASK) >> RCFG_DES_ADDR;
+    unsigned int wr = ((job->job.wr_des_addr << WCFG_DES_ADDR) & WCFG_DES_ADDR_MASK) >> WCFG_DES_ADDR;
+
+    job->des_lo = min(rd, wr);
+    job->des_hi = max(soc_nna_chain_end(pnna, rd), soc_nna_chain_end(pnna, wr));
+}
+
+/* called with irq_lock held, lowers *end to the first desram in use by job from base on */
+static void __soc_nna_des_limit(struct soc_nna_job_entry *job, unsigned int base, unsigned int *end)
+{
+    if (job->des_hi <= base)
+        return;
+    *end = min(*end, max(job->des_lo, base));
+}
+
+/*
+ * called with irq_lock held. Picks where SETUP_DES writes: the whole
+ * desram when nothing is queued, otherwise the half with the most room
+ * left by the queued jobs. Returns the number of free descriptors at
+ * *base, 0 when both halves are in use.
+ */
+static unsigned int __soc_nna_des_place(struct soc_nna *pnna, unsigned int *base)
+{
+    static const unsigned int bases[] = { 0, SOC_NNA_DES_BANK };
+    struct soc_nna_job_entry *job = NULL;
+    unsigned int i = 0, end = 0, cap = 0;
+
+    for (i = 0; i < ARRAY_SIZE(bases); i++) {
+        end = SOC_NNA_MAX_DES_CHN_CNT;
+        if (pnna->job_cur)
+            __soc_nna_des_limit(pnna->job_cur, bases[i], &end);
+        list_for_each_entry(job, &pnna->job_queue, list)
+            __soc_nna_des_limit(job, bases[i], &end);
+        if (end - bases[i] > cap) {
+            cap = end - bases[i];
+            *base = bases[i];
+        }
+    }
+
+    return cap;
+}
+
+static long soc_nna_submit(struct soc_nna *pnna, struct soc_nna_file *pf, long usr_arg)
+{
+    struct soc_nna_job_entry *job = NULL;
+    unsigned long flags;
+    unsigned int seq = 0;
+    long ret = 0;
+
+    job = kzalloc(sizeof(struct soc_nna_job_entry), GFP_KERNEL);
+    if (!job)
+        return -ENOMEM;
+
+	if (copy_from_user(&job->job, (void *)usr_arg, sizeof(soc_nna_job_t))) {
+        dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_from_user failed\n", __func__, __LINE__, current->tgid, current->pid);
+        kfree(job);
+		return -EFAULT;
+	}
+    job->owner = pf;
+    job->prof.submit_ns = ktime_to_ns(ktime_get());
+    soc_nna_job_range(pnna, job);
+
+    spin_lock_irqsave(&pnna->irq_lock, flags);
+    if (job->job.dep_seq && (int)(job->job.dep_seq - pnna->job_seq) > 0) {
+        ret = -EINVAL;
+    } else if (pnna->job_cnt >= SOC_NNA_JOB_MAX ||
+               (job->des_lo < pnna->des_wr_hi && pnna->des_wr_lo < job->des_hi)) {
+        ret = -EBUSY;
+    } else {
+        /* 0 means no dependency, skip it on wrap */
+        seq = ++pnna->job_seq;
+        if (!seq)
+            seq = ++pnna->job_seq;
+        job->job.seq = seq;
+        pnna->job_cnt++;
+        list_add_tail(&job->list, &pnna->job_queue);
+        __soc_nna_job_kick(pnna);
+    }
+    spin_unlock_irqrestore(&pnna->irq_lock, flags);
+
+    if (ret) {
+        kfree(job);
+        return ret;
+    }
+    soc_nna_poll_start(pnna);
+
+    /* job may already be done and freed, only report its fence */
+    if (copy_to_user(&((soc_nna_job_t *)usr_arg)->seq, &seq, sizeof(unsigned int)))
+        return -EFAULT;
+
     return 0;
 }
 
+static bool soc_nna_idle(struct soc_nna *pnna, unsigned int chn_mask)
+{
+    unsigned long flags;
+    bool idle = false;
+
+    spin_lock_irqsave(&pnna->irq_lock, flags);
+    idle = !(pnna->busy & chn_mask);
+    spin_unlock_irqrestore(&pnna->irq_lock, flags);
+
+    return idle;
+}
+
+static bool soc_nna_fence_done(struct soc_nna *pnna, unsigned int seq)
+{
+    unsigned long flags;
+    bool done = false;
+
+    spin_lock_irqsave(&pnna->irq_lock, flags);
+    done = (int)(pnna->job_done - seq) >= 0;
+    spin_unlock_irqrestore(&pnna->irq_lock, flags);
+
+    return done;
+}
+
+static long soc_nna_job_prof(struct soc_nna *pnna, long usr_arg)
+{
+    soc_nna_job_prof_t prof;
+    unsigned long flags;
+    unsigned int seq = 0;
+
+	if (copy_from_user(&seq, &((soc_nna_job_prof_t *)usr_arg)->seq, sizeof(unsigned int))) {
+        dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_from_user failed\n", __func__, __LINE__, current->tgid, current->pid);
+		return -EFAULT;
+	}
+
+    spin_lock_irqsave(&pnna->irq_lock, flags);
+    prof = pnna->prof[seq % SOC_NNA_PROF_CNT];
+    spin_unlock_irqrestore(&pnna->irq_lock, flags);
+    if (!seq || prof.seq != seq)
+        return -ENOENT;
+
+    if (copy_to_user((void *)usr_arg, &prof, sizeof(soc_nna_job_prof_t)))
+        return -EFAULT;
+
+    return 0;
+}
+
+static bool soc_nna_has_event(struct soc_nna_file *pf)
+{
+    struct soc_nna *pnna = pf->pnna;
+    unsigned long flags;
+    bool ret = false;
+
+    spin_lock_irqsave(&pnna->irq_lock, flags);
+    ret = !kfifo_is_empty(&pf->events);
+    spin_unlock_irqrestore(&pnna->irq_lock, flags);
+
+    return ret;
+}
+
+static ssize_t soc_nna_read(struct file *file, char *buf, size_t size, loff_t *offset)
+{
+    struct soc_nna_file *pf = file->private_data;
+    struct soc_nna *pnna = pf->pnna;
+    soc_nna_event_t events[SOC_NNA_EVENT_CNT];
+    unsigned long flags;
+    unsigned int cnt = 0;
+    int ret = 0;
+
+    if (size < sizeof(soc_nna_event_t))
+        return -EINVAL;
+
+    if (file->f_flags & O_NONBLOCK) {
+        if (!soc_nna_has_event(pf))
+            return -EAGAIN;
+    } else {
+        ret = wait_event_interruptible(pnna->done_wq, soc_nna_has_event(pf));
+        if (ret)
+            return ret;
+    }
+
+    spin_lock_irqsave(&pnna->irq_lock, flags);
+    cnt = kfifo_out(&pf->events, events, min_t(size_t, size / sizeof(soc_nna_event_t), SOC_NNA_EVENT_CNT));
+    spin_unlock_irqrestore(&pnna->irq_lock, flags);
+
+    if (copy_to_user(buf, events, cnt * sizeof(soc_nna_event_t)))
+        return -EFAULT;
+
+    return cnt * sizeof(soc_nna_event_t);
+}
+
 static ssize_t soc_nna_write(struct file *file, const char *buf, size_t size, loff_t *offset)
 {
     //TODO
@@ -183,11 +893,56 @@ static ssize_t soc_nna_write(struct file *file, const char *buf, size_t size, lo
 
 static unsigned int soc_nna_poll(struct file *file, struct poll_table_struct *poll_table)
 {
-    //TODO
-    return 0;
+    struct soc_nna_file *pf = file->private_data;
+
+    poll_wait(file, &pf->pnna->done_wq, poll_table);
+
+    return soc_nna_has_event(pf) ? (POLLIN | POLLRDNORM) : 0;
+}
+
+static long soc_nna_wait(struct soc_nna *pnna, long usr_arg)
+{
+    soc_nna_wait_t wait;
+    unsigned int chn_mask = 0;
+    long ret = 0;
+
+	if (copy_from_user(&wait, (void *)usr_arg, sizeof(wait))) {
+        dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_from_user failed\n", __func__, __LINE__, current->tgid, current->pid);
+		return -EFAULT;
+	}
+
+    chn_mask = wait.chn_mask & ((1 << SOC_NNA_CHN_CNT) - 1);
+    if (!wait.timeout_ms)
+        return wait_event_interruptible(pnna->done_wq, soc_nna_idle(pnna, chn_mask));
+
+    ret = wait_event_interruptible_timeout(pnna->done_wq, soc_nna_idle(pnna, chn_mask), msecs_to_jiffies(wait.timeout_ms));
+    if (ret < 0)
+        return ret;
+
+    return ret ? 0 : -ETIMEDOUT;
+}
+
+static long soc_nna_wait_fence(struct soc_nna *pnna, long usr_arg)
+{
+    soc_nna_fence_t fence;
+    long ret = 0;
+
+	if (copy_from_user(&fence, (void *)usr_arg, sizeof(fence))) {
+        dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_from_user failed\n", __func__, __LINE__, current->tgid, current->pid);
+		return -EFAULT;
+	}
+
+    if (!fence.timeout_ms)
+        return wait_event_interruptible(pnna->done_wq, soc_nna_fence_done(pnna, fence.seq));
+
+    ret = wait_event_interruptible_timeout(pnna->done_wq, soc_nna_fence_done(pnna, fence.seq), msecs_to_jiffies(fence.timeout_ms));
+    if (ret < 0)
+        return ret;
+
+    return ret ? 0 : -ETIMEDOUT;
 }
 
-static long soc_nna_malloc(struct soc_nna *pnna, long usr_arg)
+static long soc_nna_malloc(struct soc_nna *pnna, struct soc_nna_file *pf, long usr_arg)
 {
     long ret = 0;
     struct soc_nna_buf buf;
@@ -212,6 +967,18 @@ static long soc_nna_malloc(struct soc_nna *pnna, long usr_arg)
         goto err_copy_from_user;
 	}
 
+    if (nna_arena_size > 0) {
+        ret = soc_nna_arena_alloc(pnna, pf, &buf);
+        if (ret)
+            return ret;
+        if (copy_to_user((void *)usr_arg, &buf, sizeof(buf))) {
+            dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_to_user failed\n", __func__, __LINE__, current->tgid, current->pid);
+            soc_nna_arena_free(pnna, pf, &buf);
+            return -EFAULT;
+        }
+        return 0;
+    }
+
     pelem = kmem_cache_alloc(pnna->memory_cache, GFP_ATOMIC);
     if (!pelem) {
         dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:kmem_cache_alloc failed\n", __func__, __LINE__, current->tgid, current->pid);
@@ -257,7 +1024,7 @@ err_copy_from_user:
     return ret;
 }
 
-static long soc_nna_free(struct soc_nna *pnna, long usr_arg)
+static long soc_nna_free(struct soc_nna *pnna, struct soc_nna_file *pf, long usr_arg)
 {
     long ret = -1;
     struct soc_nna_buf buf;
@@ -269,6 +1036,11 @@ static long soc_nna_free(struct soc_nna *pnna, long usr_arg)
 		return -EFAULT;
 	}
 
+    ret = soc_nna_arena_free(pnna, pf, &buf);
+    if (ret != -ENOENT)
+        return ret;
+    ret = -1;
+
     mutex_lock(&pnna->mlock);
 	list_for_each_safe(pos, n, &pnna->memory_list) {
 		pelem = list_entry(pos, struct soc_nna_memory_cache, list);
@@ -276,6 +1048,8 @@ static long soc_nna_free(struct soc_nna *pnna, long usr_arg)
             list_del(pos);
             dma_free_coherent(pnna->mdev.this_device, pelem->buf.size, pelem->buf.vaddr, (dma_addr_t)pelem->buf.paddr);
             kmem_cache_free(pnna->memory_cache, pelem);
+            /* cached chains may point into the freed pages */
+            soc_nna_des_cache_invalidate(pnna);
             dev_info(pnna->mdev.this_device, "%s(%d) [%d:%d]:free success, buf.vaddr=%p, buf.paddr=%p, buf.size=0x%x\n", __func__, __LINE__, current->tgid, current->pid, buf.vaddr, buf.paddr, buf.size);
             ret = 0;
             break;
@@ -309,6 +1083,72 @@ long soc_nna_flushcache(struct soc_nna *pnna, long usr_arg)
     return 0;
 }
 
+static int soc_nna_flush_cmp(const void *a, const void *b)
+{
+    const struct flush_cache_info *x = a, *y = b;
+
+    if (x->addr == y->addr)
+        return 0;
+    return x->addr < y->addr ? -1 : 1;
+}
+
+long soc_nna_flushcache_batch(struct soc_nna *pnna, long usr_arg)
+{
+    struct flush_cache_batch batch;
+    struct flush_cache_info *info = NULL;
+    unsigned int i = 0, n = 0;
+    u64 total = 0;
+    long ret = 0;
+
+	if (copy_from_user(&batch, (void *)usr_arg, sizeof(batch))) {
+        dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_from_user failed\n", __func__, __LINE__, current->tgid, current->pid);
+		return -EFAULT;
+	}
+    if (!batch.count || batch.count > SOC_NNA_FLUSH_BATCH_MAX)
+        return -EINVAL;
+
+    info = kmalloc(batch.count * sizeof(struct flush_cache_info), GFP_KERNEL);
+    if (!info)
+        return -ENOMEM;
+	if (copy_from_user(info, (void *)batch.info, batch.count * sizeof(struct flush_cache_info))) {
+        dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_from_user failed\n", __func__, __LINE__, current->tgid, current->pid);
+		ret = -EFAULT;
+        goto out;
+	}
+
+    /* merge overlapping and adjacent ranges, mixed directions become bidirectional */
+    sort(info, batch.count, sizeof(struct flush_cache_info), soc_nna_flush_cmp, NULL);
+    for (i = 0; i < batch.count; i++) {
+        if ((info[i].addr == 0) || (info[i].len == 0) || (info[i].addr + info[i].len < info[i].addr)) {
+            ret = -EINVAL;
+            goto out;
+        }
+        if (n && info[i].addr <= info[n - 1].addr + info[n - 1].len) {
+            info[n - 1].len = max(info[n - 1].addr + info[n - 1].len, info[i].addr + info[i].len) - info[n - 1].addr;
+            if (info[n - 1].dir != info[i].dir)
+                info[n - 1].dir = DMA_BIDIRECTIONAL;
+            continue;
+        }
+        info[n++] = info[i];
+    }
+
+    for (i = 0; i < n; i++)
+        total += info[i].len;
+    num_all += total;
+
+    /*
+     * __flush_cache_all() would skip the L2 writeback dma_cache_sync()
+     * does, and dma_cache_sync() already blasts the whole L1 for a range
+     * larger than it, so every range goes through it.
+     */
+    for (i = 0; i < n; i++)
+        dma_cache_sync(NULL, (void *)info[i].addr, info[i].len, info[i].dir);
+
+out:
+    kfree(info);
+    return ret;
+}
+
 static void soc_nna_analysis_des(struct soc_nna *pnna, unsigned int st_idx, unsigned int cmd_cnt, nna_dma_cmd_t *d_va_cmd, nna_dma_des_info_t *des_info)
 {
     int i = 0, j = 0;
@@ -372,13 +1212,17 @@ static void soc_nna_analysis_des(struct soc_nna *pnna, unsigned int st_idx, unsi
     }
 }
 
-static void soc_nna_update_des(struct soc_nna *pnna, unsigned int *d_va_chn, des_gen_result_t *des_rslt)
+/*
+ * fill vdma with the chains in des_info, at most cap descriptors. The
+ * chain indexes in d_va_chn are relative to vdma. Returns the number of
+ * descriptors used.
+ */
+static int soc_nna_update_des(struct soc_nna *pnna, unsigned long long int *vdma, unsigned int cap, unsigned int *d_va_chn, des_gen_result_t *des_rslt)
 {
     nna_dma_des_info_t *des_info = pnna->des_info;
-    int des_remain = 2048; //(16 * 1024) / sizeof(unsigned long long int);
+    int des_remain = cap;
     int chnidx = 0, desidx = 0, destotal_chain = 0, rdidx = 0, wridx = 0;
     int maxchnnum = des_info[0].chain_num > des_info[1].chain_num ? des_info[0].chain_num : des_info[1].chain_num;
-    unsigned long long int *vdma = (unsigned long long int *)pnna->dmamem;
     memset(des_rslt, 0, sizeof(des_gen_result_t));
 
     for (chnidx = 0; chnidx < maxchnnum; chnidx++) {
@@ -388,7 +1232,7 @@ static void soc_nna_update_des(struct soc_nna *pnna, unsigned int *d_va_chn, des
             des_rslt->wcmd_st_idx = des_info[1].chain_st_idx[chnidx];
             des_rslt->dma_chn_num = chnidx;
             des_rslt->finish = 0;
-            return;
+            return desidx;
         }
 
         /* rd chain */
@@ -412,6 +1256,126 @@ static void soc_nna_update_des(struct soc_nna *pnna, unsigned int *d_va_chn, des
 
     des_rslt->dma_chn_num = maxchnnum;
     des_rslt->finish = 1;
+
+    return desidx;
+}
+
+static void soc_nna_des_cache_free(struct soc_nna *pnna, struct soc_nna_des_cache *entry)
+{
+    list_del(&entry->list);
+    pnna->des_cache_num--;
+    if (pnna->des_loaded == entry)
+        pnna->des_loaded = NULL;
+    kfree(entry->cmd);
+    kfree(entry->pa);
+    kfree(entry->des);
+    kfree(entry->chn);
+    kfree(entry);
+}
+
+/* called with mlock held */
+static void soc_nna_des_cache_invalidate(struct soc_nna *pnna)
+{
+    struct soc_nna_des_cache *entry = NULL, *n = NULL;
+
+    list_for_each_entry_safe(entry, n, &pnna->des_cache, list)
+        soc_nna_des_cache_free(pnna, entry);
+    pnna->des_loaded = NULL;
+}
+
+/*
+ * Resolve the addresses of the commands soc_nna_analysis_des() reads, in
+ * the mm of the caller, skipped commands are left 0.
+ */
+static void soc_nna_des_cache_pa(unsigned int *idx, nna_dma_cmd_t *d_va_cmd, u32 *pa)
+{
+    nna_dma_cmd_t *pcmd = NULL;
+    unsigned int i = 0, base = 0, end = 0, k = 0;
+
+    memset(pa, 0, (idx[1] + idx[3]) * 3 * sizeof(u32));
+    for (k = 0; k < 2; k++) {
+        base = k ? idx[1] : 0;
+        end = idx[2 * k + 1];
+        for (i = idx[2 * k]; i < end; i++) {
+            pcmd = d_va_cmd + base + i;
+            NNADMA_VA_2_PA(pcmd->d_va_st_addr, pa[3 * (base + i)]);
+            NNADMA_VA_2_PA(pcmd->o_va_st_addr, pa[3 * (base + i) + 1]);
+            NNADMA_VA_2_PA(pcmd->o_va_mlc_addr, pa[3 * (base + i) + 2]);
+        }
+    }
+}
+
+/* called with mlock held */
+static struct soc_nna_des_cache *soc_nna_des_cache_find(struct soc_nna *pnna, u32 hash, unsigned int *idx, nna_dma_cmd_t *d_va_cmd, unsigned int cmd_cnt, u32 *pa,
+                                                       unsigned int cap)
+{
+    struct soc_nna_des_cache *entry = NULL;
+
+    list_for_each_entry(entry, &pnna->des_cache, list) {
+        if (entry->hash != hash || entry->cmd_cnt != cmd_cnt)
+            continue;
+        /* a partial result is only the same for the same room */
+        if (entry->des_cnt > cap || (!entry->des_rslt.finish && entry->des_cap != cap))
+            continue;
+        if (memcmp(entry->idx, idx, sizeof(entry->idx)))
+            continue;
+        if (memcmp(entry->cmd, d_va_cmd, cmd_cnt * sizeof(nna_dma_cmd_t)))
+            continue;
+        if (memcmp(entry->pa, pa, cmd_cnt * 3 * sizeof(u32)))
+            continue;
+        list_move(&entry->list, &pnna->des_cache);
+        return entry;
+    }
+
+    return NULL;
+}
+
+/* called with mlock held, takes pa, a failed insert only means the next setup is slow */
+static void soc_nna_des_cache_insert(struct soc_nna *pnna, u32 hash, unsigned int *idx, nna_dma_cmd_t *d_va_cmd, unsigned int cmd_cnt, u32 *pa,
+                                     unsigned int des_cnt, unsigned int cap, unsigned int *d_va_chn, des_gen_result_t *des_rslt)
+{
+    struct soc_nna_des_cache *entry = NULL;
+
+    while (pnna->des_cache_num >= nna_des_cache_cnt && !list_empty(&pnna->des_cache))
+        soc_nna_des_cache_free(pnna, list_entry(pnna->des_cache.prev, struct soc_nna_des_cache, list));
+
+    entry = kzalloc(sizeof(struct soc_nna_des_cache), GFP_KERNEL);
+    if (!entry) {
+        kfree(pa);
+        return;
+    }
+
+    entry->cmd = kmemdup(d_va_cmd, cmd_cnt * sizeof(nna_dma_cmd_t), GFP_KERNEL);
+    entry->des = kmemdup(pnna->des_scratch, des_cnt * sizeof(unsigned long long), GFP_KERNEL);
+    entry->chn = kmemdup(d_va_chn, 2 * des_rslt->dma_chn_num * sizeof(unsigned int), GFP_KERNEL);
+    if (!entry->cmd || !entry->des || !entry->chn) {
+        kfree(entry->cmd);
+        kfree(entry->des);
+        kfree(entry->chn);
+        kfree(entry);
+        kfree(pa);
+        return;
+    }
+
+    entry->pa = pa;
+    entry->hash = hash;
+    memcpy(entry->idx, idx, sizeof(entry->idx));
+    entry->cmd_cnt = cmd_cnt;
+    entry->des_cnt = des_cnt;
+    entry->des_cap = cap;
+    entry->des_rslt = *des_rslt;
+    list_add(&entry->list, &pnna->des_cache);
+    pnna->des_cache_num++;
+    pnna->des_loaded = entry;
+}
+
+static long soc_nna_des_invalidate(struct soc_nna *pnna)
+{
+    mutex_lock(&pnna->mlock);
+    soc_nna_des_cache_invalidate(pnna);
+    mutex_unlock(&pnna->mlock);
+
+    return 0;
 }
 
 long soc_nna_setup_des(struct soc_nna *pnna, long usr_arg)
@@ -421,6 +1385,11 @@ long soc_nna_setup_des(struct soc_nna *pnna, long usr_arg)
     nna_dma_cmd_t *d_va_cmd = NULL, *d_pa_cmd = NULL;
     unsigned int d_pa_chn = 0;
     unsigned int *d_va_chn = NULL;
+    struct soc_nna_des_cache *entry = NULL;
+    unsigned int idx[4], cmd_cnt = 0, des_cnt = 0, base = 0, cap = 0, i = 0;
+    unsigned long long *vdma = NULL;
+    u32 hash = 0, *pa = NULL;
+    unsigned long flags;
 
 	if (copy_from_user(&cmd_set, (void *)usr_arg, sizeof(nna_dma_cmd_set_t))) {
         dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_from_user failed\n", __func__, __LINE__, current->tgid, current->pid);
@@ -430,18 +1399,87 @@ long soc_nna_setup_des(struct soc_nna *pnna, long usr_arg)
 
     mutex_lock(&pnna->mlock);
 
+    /*
+     * queued jobs run chains already in the desram, write around them.
+     * SUBMIT of chains inside the range fails during the rewrite.
+     */
+    spin_lock_irqsave(&pnna->irq_lock, flags);
+    cap = __soc_nna_des_place(pnna, &base);
+    if (!cap) {
+        spin_unlock_irqrestore(&pnna->irq_lock, flags);
+        mutex_unlock(&pnna->mlock);
+        return -EBUSY;
+    }
+    pnna->des_wr_lo = base;
+    pnna->des_wr_hi = base + cap;
+    spin_unlock_irqrestore(&pnna->irq_lock, flags);
+    vdma = (unsigned long long *)pnna->dmamem + base;
+
     NNADMA_VA_2_PA((unsigned long)cmd_set.d_va_cmd, d_pa_cmd);      //convert user space vaddr to paddr
     d_va_cmd = phys_to_virt((unsigned long)d_pa_cmd);               //map paddr to kernel space vaddr to be used by kernel
 
     NNADMA_VA_2_PA((unsigned long)cmd_set.d_va_chn, d_pa_chn);      //convert user space vaddr to paddr
     d_va_chn = phys_to_virt((unsigned long)d_pa_chn);               //map paddr to kernel space vaddr to be used by kernel
 
-    soc_nna_analysis_des(pnna, cmd_set.rd_cmd_st_idx, cmd_set.rd_cmd_cnt, d_va_cmd, &(pnna->des_info[0]));
-    soc_nna_analysis_des(pnna, cmd_set.wr_cmd_st_idx, cmd_set.wr_cmd_cnt, d_va_cmd + cmd_set.rd_cmd_cnt, &(pnna->des_info[1]));
+    idx[0] = cmd_set.rd_cmd_st_idx;
+    idx[1] = cmd_set.rd_cmd_cnt;
+    idx[2] = cmd_set.wr_cmd_st_idx;
+    idx[3] = cmd_set.wr_cmd_cnt;
+    cmd_cnt = cmd_set.rd_cmd_cnt + cmd_set.wr_cmd_cnt;
+    /* every command takes a descriptor, larger sets do not fit the desram */
+    if (nna_des_cache_cnt > 0 && idx[1] <= SOC_NNA_MAX_DES_CHN_CNT && idx[3] <= SOC_NNA_MAX_DES_CHN_CNT)
+        pa = kmalloc(cmd_cnt * 3 * sizeof(u32), GFP_KERNEL);
+
+    if (!pa) {
+        soc_nna_analysis_des(pnna, cmd_set.rd_cmd_st_idx, cmd_set.rd_cmd_cnt, d_va_cmd, &(pnna->des_info[0]));
+        soc_nna_analysis_des(pnna, cmd_set.wr_cmd_st_idx, cmd_set.wr_cmd_cnt, d_va_cmd + cmd_set.rd_cmd_cnt, &(pnna->des_info[1]));
+        soc_nna_update_des(pnna, vdma, cap, d_va_chn, &cmd_set.des_rslt);
+        pnna->des_loaded = NULL;
+        goto rebase;
+    }
 
-    soc_nna_update_des(pnna, d_va_chn, &cmd_set.des_rslt);
+    soc_nna_des_cache_pa(idx, d_va_cmd, pa);
+    hash = jhash2((u32 *)d_va_cmd, cmd_cnt * sizeof(nna_dma_cmd_t) / sizeof(u32), jhash2(idx, 4, 0));
+    hash = jhash2(pa, cmd_cnt * 3, hash);
+
+    entry = soc_nna_des_cache_find(pnna, hash, idx, d_va_cmd, cmd_cnt, pa, cap);
+    if (entry) {
+        kfree(pa);
+        if (pnna->des_loaded != entry || pnna->des_loaded_base != base) {
+            memcpy(vdma, entry->des, entry->des_cnt * sizeof(unsigned long long));
+            pnna->des_loaded = entry;
+            pnna->des_loaded_base = base;
+        }
+        memcpy(d_va_chn, entry->chn, 2 * entry->des_rslt.dma_chn_num * sizeof(unsigned int));
+        cmd_set.des_rslt = entry->des_rslt;
+    } else {
+        soc_nna_analysis_des(pnna, cmd_set.rd_cmd_st_idx, cmd_set.rd_cmd_cnt, d_va_cmd, &(pnna->des_info[0]));
+        soc_nna_analysis_des(pnna, cmd_set.wr_cmd_st_idx, cmd_set.wr_cmd_cnt, d_va_cmd + cmd_set.rd_cmd_cnt, &(pnna->des_info[1]));
+        des_cnt = soc_nna_update_des(pnna, pnna->des_scratch, cap, d_va_chn, &cmd_set.des_rslt);
+        memcpy(vdma, pnna->des_scratch, des_cnt * sizeof(unsigned long long));
+        pnna->des_loaded = NULL;
+        pnna->des_loaded_base = base;
+        /* not even one chain fits next to the queued jobs, nothing worth keeping */
+        if (!cmd_set.des_rslt.dma_chn_num && !cmd_set.des_rslt.finish && cap < SOC_NNA_MAX_DES_CHN_CNT)
+            kfree(pa);
+        else
+            soc_nna_des_cache_insert(pnna, hash, idx, d_va_cmd, cmd_cnt, pa, des_cnt, cap, d_va_chn, &cmd_set.des_rslt);
+    }
+
+rebase:
+    /* the chains of a half are handed out with their desram index */
+    for (i = 0; i < 2 * cmd_set.des_rslt.dma_chn_num; i++)
+        d_va_chn[i] += base;
+
+    spin_lock_irqsave(&pnna->irq_lock, flags);
+    pnna->des_wr_lo = pnna->des_wr_hi = 0;
+    spin_unlock_irqrestore(&pnna->irq_lock, flags);
     mutex_unlock(&pnna->mlock);
 
+    /* try again once the queue has drained a little */
+    if (!cmd_set.des_rslt.dma_chn_num && !cmd_set.des_rslt.finish && cap < SOC_NNA_MAX_DES_CHN_CNT)
+        return -EBUSY;
+
 	if (copy_to_user((void *)usr_arg, &cmd_set, sizeof(nna_dma_cmd_set_t))) {
         dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_to_user failed\n", __func__, __LINE__, current->tgid, current->pid);
 		ret = -EFAULT;
@@ -455,7 +1493,7 @@ err_copy_from_user:
     return ret;
 }
 
-long soc_nna_rdchn_start(struct soc_nna *pnna, long usr_arg)
+long soc_nna_rdchn_start(struct soc_nna *pnna, struct soc_nna_file *pf, long usr_arg)
 {
     dma_addr_t dma_addr = 0;
 
@@ -464,12 +1502,10 @@ long soc_nna_rdchn_start(struct soc_nna *pnna, long usr_arg)
 		return -EFAULT;
 	}
 
-    soc_nna_writel(pnna, NNA_DMA_RCFG, ((dma_addr << RCFG_DES_ADDR) & RCFG_DES_ADDR_MASK) | (1 << RCFG_START));
-
-    return 0;
+    return soc_nna_chn_start(pnna, pf, SOC_NNA_CHN_RD, ((dma_addr << RCFG_DES_ADDR) & RCFG_DES_ADDR_MASK) | (1 << RCFG_START));
 }
 
-long soc_nna_wrchn_start(struct soc_nna *pnna, long usr_arg)
+long soc_nna_wrchn_start(struct soc_nna *pnna, struct soc_nna_file *pf, long usr_arg)
 {
     dma_addr_t dma_addr = 0;
 
@@ -478,9 +1514,7 @@ long soc_nna_wrchn_start(struct soc_nna *pnna, long usr_arg)
 		return -EFAULT;
 	}
 
-    soc_nna_writel(pnna, NNA_DMA_WCFG, ((dma_addr << WCFG_DES_ADDR) & WCFG_DES_ADDR_MASK) | (1 << WCFG_START));
-
-    return 0;
+    return soc_nna_chn_start(pnna, pf, SOC_NNA_CHN_WR, ((dma_addr << WCFG_DES_ADDR) & WCFG_DES_ADDR_MASK) | (1 << WCFG_START));
 }
 int soc_nna_version(struct soc_nna *pnna, long usr_arg)
 {
@@ -507,31 +1541,56 @@ int soc_nna_version(struct soc_nna *pnna, long usr_arg)
 static long soc_nna_unlocked_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
     long ret = -1;
-    struct miscdevice *mdev = file->private_data;
-    struct soc_nna *pnna = list_entry(mdev, struct soc_nna, mdev);
+    struct soc_nna_file *pf = file->private_data;
+    struct soc_nna *pnna = pf->pnna;
+    struct miscdevice *mdev = &pnna->mdev;
 
 	switch (cmd) {
         case IOCTL_SOC_NNA_MALLOC:
-            ret = soc_nna_malloc(pnna, arg);
+            ret = soc_nna_malloc(pnna, pf, arg);
             break;
         case IOCTL_SOC_NNA_FREE:
-            ret = soc_nna_free(pnna, arg);
+            ret = soc_nna_free(pnna, pf, arg);
             break;
         case IOCTL_SOC_NNA_FLUSHCACHE:
             ret = soc_nna_flushcache(pnna, arg);
             break;
+        case IOCTL_SOC_NNA_FLUSHCACHE_BATCH:
+            ret = soc_nna_flushcache_batch(pnna, arg);
+            break;
+        case IOCTL_SOC_NNA_ORAM_ALLOC:
+            ret = soc_nna_oram_alloc(pnna, pf, arg);
+            break;
+        case IOCTL_SOC_NNA_ORAM_FREE:
+            ret = soc_nna_oram_free(pnna, pf, arg);
+            break;
+        case IOCTL_SOC_NNA_JOB_PROF:
+            ret = soc_nna_job_prof(pnna, arg);
+            break;
         case IOCTL_SOC_NNA_SETUP_DES:
             ret = soc_nna_setup_des(pnna, arg);
             break;
         case IOCTL_SOC_NNA_RDCH_START:
-            ret = soc_nna_rdchn_start(pnna, arg);
+            ret = soc_nna_rdchn_start(pnna, pf, arg);
             break;
         case IOCTL_SOC_NNA_WRCH_START:
-            ret = soc_nna_wrchn_start(pnna, arg);
+            ret = soc_nna_wrchn_start(pnna, pf, arg);
 			break;
 		case IOCTL_SOC_NNA_VERSION:
 			ret = soc_nna_version(pnna, arg);
             break;
+        case IOCTL_SOC_NNA_WAIT:
+            ret = soc_nna_wait(pnna, arg);
+            break;
+        case IOCTL_SOC_NNA_DES_INVALIDATE:
+            ret = soc_nna_des_invalidate(pnna);
+            break;
+        case IOCTL_SOC_NNA_SUBMIT:
+            ret = soc_nna_submit(pnna, pf, arg);
+            break;
+        case IOCTL_SOC_NNA_WAIT_FENCE:
+            ret = soc_nna_wait_fence(pnna, arg);
+            break;
         default:
             dev_err(mdev->this_device, "%s(%d) [%d:%d]: unsupport cmd=0x%x\n", __func__, __LINE__, current->tgid, current->pid, cmd);
             return -1;
@@ -540,6 +1599,286 @@ static long soc_nna_unlocked_ioctl(struct file *file, unsigned int cmd, unsigned
     return ret;
 }
 
+#define SOC_NNA_ORAM_ADDR           0x12620000
+
+static unsigned int soc_nna_oram_size(void)
+{
+#ifdef CONFIG_SOC_T41
+	return 384 * 1024;//目前T41的oram_size 为 384 *1024
+#elif defined(CONFIG_SOC_T40)
+	/* l2cache_size + ORAM = 1*1024*1024 这里是获取l2cache size，根据l2cache size来得到ORAM size */
+	switch(((*((volatile unsigned int *)(0xb2200060))) & 0x1c00) >> 10)
+	{
+		case 1:
+			return (1024 - 128) * 1024;
+		case 2:
+			return (1024 - 256) * 1024;
+		case 3:
+			return (1024 - 512) * 1024;
+		case 4:
+			return (1024 - 1024) * 1024;
+		default:
+			return 0;
+	}
+#else
+	return 0;
+#endif
+}
+
+static long soc_nna_oram_alloc(struct soc_nna *pnna, struct soc_nna_file *pf, long usr_arg)
+{
+    struct soc_nna_oram_region *region = NULL;
+    unsigned int pages = 0, start = 0;
+    long ret = 0;
+
+    region = kzalloc(sizeof(struct soc_nna_oram_region), GFP_KERNEL);
+    if (!region)
+        return -ENOMEM;
+
+	if (copy_from_user(&region->oram, (void *)usr_arg, sizeof(soc_nna_oram_t))) {
+        dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_from_user failed\n", __func__, __LINE__, current->tgid, current->pid);
+        kfree(region);
+		return -EFAULT;
+	}
+    pages = PAGE_ALIGN(region->oram.size) >> PAGE_SHIFT;
+    if (!pages || pages > pnna->oram_pages) {
+        kfree(region);
+        return -EINVAL;
+    }
+
+    mutex_lock(&pnna->mlock);
+    if (atomic_read(&pnna->oram_legacy_maps)) {
+        ret = -EBUSY;
+        goto unlock;
+    }
+    start = bitmap_find_next_zero_area(pnna->oram_bitmap, pnna->oram_pages, 0, pages, 0);
+    if (start >= pnna->oram_pages) {
+        ret = -ENOMEM;
+        goto unlock;
+    }
+    bitmap_set(pnna->oram_bitmap, start, pages);
+
+    region->owner = pf;
+    region->tgid = current->tgid;
+    get_task_comm(region->comm, current);
+    region->oram.paddr = SOC_NNA_ORAM_ADDR + (start << PAGE_SHIFT);
+    region->oram.size = pages << PAGE_SHIFT;
+    list_add_tail(&region->list, &pnna->oram_list);
+unlock:
+    mutex_unlock(&pnna->mlock);
+
+    if (ret) {
+        kfree(region);
+        return ret;
+    }
+
+    if (copy_to_user((void *)usr_arg, &region->oram, sizeof(soc_nna_oram_t)))
+        return -EFAULT;
+
+    return 0;
+}
+
+/* called with mlock held */
+static void soc_nna_oram_region_free(struct soc_nna *pnna, struct soc_nna_oram_region *region)
+{
+    bitmap_clear(pnna->oram_bitmap, (region->oram.paddr - SOC_NNA_ORAM_ADDR) >> PAGE_SHIFT, region->oram.size >> PAGE_SHIFT);
+    list_del(&region->list);
+    kfree(region);
+}
+
+static long soc_nna_oram_free(struct soc_nna *pnna, struct soc_nna_file *pf, long usr_arg)
+{
+    struct soc_nna_oram_region *region = NULL;
+    soc_nna_oram_t oram;
+    long ret = -EINVAL;
+
+	if (copy_from_user(&oram, (void *)usr_arg, sizeof(oram))) {
+        dev_err(pnna->mdev.this_device, "%s(%d) [%d:%d]:copy_from_user failed\n", __func__, __LINE__, current->tgid, current->pid);
+		return -EFAULT;
+	}
+
+    mutex_lock(&pnna->mlock);
+    list_for_each_entry(region, &pnna->oram_list, list) {
+        if (region->owner == pf && region->oram.paddr == oram.paddr) {
+            /* another file could be given the oram still mapped here */
+            if (atomic_read(&region->maps)) {
+                ret = -EBUSY;
+                break;
+            }
+            soc_nna_oram_region_free(pnna, region);
+            ret = 0;
+            break;
+        }
+    }
+    mutex_unlock(&pnna->mlock);
+
+    return ret;
+}
+
+static void soc_nna_oram_vm_open(struct vm_area_struct *vma)
+{
+    struct soc_nna *pnna = vma->vm_private_data;
+
+    atomic_inc(&pnna->oram_legacy_maps);
+}
+
+static void soc_nna_oram_vm_close(struct vm_area_struct *vma)
+{
+    struct soc_nna *pnna = vma->vm_private_data;
+
+    atomic_dec(&pnna->oram_legacy_maps);
+}
+
+static const struct vm_operations_struct soc_nna_oram_vm_ops = {
+    .open = soc_nna_oram_vm_open,
+    .close = soc_nna_oram_vm_close,
+};
+
+static void soc_nna_oram_region_vm_open(struct vm_area_struct *vma)
+{
+    struct soc_nna_oram_region *region = vma->vm_private_data;
+
+    atomic_inc(&region->maps);
+}
+
+static void soc_nna_oram_region_vm_close(struct vm_area_struct *vma)
+{
+    struct soc_nna_oram_region *region = vma->vm_private_data;
+
+    atomic_dec(&region->maps);
+}
+
+static const struct vm_operations_struct soc_nna_oram_region_vm_ops = {
+    .open = soc_nna_oram_region_vm_open,
+    .close = soc_nna_oram_region_vm_close,
+};
+
+/*
+ * Once oram is partitioned, mappings must lie inside one region of pf and
+ * keep it from being freed. Unpartitioned mappings are counted and block
+ * ORAM_ALLOC while alive.
+ */
+static int soc_nna_oram_mmap(struct soc_nna *pnna, struct soc_nna_file *pf, struct vm_area_struct *vma, unsigned long start, unsigned long end, int extend)
+{
+    struct soc_nna_oram_region *region = NULL;
+    int ret = 0;
+
+    mutex_lock(&pnna->mlock);
+    if (list_empty(&pnna->oram_list)) {
+        vma->vm_private_data = pnna;
+        vma->vm_ops = &soc_nna_oram_vm_ops;
+        atomic_inc(&pnna->oram_legacy_maps);
+    } else {
+        ret = -EACCES;
+        list_for_each_entry(region, &pnna->oram_list, list) {
+            if (!extend && region->owner == pf && start >= region->oram.paddr && end <= region->oram.paddr + region->oram.size) {
+                vma->vm_private_data = region;
+                vma->vm_ops = &soc_nna_oram_region_vm_ops;
+                atomic_inc(&region->maps);
+                ret = 0;
+                break;
+            }
+        }
+    }
+    mutex_unlock(&pnna->mlock);
+
+    return ret;
+}
+
+static int soc_nna_oram_show(struct seq_file *m, void *v)
+{
+    struct soc_nna *pnna = (struct soc_nna *)(m->private);
+    struct soc_nna_oram_region *region = NULL;
+
+    mutex_lock(&pnna->mlock);
+    seq_printf(m, "oram 0x%08x size 0x%x, unpartitioned maps %d\n", SOC_NNA_ORAM_ADDR, pnna->oram_size, atomic_read(&pnna->oram_legacy_maps));
+    list_for_each_entry(region, &pnna->oram_list, list)
+        seq_printf(m, "0x%08x-0x%08x pid %d (%s)\n", region->oram.paddr, region->oram.paddr + region->oram.size, region->tgid, region->comm);
+    mutex_unlock(&pnna->mlock);
+
+    return 0;
+}
+
+static int soc_nna_oram_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, soc_nna_oram_show, PDE_DATA(inode));
+}
+
+static const struct file_operations soc_nna_oram_fops = {
+    .read = seq_read,
+    .open = soc_nna_oram_open,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+static int soc_nna_stat_show(struct seq_file *m, void *v)
+{
+    struct soc_nna *pnna = (struct soc_nna *)(m->private);
+    static const char *name[SOC_NNA_CHN_CNT] = { "rd", "wr" };
+    struct soc_nna_stats stats;
+    unsigned long flags;
+    ktime_t now;
+    u64 elapsed = 0;
+    int chn = 0;
+
+    spin_lock_irqsave(&pnna->irq_lock, flags);
+    now = ktime_get();
+    stats = pnna->stats;
+    if (pnna->busy)
+        stats.busy_ns += ktime_to_ns(ktime_sub(now, stats.busy_start));
+    spin_unlock_irqrestore(&pnna->irq_lock, flags);
+
+    elapsed = ktime_to_ns(ktime_sub(now, stats.reset));
+    seq_printf(m, "elapsed %llu us, dma busy %llu us (%llu%%)\n", div_u64(elapsed, NSEC_PER_USEC), div_u64(stats.busy_ns, NSEC_PER_USEC),
+            elapsed ? div64_u64(stats.busy_ns * 100, elapsed) : 0);
+    for (chn = 0; chn < SOC_NNA_CHN_CNT; chn++) {
+        /* bytes per ns * 1000 is MB/s */
+        seq_printf(m, "%s: chains %u, bytes %llu, busy %llu us, %llu MB/s while busy, %llu MB/s overall\n", name[chn],
+                stats.chn_runs[chn], stats.chn_bytes[chn], div_u64(stats.chn_ns[chn], NSEC_PER_USEC),
+                stats.chn_ns[chn] ? div64_u64(stats.chn_bytes[chn] * 1000, stats.chn_ns[chn]) : 0,
+                elapsed ? div64_u64(stats.chn_bytes[chn] * 1000, elapsed) : 0);
+    }
+    seq_printf(m, "jobs %u, submit to done avg %llu us, max %llu us\n", stats.jobs,
+            stats.jobs ? div_u64(div_u64(stats.job_ns, stats.jobs), NSEC_PER_USEC) : 0, div_u64(stats.job_max_ns, NSEC_PER_USEC));
+
+    return 0;
+}
+
+static int soc_nna_stat_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, soc_nna_stat_show, PDE_DATA(inode));
+}
+
+/* any write clears the counters, a running chain is counted from its start */
+static ssize_t soc_nna_stat_write(struct file *file, const char __user *buf, size_t len, loff_t *off)
+{
+    struct seq_file *m = file->private_data;
+    struct soc_nna *pnna = (struct soc_nna *)(m->private);
+    struct soc_nna_stats *stats = &pnna->stats;
+    unsigned long flags;
+
+    spin_lock_irqsave(&pnna->irq_lock, flags);
+    stats->reset = ktime_get();
+    stats->busy_ns = 0;
+    memset(stats->chn_ns, 0, sizeof(stats->chn_ns));
+    memset(stats->chn_bytes, 0, sizeof(stats->chn_bytes));
+    memset(stats->chn_runs, 0, sizeof(stats->chn_runs));
+    stats->jobs = 0;
+    stats->job_ns = 0;
+    stats->job_max_ns = 0;
+    spin_unlock_irqrestore(&pnna->irq_lock, flags);
+
+    return len;
+}
+
+static const struct file_operations soc_nna_stat_fops = {
+    .read = seq_read,
+    .write = soc_nna_stat_write,
+    .open = soc_nna_stat_open,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
 /**
  * According to mips memory architecture, the user space range is [0x00000000 ~ 0x800000000], but the io memory is [0x10000000 to 0x20000000];
  * the io memory should be mapped to uncached.
@@ -597,13 +1936,10 @@ static int soc_nna_mmap(struct file *file, struct vm_area_struct *vma)
 	uint32_t nmem_addr = 0;
 	uint32_t nmem_size = 0;
 	uint32_t n = 0, set_oram_nums = 0;
-    struct miscdevice *mdev = file->private_data;
+    struct soc_nna_file *pf = file->private_data;
+    struct miscdevice *mdev = &pf->pnna->mdev;
 	unsigned long paddr_start = vma->vm_pgoff << PAGE_SHIFT;
 	unsigned long paddr_end = paddr_start + vma->vm_end - vma->vm_start;
-#ifdef CONFIG_SOC_T40
-	unsigned int oram_size_cmd_t = 0, oram_real_size = 0;
-	unsigned int l2cache_size = 0;
-#endif
 	uint32_t mmap_type = 0;
 	uint32_t extend = 0;
 
@@ -622,6 +1958,9 @@ static int soc_nna_mmap(struct file *file, struct vm_area_struct *vma)
 	}else if((paddr_start < 0x12620000 ) && (paddr_end > 0x12620000)) {
 		mmap_type = 1; //oram
 		extend = 1;
+	}else if((paddr_start > 0x12620000) && (paddr_start < 0x12620000 + pf->pnna->oram_size)) {
+		mmap_type = 1; //oram region
+		extend = 0;
 	} else {
 		mmap_type = 3;// nmem
 		if(paddr_start == nmem_addr)
@@ -631,31 +1970,12 @@ static int soc_nna_mmap(struct file *file, struct vm_area_struct *vma)
 			extend = 1;
 		}
 	}
-#ifdef CONFIG_SOC_T40
-	/* l2cache_size + ORAM = 1*1024*1024 这里是获取l2cache size，根据l2cache size来得到ORAM size */
-	oram_size_cmd_t = *((volatile unsigned int *)(0xb2200060));
-	switch((oram_size_cmd_t & 0x1c00) >> 10)
-	{
-		case 1:
-			l2cache_size = 128;
-			oram_real_size = 1024 - l2cache_size;
-			break;
-		case 2:
-			l2cache_size = 256;
-			oram_real_size = 1024 - l2cache_size;
-			break;
-		case 3:
-			l2cache_size = 512;
-			oram_real_size = 1024 - l2cache_size;
-			break;
-		case 4:
-			l2cache_size = 1024;
-			oram_real_size = 1024 - l2cache_size;
-			break;
-		default:
-			break;
+	if (mmap_type == 1) {
+		if (soc_nna_oram_mmap(pf->pnna, pf, vma, paddr_start, paddr_end, extend)) {
+			dev_err(mdev->this_device, "%s(%d) [%d:%d]: oram 0x%lx-0x%lx is not owned\n", __func__, __LINE__, current->tgid, current->pid, paddr_start, paddr_end);
+			return -EACCES;
+		}
 	}
-#endif
 	/* 根据不同虚拟地址的类型来设置属性 */
 	if(mmap_type != 3){
 		pgprot_val(vma->vm_page_prot) &= ~_CACHE_MASK;
@@ -669,15 +1989,11 @@ static int soc_nna_mmap(struct file *file, struct vm_area_struct *vma)
 	if (extend == 0){
 		if (io_remap_pfn_range(vma, vma->vm_start, vma->vm_pgoff, vma->vm_end - vma->vm_start, vma->vm_page_prot)) {
 			dev_err(mdev->this_device, "%s(%d) [%d:%d]: io_remap_pfn_range failed\n", __func__, __LINE__, current->tgid, current->pid);
-			return -EAGAIN;
+			goto err_remap;
 		}
 	}else {
 		unsigned int real_paddr = 0x12620000;
-#ifdef CONFIG_SOC_T41
-		unsigned int real_size = 384 * 1024;//目前T41的oram_size 为 384 *1024
-#elif defined(CONFIG_SOC_T40)
-		unsigned int real_size = oram_real_size * 1024;//896 * 1024
-#endif
+		unsigned int real_size = pf->pnna->oram_size;
 		unsigned int before_s = 0;
 		unsigned int after_s = 0;
 		if(mmap_type !=1)//oram
@@ -698,12 +2014,12 @@ static int soc_nna_mmap(struct file *file, struct vm_area_struct *vma)
 			for(n = 0 ; n < set_oram_nums; n++){
 				if (io_remap_pfn_range(vma, vma->vm_start + n * real_size, real_paddr>>PAGE_SHIFT, (before_s % real_size)&&(n == (set_oram_nums -1)) ? before_s % real_size : real_size , vma->vm_page_prot)) {
 					dev_err(mdev->this_device, "%s(%d) [%d:%d]: io_remap_pfn_range failed\n", __func__, __LINE__, current->tgid, current->pid);
-					return -EAGAIN;
+					goto err_remap;
 				}
 			}
 			if (io_remap_pfn_range(vma, vma->vm_start + before_s, real_paddr>>PAGE_SHIFT, real_size, vma->vm_page_prot)) {
 				dev_err(mdev->this_device, "%s(%d) [%d:%d]: io_remap_pfn_range failed\n", __func__, __LINE__, current->tgid, current->pid);
-				return -EAGAIN;
+				goto err_remap;
 			}
 			after_s = paddr_end - real_paddr - real_size;
 			set_oram_nums = after_s / real_size;
@@ -711,11 +2027,16 @@ static int soc_nna_mmap(struct file *file, struct vm_area_struct *vma)
 			for(n = 0; n < set_oram_nums ; n++){
 				if (io_remap_pfn_range(vma, vma->vm_start+ before_s + real_size * (n + 1) , real_paddr>>PAGE_SHIFT,(after_s % real_size)&&(n == (set_oram_nums -1)) ? after_s % real_size : real_size, vma->vm_page_prot)) {
 					dev_err(mdev->this_device, "%s(%d) [%d:%d]: io_remap_pfn_range failed\n", __func__, __LINE__, current->tgid, current->pid);
-					return -EAGAIN;
+					goto err_remap;
 				}
 			}
 	}
 	return 0;
+
+err_remap:
+	if (vma->vm_ops && vma->vm_ops->close)
+		vma->vm_ops->close(vma);
+	return -EAGAIN;
 }
 
 static const struct file_operations soc_nna_fops = {
@@ -757,8 +2078,30 @@ static int soc_nna_probe(struct platform_device *pdev)
     pnna->dev = &pdev->dev;
 
     mutex_init(&pnna->mlock);
+    spin_lock_init(&pnna->irq_lock);
+    init_waitqueue_head(&pnna->done_wq);
+    INIT_LIST_HEAD(&pnna->job_queue);
+    pnna->stats.reset = ktime_get();
+    hrtimer_init(&pnna->poll_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    pnna->poll_timer.function = soc_nna_poll_timer;
 
     INIT_LIST_HEAD(&pnna->memory_list);
+    INIT_LIST_HEAD(&pnna->des_cache);
+    pnna->des_scratch = kmalloc(SOC_NNA_DMA_DESRAM_SIZE, GFP_KERNEL);
+    if (!pnna->des_scratch) {
+        dev_err(&pdev->dev, "kmalloc des scratch failed\n");
+        ret = -ENOMEM;
+        goto err_kmalloc_des_scratch;
+    }
+    INIT_LIST_HEAD(&pnna->oram_list);
+    pnna->oram_size = soc_nna_oram_size();
+    pnna->oram_pages = pnna->oram_size >> PAGE_SHIFT;
+    pnna->oram_bitmap = kzalloc(BITS_TO_LONGS(pnna->oram_pages + 1) * sizeof(unsigned long), GFP_KERNEL);
+    if (!pnna->oram_bitmap) {
+        dev_err(&pdev->dev, "kzalloc oram bitmap failed\n");
+        ret = -ENOMEM;
+        goto err_kzalloc_oram_bitmap;
+    }
     pnna->memory_cache = kmem_cache_create(pnna->name, sizeof(struct soc_nna_memory_cache), 0, SLAB_HWCACHE_ALIGN, NULL);
     if (!pnna->memory_cache) {
         printk("%s:kmem_cache_create failed\n", __func__);
@@ -821,6 +2164,12 @@ static int soc_nna_probe(struct platform_device *pdev)
 
     oram_clk = *(volatile unsigned int*)0xb2200060;
     *(volatile unsigned int *)0xb2200060 = oram_clk | (1 << 5);
+
+    pnna->proc = jz_proc_mkdir("nna");
+    if (pnna->proc) {
+        proc_create_data("oram", S_IRUGO, pnna->proc, &soc_nna_oram_fops, pnna);
+        proc_create_data("stat", S_IRUGO | S_IWUSR, pnna->proc, &soc_nna_stat_fops, pnna);
+    }
     printk("@@@@ soc nna probe sucess (Board: %s, Version: %s) @@@\n", SOC_NNA_BORD, SOC_NNA_VERSION);
 
     return 0;
@@ -840,6 +2189,10 @@ err_ioremap_iomem:
 err_get_iomem_resource:
     kmem_cache_destroy(pnna->memory_cache);
 err_kmem_cache_create:
+    kfree(pnna->oram_bitmap);
+err_kzalloc_oram_bitmap:
+    kfree(pnna->des_scratch);
+err_kmalloc_des_scratch:
 err_snprintf_name:
     kfree(pnna);
 err_kzalloc_soc_nna:
@@ -849,8 +2202,16 @@ err_kzalloc_soc_nna:
 static int __exit soc_nna_remove(struct platform_device *pdev)
 {
     struct soc_nna *pnna = platform_get_drvdata(pdev);
+    struct soc_nna_job_entry *job = NULL, *n = NULL;
+
     if (pnna) {
+        if (pnna->proc)
+            proc_remove(pnna->proc);
         misc_deregister(&pnna->mdev);
+        hrtimer_cancel(&pnna->poll_timer);
+        list_for_each_entry_safe(job, n, &pnna->job_queue, list)
+            kfree(job);
+        kfree(pnna->job_cur);
 #ifndef CPU_SIMULATOR
         clk_put(pnna->clk_gate);
         clk_put(pnna->clk);
@@ -858,6 +2219,9 @@ static int __exit soc_nna_remove(struct platform_device *pdev)
         iounmap((void *)pnna->dmamem);
         iounmap(pnna->iomem);
         kmem_cache_destroy(pnna->memory_cache);
+        soc_nna_des_cache_invalidate(pnna);
+        kfree(pnna->des_scratch);
+        kfree(pnna->oram_bitmap);
         kfree(pnna);
     }
 
@@ -3,15 +3,24 @@
 #include <linux/version.h>
 #include <linux/types.h>
 #include <linux/bug.h>
+#include <txx-funcs.h>
 #include "tx-isp-module.h"
 
 static int __init tx_isp_driver_init(void)
 {
-	return tx_isp_init();
+	int ret;
+
+	private_funcs_stats_init();
+	ret = tx_isp_init();
+	if (ret)
+		private_funcs_stats_exit();
+
+	return ret;
 }
 static void __exit tx_isp_driver_exit(void)
 {
-	return tx_isp_exit();
+	tx_isp_exit();
+	private_funcs_stats_exit();
 }
 
 module_init(tx_isp_driver_init);
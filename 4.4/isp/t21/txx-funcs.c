@@ -8,6 +8,7 @@
  */
 
 #include <txx-funcs.h>
+#include <private-funcs-stats.h>
 #include <tx-isp-debug.h>
 
 struct resource * private_request_mem_region(resource_size_t start, resource_size_t n,
@@ -77,7 +78,12 @@ void  private_init_waitqueue_head(wait_queue_head_t *q)
 
 unsigned long  private_wait_for_completion_timeout(struct completion *x, unsigned long timeout)
 {
-	return wait_for_completion_timeout(x, timeout);
+	ktime_t start = funcs_stat_begin();
+	unsigned long ret;
+
+	ret = wait_for_completion_timeout(x, timeout);
+	funcs_stat_end(PFS_WAIT_COMPLETION, start);
+	return ret;
 }
 
 void  private_proc_remove(struct proc_dir_entry *de)
@@ -133,12 +139,22 @@ void  private_kfree(void *p)
 
 long  private_copy_from_user(void *to, const void __user *from, long size)
 {
-	return copy_from_user(to, from, size);
+	ktime_t start = funcs_stat_begin();
+	long ret;
+
+	ret = copy_from_user(to, from, size);
+	funcs_stat_end(PFS_COPY_FROM_USER, start);
+	return ret;
 }
 
 long  private_copy_to_user(void __user *to, const void *from, long size)
 {
-	return copy_to_user(to, from, size);
+	ktime_t start = funcs_stat_begin();
+	long ret;
+
+	ret = copy_to_user(to, from, size);
+	funcs_stat_end(PFS_COPY_TO_USER, start);
+	return ret;
 }
 
 /* netlink */
@@ -280,5 +280,7 @@ struct proc_dir_entry* private_jz_proc_mkdir(char *s);
 void private_get_isp_priv_mem(unsigned int *phyaddr, unsigned int *size);
 
 int private_driver_get_interface(void);
+void private_funcs_stats_init(void);
+void private_funcs_stats_exit(void);
 
 #endif /*__TXX_DRV_FUNCS_H__*/
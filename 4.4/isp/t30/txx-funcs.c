@@ -8,6 +8,7 @@
  */
 
 #include <txx-funcs.h>
+#include <private-funcs-stats.h>
 
 static const unsigned int __pow2_lut[33]={
 		1073741824,1097253708,1121280436,1145833280,1170923762,1196563654,1222764986,1249540052,
@@ -276,7 +277,10 @@ void private_spin_lock_init(spinlock_t *lock)
 #endif
 void private_mutex_lock(struct mutex *lock)
 {
+	ktime_t start = funcs_stat_begin();
+
 	pfaces->mutex_lock(lock);
+	funcs_stat_end(PFS_MUTEX_LOCK, start);
 }
 
 void private_mutex_unlock(struct mutex *lock)
@@ -297,7 +301,12 @@ struct clk * private_clk_get(struct device *dev, const char *id)
 
 int private_clk_enable(struct clk *clk)
 {
-	return pfaces->clk_enable(clk);
+	ktime_t start = funcs_stat_begin();
+	int ret;
+
+	ret = pfaces->clk_enable(clk);
+	funcs_stat_end(PFS_CLK_ENABLE, start);
+	return ret;
 }
 EXPORT_SYMBOL(private_clk_enable);
 
@@ -308,7 +317,10 @@ int private_clk_is_enabled(struct clk *clk)
 
 void private_clk_disable(struct clk *clk)
 {
+	ktime_t start = funcs_stat_begin();
+
 	pfaces->clk_disable(clk);
+	funcs_stat_end(PFS_CLK_DISABLE, start);
 }
 EXPORT_SYMBOL(private_clk_disable);
 
@@ -320,7 +332,12 @@ EXPORT_SYMBOL(private_clk_put);
 
 int private_clk_set_rate(struct clk *clk, unsigned long rate)
 {
-	return pfaces->clk_set_rate(clk, rate);
+	ktime_t start = funcs_stat_begin();
+	int ret;
+
+	ret = pfaces->clk_set_rate(clk, rate);
+	funcs_stat_end(PFS_CLK_SET_RATE, start);
+	return ret;
 }
 EXPORT_SYMBOL(private_clk_set_rate);
 
@@ -342,7 +359,12 @@ void private_i2c_put_adapter(struct i2c_adapter *adap)
 
 int private_i2c_transfer(struct i2c_adapter *adap, struct i2c_msg *msgs, int num)
 {
-	return pfaces->i2c_transfer(adap, msgs, num);
+	ktime_t start = funcs_stat_begin();
+	int ret;
+
+	ret = pfaces->i2c_transfer(adap, msgs, num);
+	funcs_stat_end(PFS_I2C_TRANSFER, start);
+	return ret;
 }
 EXPORT_SYMBOL(private_i2c_transfer);
 
@@ -388,7 +410,12 @@ void private_i2c_unregister_device(struct i2c_client *client)
 /* gpio interfaces */
 int private_gpio_request(unsigned gpio, const char *label)
 {
-	return pfaces->gpio_request(gpio, label);
+	ktime_t start = funcs_stat_begin();
+	int ret;
+
+	ret = pfaces->gpio_request(gpio, label);
+	funcs_stat_end(PFS_GPIO_REQUEST, start);
+	return ret;
 }
 EXPORT_SYMBOL(private_gpio_request);
 
@@ -400,7 +427,12 @@ EXPORT_SYMBOL(private_gpio_free);
 
 int private_gpio_direction_output(unsigned gpio, int value)
 {
-	return pfaces->gpio_direction_output(gpio, value);
+	ktime_t start = funcs_stat_begin();
+	int ret;
+
+	ret = pfaces->gpio_direction_output(gpio, value);
+	funcs_stat_end(PFS_GPIO_OUTPUT, start);
+	return ret;
 }
 EXPORT_SYMBOL(private_gpio_direction_output);
 
@@ -416,7 +448,12 @@ int private_gpio_set_debounce(unsigned gpio, unsigned debounce)
 
 int private_jzgpio_set_func(enum gpio_port port, enum gpio_function func,unsigned long pins)
 {
-	return pfaces->jzgpio_set_func(port, func, pins);
+	ktime_t start = funcs_stat_begin();
+	int ret;
+
+	ret = pfaces->jzgpio_set_func(port, func, pins);
+	funcs_stat_end(PFS_JZGPIO_SET_FUNC, start);
+	return ret;
 }
 EXPORT_SYMBOL(private_jzgpio_set_func);
 
@@ -428,7 +465,10 @@ int private_jzgpio_ctrl_pull(enum gpio_port port, int enable_pull,unsigned long
 /* system interfaces */
 void private_msleep(unsigned int msecs)
 {
+	ktime_t start = funcs_stat_begin();
+
 	pfaces->msleep(msecs);
+	funcs_stat_end(PFS_MSLEEP, start);
 }
 EXPORT_SYMBOL(private_msleep);
 
@@ -471,7 +511,12 @@ void private_complete(struct completion *x)
 
 int private_wait_for_completion_interruptible(struct completion *x)
 {
-	return pfaces->wait_for_completion_interruptible(x);
+	ktime_t start = funcs_stat_begin();
+	int ret;
+
+	ret = pfaces->wait_for_completion_interruptible(x);
+	funcs_stat_end(PFS_WAIT_COMPLETION, start);
+	return ret;
 }
 
 /* misc driver interfaces */
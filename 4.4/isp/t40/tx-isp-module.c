@@ -10,18 +10,27 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/version.h>
+#include <txx-funcs.h>
 
 extern int tx_isp_init(void);
 extern void tx_isp_exit(void);
 
 static int __init tx_isp_module_init(void)
 {
-	return tx_isp_init();
+	int ret;
+
+	private_funcs_stats_init();
+	ret = tx_isp_init();
+	if (ret)
+		private_funcs_stats_exit();
+
+	return ret;
 }
 
 static void __exit tx_isp_module_exit(void)
 {
 	tx_isp_exit();
+	private_funcs_stats_exit();
 }
 
 module_init(tx_isp_module_init);
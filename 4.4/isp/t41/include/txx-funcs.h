@@ -70,6 +70,8 @@ int get_isp_clk(void);
 int get_isp_clks(void);
 int get_isp_clka(void);
 int get_isp_memopt(void);
+void private_funcs_stats_init(void);
+void private_funcs_stats_exit(void);
 void *private_vmalloc(unsigned long size);
 void private_vfree(const void *addr);
 
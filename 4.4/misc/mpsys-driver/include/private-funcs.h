@@ -50,6 +50,8 @@ void private_misc_deregister(struct miscdevice *misc);
 
 /* system interfaces */
 void private_msleep(unsigned int msecs);
+void private_funcs_stats_init(void);
+void private_funcs_stats_exit(void);
 
 /* proc file interfaces */
 struct proc_dir_entry *private_proc_create_data(const char *name, umode_t mode, struct proc_dir_entry *parent,const struct file_operations *proc_fops, void *data);
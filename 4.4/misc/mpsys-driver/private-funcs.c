@@ -1,4 +1,5 @@
 #include "include/private-funcs.h"
+#include <private-funcs-stats.h>
 
 /* semaphore and mutex interfaces */
 int private_down_interruptible(struct semaphore *sem)
@@ -13,7 +14,10 @@ void private_up(struct semaphore *sem)
 
 void private_mutex_lock(struct mutex *lock)
 {
+	ktime_t start = funcs_stat_begin();
+
 	mutex_lock(lock);
+	funcs_stat_end(PFS_MUTEX_LOCK, start);
 }
 
 void private_mutex_unlock(struct mutex *lock)
@@ -39,7 +43,12 @@ void private_complete(struct completion *x)
 
 int private_wait_for_completion_interruptible(struct completion *x)
 {
-	return wait_for_completion_interruptible(x);
+	ktime_t start = funcs_stat_begin();
+	int ret;
+
+	ret = wait_for_completion_interruptible(x);
+	funcs_stat_end(PFS_WAIT_COMPLETION, start);
+	return ret;
 }
 
 int private_wait_event_interruptible(wait_queue_head_t *wq, int (* state)(void))
@@ -65,12 +74,22 @@ void private_kfree(void *p)
 
 long private_copy_from_user(void *to, const void __user *from, long size)
 {
-	return copy_from_user(to, from, size);
+	ktime_t start = funcs_stat_begin();
+	long ret;
+
+	ret = copy_from_user(to, from, size);
+	funcs_stat_end(PFS_COPY_FROM_USER, start);
+	return ret;
 }
 
 long private_copy_to_user(void __user *to, const void *from, long size)
 {
-	return copy_to_user(to, from, size);
+	ktime_t start = funcs_stat_begin();
+	long ret;
+
+	ret = copy_to_user(to, from, size);
+	funcs_stat_end(PFS_COPY_TO_USER, start);
+	return ret;
 }
 
 /* file ops */
@@ -119,7 +138,10 @@ void private_misc_deregister(struct miscdevice *misc)
 /* system interfaces */
 void private_msleep(unsigned int msecs)
 {
+    ktime_t start = funcs_stat_begin();
+
     msleep(msecs);
+    funcs_stat_end(PFS_MSLEEP, start);
 }
 
 /* proc file interfaces */
@@ -0,0 +1,153 @@
+/*
+ * Call counters of the private_* wrappers.
+ *
+ * Every module that carries a copy of the private funcs shim (the ISP
+ * txx-funcs.c/tx-isp-funcs.c and mpsys private-funcs.c) includes this
+ * header once, from that file, and brackets the wrappers that may sleep or
+ * touch the bus with funcs_stat_begin()/funcs_stat_end(). The module init
+ * calls private_funcs_stats_init() and its exit private_funcs_stats_exit().
+ *
+ * Counting is off unless the funcs_stats module parameter is set, a
+ * disabled call costs one flag test. The totals are in
+ * <debugfs>/<module>_funcs_stats, so modules loaded side by side each get
+ * their own file; write anything to it to clear.
+ */
+#ifndef __PRIVATE_FUNCS_STATS_H__
+#define __PRIVATE_FUNCS_STATS_H__
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/atomic.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/fs.h>
+#include <linux/err.h>
+
+static int funcs_stats;
+module_param(funcs_stats, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(funcs_stats, "count calls and time of the private wrappers");
+
+enum {
+	PFS_MSLEEP,
+	PFS_MDELAY,
+	PFS_I2C_TRANSFER,
+	PFS_CLK_ENABLE,
+	PFS_CLK_DISABLE,
+	PFS_CLK_SET_RATE,
+	PFS_GPIO_REQUEST,
+	PFS_GPIO_OUTPUT,
+	PFS_JZGPIO_SET_FUNC,
+	PFS_MUTEX_LOCK,
+	PFS_WAIT_COMPLETION,
+	PFS_COPY_FROM_USER,
+	PFS_COPY_TO_USER,
+	PFS_NR,
+};
+
+static const char *funcs_stat_names[PFS_NR] = {
+	[PFS_MSLEEP]		= "msleep",
+	[PFS_MDELAY]		= "mdelay",
+	[PFS_I2C_TRANSFER]	= "i2c_transfer",
+	[PFS_CLK_ENABLE]	= "clk_enable",
+	[PFS_CLK_DISABLE]	= "clk_disable",
+	[PFS_CLK_SET_RATE]	= "clk_set_rate",
+	[PFS_GPIO_REQUEST]	= "gpio_request",
+	[PFS_GPIO_OUTPUT]	= "gpio_direction_output",
+	[PFS_JZGPIO_SET_FUNC]	= "jzgpio_set_func",
+	[PFS_MUTEX_LOCK]	= "mutex_lock",
+	[PFS_WAIT_COMPLETION]	= "wait_for_completion",
+	[PFS_COPY_FROM_USER]	= "copy_from_user",
+	[PFS_COPY_TO_USER]	= "copy_to_user",
+};
+
+static struct funcs_stat {
+	atomic_t	calls;
+	atomic64_t	ns;
+	u64		max_ns;		/* racy, only a hint */
+} funcs_stat[PFS_NR];
+
+static struct dentry *funcs_stats_dentry;
+
+static inline ktime_t funcs_stat_begin(void)
+{
+	return funcs_stats ? ktime_get() : ktime_set(0, 0);
+}
+
+/* a call started before counting was enabled is not accounted */
+static inline void funcs_stat_end(int id, ktime_t start)
+{
+	struct funcs_stat *st = &funcs_stat[id];
+	s64 ns;
+
+	if (!ktime_to_ns(start))
+		return;
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	atomic_inc(&st->calls);
+	atomic64_add(ns, &st->ns);
+	if (ns > st->max_ns)
+		st->max_ns = ns;
+}
+
+static int funcs_stats_show(struct seq_file *m, void *v)
+{
+	u64 ns;
+	int i;
+
+	seq_printf(m, "%-24s %10s %12s %10s\n", "func", "calls", "total_us", "max_us");
+	for (i = 0; i < PFS_NR; i++) {
+		ns = atomic64_read(&funcs_stat[i].ns);
+		seq_printf(m, "%-24s %10u %12llu %10llu\n", funcs_stat_names[i],
+			   atomic_read(&funcs_stat[i].calls),
+			   div_u64(ns, NSEC_PER_USEC),
+			   div_u64(funcs_stat[i].max_ns, NSEC_PER_USEC));
+	}
+
+	return 0;
+}
+
+static int funcs_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, funcs_stats_show, NULL);
+}
+
+static ssize_t funcs_stats_write(struct file *file, const char __user *buf,
+				 size_t len, loff_t *off)
+{
+	int i;
+
+	for (i = 0; i < PFS_NR; i++) {
+		atomic_set(&funcs_stat[i].calls, 0);
+		atomic64_set(&funcs_stat[i].ns, 0);
+		funcs_stat[i].max_ns = 0;
+	}
+
+	return len;
+}
+
+static const struct file_operations funcs_stats_fops = {
+	.open = funcs_stats_open,
+	.read = seq_read,
+	.write = funcs_stats_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+void private_funcs_stats_init(void)
+{
+	/* debugfs is optional, the wrappers work without the file */
+	funcs_stats_dentry = debugfs_create_file(KBUILD_MODNAME "_funcs_stats", S_IRUGO | S_IWUSR,
+						 NULL, NULL, &funcs_stats_fops);
+	if (IS_ERR_OR_NULL(funcs_stats_dentry))
+		funcs_stats_dentry = NULL;
+}
+
+void private_funcs_stats_exit(void)
+{
+	debugfs_remove(funcs_stats_dentry);
+	funcs_stats_dentry = NULL;
+}
+
+#endif /* __PRIVATE_FUNCS_STATS_H__ */